@@ -8,8 +8,45 @@
 #include <sstream>
 #include <fstream>
 #include <set>
+#include <deque>
+#include <map>
+#include <functional>
+#include <type_traits>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <random>
 #include <assert.h>
 
+#ifdef AVULKAN_WITH_BASISU
+#include <basisu_transcoder.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AVULKAN_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVULKAN_TARGET_AVX
+#else
+#define AVULKAN_TARGET_AVX __attribute__((target("avx")))
+#endif
+#endif
+
 // Global Settings
 const char                      APPNAME[] = "VulkanDemo";
 const char                      ENGINENAME[] = "VulkanDemoEngine";
@@ -20,9 +57,23 @@ VkSurfaceTransformFlagBitsKHR   vkTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_
 VkFormat                        vkFormat = VK_FORMAT_B8G8R8A8_SRGB;
 VkColorSpaceKHR                 vkColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
 VkImageUsageFlags               vkImageUsageFlags = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+bool                            shaderHotReload = true;
+bool                            depthPrepass = true;
+VkSampleCountFlagBits           msaaSamples = VK_SAMPLE_COUNT_4_BIT;
+bool                            gpuDrivenRendering = true;
+bool                            occlusionCulling = true;
+bool                            bindlessResources = true;
+uint32_t                        instanceGridSize = 8;
+VkDeviceSize                    textureStreamingBudget = 256ull << 20;
+VkDeviceSize                    textureUploadBudget = 8ull << 20;
+const char*                     virtualTexturePath = "Textures/Terrain.ktx2";
+uint32_t                        virtualTextureCacheSize = 4096;
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+const char SHADER_SOURCE_DIR[] = "Shaders/GLSL";
+const char TEXTURE_DIR[] = "Textures";
+
 #define STRINGIFY( name ) #name
 
 #define Print(...) { printf(__VA_ARGS__); printf("\n"); } 
@@ -37,10 +88,49 @@ struct QueueFamilyIndices
 {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	std::optional<uint32_t> transferFamily;
+	std::optional<uint32_t> computeFamily;
 
 	bool isComplete() { return graphicsFamily.has_value() && presentFamily.has_value(); }
 };
 
+struct ShaderAsset
+{
+	std::string source;
+	std::string binary;
+	std::string defines;	//	Extra glslc arguments, lets one source build several variants.
+};
+
+//	Keep in sync with GenerateAssets.bat
+const std::vector<ShaderAsset> SHADER_ASSETS = {
+	{ "Shaders/GLSL/shader.vert", "Shaders/SPIR-V/vert.spv" },
+	{ "Shaders/GLSL/shader.frag", "Shaders/SPIR-V/frag.spv" },
+	{ "Shaders/GLSL/depth.vert", "Shaders/SPIR-V/depth_vert.spv" },
+	{ "Shaders/GLSL/cull.comp", "Shaders/SPIR-V/cull_comp.spv" },
+	{ "Shaders/GLSL/cull.comp", "Shaders/SPIR-V/cull_early_comp.spv", "-DOCCLUSION_EARLY" },
+	{ "Shaders/GLSL/cull.comp", "Shaders/SPIR-V/cull_late_comp.spv", "-DOCCLUSION_LATE" },
+	{ "Shaders/GLSL/hiz.comp", "Shaders/SPIR-V/hiz_comp.spv" },
+	{ "Shaders/GLSL/hiz.comp", "Shaders/SPIR-V/hiz_ms_comp.spv", "-DMULTISAMPLED" },
+	{ "Shaders/GLSL/shader.frag", "Shaders/SPIR-V/frag_bindless.spv", "-DBINDLESS" },
+};
+
+enum ShaderAssetIndex : size_t
+{
+	SHADER_ASSET_FORWARD_VERT = 0,
+	SHADER_ASSET_FORWARD_FRAG,
+	SHADER_ASSET_DEPTH_VERT,
+	SHADER_ASSET_CULL,
+	SHADER_ASSET_CULL_EARLY,
+	SHADER_ASSET_CULL_LATE,
+	SHADER_ASSET_HIZ,
+	SHADER_ASSET_HIZ_MS,
+	SHADER_ASSET_FORWARD_FRAG_BINDLESS,
+};
+
+//	Must match local_size_x in cull.comp and local_size_x/y in hiz.comp.
+const uint32_t GPU_CULL_GROUP_SIZE = 64;
+const uint32_t HIZ_GROUP_SIZE = 8;
+
 struct SwapChainSupportDetails
 {
 	VkSurfaceCapabilitiesKHR capabilities;
@@ -240,6 +330,28 @@ QueueFamilyIndices GetVulkanQueueFamilies(const VkPhysicalDevice& device, const
 			break;
 	}
 
+	//	A transfer-only family usually maps to the DMA engines, uploads submitted there run alongside rendering.
+	for (uint32_t i = 0; i < familyQueueCount; i++)
+	{
+		VkQueueFlags flags = queueFamilyProps[i].queueFlags;
+		if (queueFamilyProps[i].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			indices.transferFamily = i;
+			break;
+		}
+	}
+
+	//	A compute family without graphics runs async compute alongside rasterization.
+	for (uint32_t i = 0; i < familyQueueCount; i++)
+	{
+		VkQueueFlags flags = queueFamilyProps[i].queueFlags;
+		if (queueFamilyProps[i].queueCount > 0 && (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			indices.computeFamily = i;
+			break;
+		}
+	}
+
 	return indices;
 }
 
@@ -280,7 +392,52 @@ void GetVulkanPhysicalDevice(const VkInstance& instance, const VkSurfaceKHR& sur
 		throw std::exception("Vulkan: Unable to fin a compatible GPU");
 }
 
-void CreateVulkanLogicalDevice(VkPhysicalDevice& physicalDevice, const VkSurfaceKHR& surface, const std::vector<const char*>& layers, VkDevice& outLogicalDevice, VkQueue& outGraphicsQueue, VkQueue& outPresentQueue)
+#ifdef VK_KHR_synchronization2
+//	Loaded when the device supports VK_KHR_synchronization2, barriers fall back to vkCmdPipelineBarrier otherwise.
+PFN_vkCmdPipelineBarrier2KHR _vkCmdPipelineBarrier2KHR = nullptr;
+#endif
+PFN_vkCmdDrawIndexedIndirectCountKHR _vkCmdDrawIndexedIndirectCountKHR = nullptr;
+VkPhysicalDeviceFeatures enabledDeviceFeatures{};
+bool descriptorIndexingEnabled = false;
+bool memoryBudgetEnabled = false;
+
+//	The descriptor indexing features the bindless heap needs, core in 1.2 and VK_EXT_descriptor_indexing before.
+bool GetVulkanDescriptorIndexingSupport(const VkPhysicalDevice& physicalDevice, bool extensionAvailable)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	if (properties.apiVersion < VK_API_VERSION_1_1 || (properties.apiVersion < VK_API_VERSION_1_2 && !extensionAvailable))
+		return false;
+
+	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES };
+	VkPhysicalDeviceFeatures2 features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	features.pNext = &indexingFeatures;
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+	return indexingFeatures.runtimeDescriptorArray && indexingFeatures.descriptorBindingPartiallyBound &&
+		indexingFeatures.descriptorBindingSampledImageUpdateAfterBind && indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind &&
+		indexingFeatures.descriptorBindingUpdateUnusedWhilePending;
+}
+
+#ifdef VK_KHR_synchronization2
+//	The extension being listed does not mean the feature is, it has to be queried like any other.
+bool GetVulkanSynchronization2Support(const VkPhysicalDevice& physicalDevice, bool extensionAvailable)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	if (!extensionAvailable || properties.apiVersion < VK_API_VERSION_1_1)
+		return false;
+
+	VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR };
+	VkPhysicalDeviceFeatures2 features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	features.pNext = &synchronization2Features;
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+	return synchronization2Features.synchronization2 == VK_TRUE;
+}
+#endif
+
+void CreateVulkanLogicalDevice(VkPhysicalDevice& physicalDevice, const VkSurfaceKHR& surface, const std::vector<const char*>& layers, VkDevice& outLogicalDevice, VkQueue& outGraphicsQueue, VkQueue& outPresentQueue, VkQueue& outTransferQueue, VkQueue& outComputeQueue)
 {
 	QueueFamilyIndices indices = GetVulkanQueueFamilies(physicalDevice, surface);
 
@@ -289,7 +446,12 @@ void CreateVulkanLogicalDevice(VkPhysicalDevice& physicalDevice, const VkSurface
 	std::vector<float> queuePriority = { 1.0f };
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+	uint32_t transferFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+	uint32_t computeFamily = indices.computeFamily.value_or(indices.graphicsFamily.value());
+	std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value(), transferFamily, computeFamily };
+
+	Print("Vulkan: Using queue families - Graphics: %i, Present: %i, Transfer: %i%s, Compute: %i%s", indices.graphicsFamily.value(), indices.presentFamily.value(),
+		transferFamily, indices.transferFamily.has_value() ? " (dedicated)" : "", computeFamily, indices.computeFamily.has_value() ? " (async)" : "");
 
 	uint32_t devicePropertiesCount;
 	if (vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &devicePropertiesCount, nullptr) != VK_SUCCESS)
@@ -301,18 +463,33 @@ void CreateVulkanLogicalDevice(VkPhysicalDevice& physicalDevice, const VkSurface
 	if (vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &devicePropertiesCount, deviceProperties.data()) != VK_SUCCESS)
 		throw std::exception("Vulkan: Unable to acquire device extension properties");
 
+	//	Optional extensions only turn features on, their absence is reported and the feature falls back.
 	std::vector<const char*> devicePropertiesNames;
-	std::set<std::string> requestedExtensions{ VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	const std::set<std::string> requiredExtensions{ VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	std::set<std::string> optionalExtensions{ VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME };
+#ifdef VK_KHR_synchronization2
+	optionalExtensions.insert(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+#endif
 
+	std::set<std::string> missingExtensions = requiredExtensions;
+	missingExtensions.insert(optionalExtensions.begin(), optionalExtensions.end());
 	for (const auto& extensionProperty : deviceProperties)
 	{
-		auto it = requestedExtensions.find(std::string(extensionProperty.extensionName));
-		if (it != requestedExtensions.end())
+		if (missingExtensions.erase(std::string(extensionProperty.extensionName)))
 			devicePropertiesNames.emplace_back(extensionProperty.extensionName);
 	}
 
-	if (requestedExtensions.size() != devicePropertiesNames.size())
-		Print("Vulkan: Could not find all validation layers.");
+	std::string missingRequired;
+	for (const auto& extension : missingExtensions)
+	{
+		if (requiredExtensions.count(extension))
+			missingRequired += (missingRequired.empty() ? "" : ", ") + extension;
+		else
+			Print("Vulkan: Optional device extension %s is not available", extension.c_str());
+	}
+
+	if (!missingRequired.empty())
+		throw std::runtime_error("Vulkan: Missing required device extension(s) " + missingRequired);
 
 	for (const auto& devicePropertyName : devicePropertiesNames)
 		Print("Vulkan - Enabling Device Extension Property: %s", devicePropertyName);
@@ -335,11 +512,70 @@ void CreateVulkanLogicalDevice(VkPhysicalDevice& physicalDevice, const VkSurface
 	deviceCreateInfo.ppEnabledExtensionNames = devicePropertiesNames.data();
 	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(devicePropertiesNames.size());
 
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+	enabledDeviceFeatures = {};
+	enabledDeviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	enabledDeviceFeatures.fragmentStoresAndAtomics = supportedFeatures.fragmentStoresAndAtomics;
+	deviceCreateInfo.pEnabledFeatures = &enabledDeviceFeatures;
+
+	//	Optional feature structs are pushed onto the front of the device's pNext chain.
+	void* featureChain = nullptr;
+
+#ifdef VK_KHR_synchronization2
+	bool synchronization2Extension = std::any_of(devicePropertiesNames.begin(), devicePropertiesNames.end(), [](const char* name) { return strcmp(name, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) == 0; });
+	bool synchronization2 = GetVulkanSynchronization2Support(physicalDevice, synchronization2Extension);
+
+	VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR };
+	synchronization2Features.synchronization2 = VK_TRUE;
+	if (synchronization2)
+	{
+		synchronization2Features.pNext = featureChain;
+		featureChain = &synchronization2Features;
+	}
+	Print("Vulkan: Synchronization2 %s", synchronization2 ? "enabled" : "unavailable, barriers use vkCmdPipelineBarrier");
+#endif
+
+	bool descriptorIndexingExtension = std::any_of(devicePropertiesNames.begin(), devicePropertiesNames.end(), [](const char* name) { return strcmp(name, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0; });
+	descriptorIndexingEnabled = GetVulkanDescriptorIndexingSupport(physicalDevice, descriptorIndexingExtension);
+
+	VkPhysicalDeviceDescriptorIndexingFeatures descriptorIndexingFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES };
+	descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+	descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	if (descriptorIndexingEnabled)
+	{
+		descriptorIndexingFeatures.pNext = featureChain;
+		featureChain = &descriptorIndexingFeatures;
+	}
+
+	deviceCreateInfo.pNext = featureChain;
+	Print("Vulkan: Descriptor indexing %s", descriptorIndexingEnabled ? "enabled" : "unavailable, bindless resources disabled");
+
+	//	The budget is read through vkGetPhysicalDeviceMemoryProperties2, which needs 1.1.
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+	memoryBudgetEnabled = physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_1 &&
+		std::any_of(devicePropertiesNames.begin(), devicePropertiesNames.end(), [](const char* name) { return strcmp(name, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0; });
+
 	if (vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &outLogicalDevice) != VK_SUCCESS)
 		throw std::exception("Vulkan: Failed To create logical device");
 
+#ifdef VK_KHR_synchronization2
+	if (synchronization2)
+		_vkCmdPipelineBarrier2KHR = (PFN_vkCmdPipelineBarrier2KHR)vkGetDeviceProcAddr(outLogicalDevice, "vkCmdPipelineBarrier2KHR");
+#endif
+
+	if (std::any_of(devicePropertiesNames.begin(), devicePropertiesNames.end(), [](const char* name) { return strcmp(name, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0; }))
+		_vkCmdDrawIndexedIndirectCountKHR = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(outLogicalDevice, "vkCmdDrawIndexedIndirectCountKHR");
+
 	vkGetDeviceQueue(outLogicalDevice, indices.graphicsFamily.value(), 0, &outGraphicsQueue);
 	vkGetDeviceQueue(outLogicalDevice, indices.presentFamily.value(), 0, &outPresentQueue);
+	vkGetDeviceQueue(outLogicalDevice, transferFamily, 0, &outTransferQueue);
+	vkGetDeviceQueue(outLogicalDevice, computeFamily, 0, &outComputeQueue);
 }
 
 void CreateVulkanSurface(SDL_Window* window, VkInstance instance, VkSurfaceKHR& outSurface)
@@ -410,6 +646,52 @@ void GetVulkanImageFormat(const VkPhysicalDevice& device, const VkSurfaceKHR& su
 	outFormat = foundFormats[0];
 }
 
+//	sampled is for depth that shaders also read, like the Hi-Z build does.
+void GetVulkanDepthFormat(const VkPhysicalDevice& device, bool sampled, VkFormat& outFormat)
+{
+	//	Ordered by preference, the spec guarantees at least one of D32_SFLOAT and X8_D24_UNORM_PACK32.
+	const VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D16_UNORM };
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | (sampled ? VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT : 0);
+
+	for (VkFormat candidate : candidates)
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(device, candidate, &properties);
+		if ((properties.optimalTilingFeatures & required) == required)
+		{
+			outFormat = candidate;
+			return;
+		}
+	}
+
+	throw std::exception("Vulkan: No supported depth format");
+}
+
+//	Highest sample count up to the requested one that both color and depth framebuffers support. With sampledDepth
+//	the multisampled depth buffer must also be readable from shaders.
+void GetVulkanSampleCount(const VkPhysicalDevice& device, VkSampleCountFlagBits requested, bool sampledDepth, VkSampleCountFlagBits& outSamples)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(device, &properties);
+
+	VkSampleCountFlags supported = properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+	if (sampledDepth)
+		supported &= properties.limits.sampledImageDepthSampleCounts;
+
+	outSamples = VK_SAMPLE_COUNT_1_BIT;
+	for (VkSampleCountFlags samples = requested; samples > VK_SAMPLE_COUNT_1_BIT; samples >>= 1)
+	{
+		if (supported & samples)
+		{
+			outSamples = static_cast<VkSampleCountFlagBits>(samples);
+			break;
+		}
+	}
+
+	if (outSamples != requested)
+		Print("Vulkan: %ix MSAA is not supported, using %ix", static_cast<int>(requested), static_cast<int>(outSamples));
+}
+
 void CreateVulkanSwapchain(const VkSurfaceKHR& surface, const VkPhysicalDevice& physicalDevice, const VkDevice& device, VkSwapchainKHR& outSwapchain, VkSurfaceFormatKHR& outSurfaceFormat, VkExtent2D& outExtent)
 {
 	VkSurfaceCapabilitiesKHR surfaceCapabilities;
@@ -541,6 +823,30 @@ VkShaderModule CreateVulkanShaderModule(const VkDevice& device, const std::vecto
 	return shaderModule;
 }
 
+uint32_t GetVulkanFormatSize(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_R32_UINT:
+	case VK_FORMAT_R32_SINT:
+	case VK_FORMAT_R32_SFLOAT: return 4;
+	case VK_FORMAT_R32G32_UINT:
+	case VK_FORMAT_R32G32_SINT:
+	case VK_FORMAT_R32G32_SFLOAT: return 8;
+	case VK_FORMAT_R32G32B32_UINT:
+	case VK_FORMAT_R32G32B32_SINT:
+	case VK_FORMAT_R32G32B32_SFLOAT: return 12;
+	case VK_FORMAT_R32G32B32A32_UINT:
+	case VK_FORMAT_R32G32B32A32_SINT:
+	case VK_FORMAT_R32G32B32A32_SFLOAT: return 16;
+	default: throw std::runtime_error("Vulkan: Unknown format size");
+	}
+}
+
 std::vector<char> ReadFile(const std::string& path)
 {
 	std::ifstream file(path, std::ios::ate | std::ios::binary);
@@ -556,253 +862,7563 @@ std::vector<char> ReadFile(const std::string& path)
 	return buffer;
 }
 
-void CreateVulkanGraphicsPipeline(const VkDevice& device, const VkExtent2D& swapchainExtent, const VkRenderPass& renderPass, VkPipelineLayout& outPipelineLayout, VkPipeline& outGraphicsPipeline)
+// Buffers & Memory
+bool TryFindVulkanMemoryType(const VkPhysicalDevice& physicalDevice, uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t& outType)
 {
-	auto vertShaderCode = ReadFile("Shaders/SPIR-V/vert.spv");
-	auto fragShaderCode = ReadFile("Shaders/SPIR-V/frag.spv");
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
 
-	auto vertShaderModule = CreateVulkanShaderModule(device, vertShaderCode);
-	auto fragShaderModule = CreateVulkanShaderModule(device, fragShaderCode);
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((typeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			outType = i;
+			return true;
+		}
+	}
 
-	VkPipelineShaderStageCreateInfo vertShaderStageInfo{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
-	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module = vertShaderModule;
-	vertShaderStageInfo.pName = "main";
+	return false;
+}
 
-	VkPipelineShaderStageCreateInfo fragShaderStageInfo{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
-	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module = fragShaderModule;
-	fragShaderStageInfo.pName = "main";
+uint32_t FindVulkanMemoryType(const VkPhysicalDevice& physicalDevice, uint32_t typeBits, VkMemoryPropertyFlags properties)
+{
+	uint32_t memoryType;
+	if (!TryFindVulkanMemoryType(physicalDevice, typeBits, properties, memoryType))
+		throw std::runtime_error("Vulkan: Failed to find a suitable memory type");
 
-	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+	return memoryType;
+}
 
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 0;
-	vertexInputInfo.vertexAttributeDescriptionCount = 0;
+//	queueFamilies is only read for VK_SHARING_MODE_CONCURRENT, see GetVulkanSharedQueueFamilies.
+void CreateVulkanBuffer(const VkPhysicalDevice& physicalDevice, const VkDevice& device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& outBuffer, VkDeviceMemory& outMemory,
+	VkSharingMode sharingMode = VK_SHARING_MODE_EXCLUSIVE, const std::vector<uint32_t>& queueFamilies = {})
+{
+	VkBufferCreateInfo bufferInfo{ VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = sharingMode;
+	if (sharingMode == VK_SHARING_MODE_CONCURRENT)
+	{
+		bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+		bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+	}
 
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssembly.primitiveRestartEnable = VK_FALSE;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &outBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to create buffer!");
 
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)swapchainExtent.width;
-	viewport.height = (float)swapchainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
+	VkMemoryRequirements memoryRequirements;
+	vkGetBufferMemoryRequirements(device, outBuffer, &memoryRequirements);
 
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapchainExtent;
+	VkMemoryAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocInfo.allocationSize = memoryRequirements.size;
+	allocInfo.memoryTypeIndex = FindVulkanMemoryType(physicalDevice, memoryRequirements.memoryTypeBits, properties);
 
-	VkPipelineViewportStateCreateInfo viewportState{};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &outMemory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate buffer memory!");
 
-	VkPipelineRasterizationStateCreateInfo rasterizer{};
-	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizer.depthClampEnable = VK_FALSE;
-	rasterizer.rasterizerDiscardEnable = VK_FALSE;
-	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterizer.lineWidth = 1.0f;
-	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	rasterizer.depthBiasEnable = VK_FALSE;
+	vkBindBufferMemory(device, outBuffer, outMemory, 0);
+}
 
-	VkPipelineMultisampleStateCreateInfo multisampling{};
-	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+VkCommandBuffer BeginVulkanSingleTimeCommands(const VkDevice& device, const VkCommandPool& cmdPool)
+{
+	VkCommandBufferAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	allocInfo.commandPool = cmdPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
 
-	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable = VK_FALSE;
+	VkCommandBuffer cmdBuffer;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate command buffer!");
 
-	VkPipelineColorBlendStateCreateInfo colorBlending{};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.logicOp = VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &colorBlendAttachment;
-	colorBlending.blendConstants[0] = 0.0f;
-	colorBlending.blendConstants[1] = 0.0f;
-	colorBlending.blendConstants[2] = 0.0f;
-	colorBlending.blendConstants[3] = 0.0f;
+	VkCommandBufferBeginInfo beginInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(cmdBuffer, &beginInfo);
 
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 0;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	return cmdBuffer;
+}
 
-	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &outPipelineLayout) != VK_SUCCESS)
-		throw std::runtime_error("failed to create pipeline layout!");
+void EndVulkanSingleTimeCommands(const VkDevice& device, const VkCommandPool& cmdPool, const VkQueue& queue, VkCommandBuffer cmdBuffer)
+{
+	vkEndCommandBuffer(cmdBuffer);
 
-	VkGraphicsPipelineCreateInfo pipelineInfo{};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.stageCount = 2;
-	pipelineInfo.pStages = shaderStages;
-	pipelineInfo.pVertexInputState = &vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &rasterizer;
-	pipelineInfo.pMultisampleState = &multisampling;
-	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.layout = outPipelineLayout;
-	pipelineInfo.renderPass = renderPass;
-	pipelineInfo.subpass = 0;
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	VkFenceCreateInfo fenceInfo{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	VkFence fence;
+	if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+		throw std::runtime_error("failed to create fence!");
 
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &outGraphicsPipeline) != VK_SUCCESS)
-		throw std::runtime_error("failed to create graphics pipeline!");
+	VkSubmitInfo submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &cmdBuffer;
 
-	vkDestroyShaderModule(device, fragShaderModule, nullptr);
-	vkDestroyShaderModule(device, vertShaderModule, nullptr);
-}
+	if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit single time commands!");
 
-void CreateVulkanRenderPass(const VkDevice& device, const VkSurfaceFormatKHR& swapchainFormat, VkRenderPass& outRenderPass) {
-	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = swapchainFormat.format;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-	VkAttachmentReference colorAttachmentRef{};
-	colorAttachmentRef.attachment = 0;
-	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkSubpassDescription subpass{};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &colorAttachmentRef;
-
-	VkRenderPassCreateInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 1;
-	renderPassInfo.pAttachments = &colorAttachment;
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
-
-	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &outRenderPass) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create render pass!");
-	}
+	vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	vkDestroyFence(device, fence, nullptr);
+	vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
 }
 
-void CreateVulkanFramebuffers(const VkDevice& device, const VkExtent2D& extents, const VkRenderPass& renderPass, const std::vector<VkImageView>& swapchainImageViews, std::vector<VkFramebuffer>& outSwapchainFramebuffers) {
-	outSwapchainFramebuffers.clear();
-	outSwapchainFramebuffers.resize(swapchainImageViews.size());
+// Transfer Queue Upload Engine
+//	Staging copies are batched onto the transfer queue. When the transfer family is dedicated, buffers and images
+//	are released by the transfer queue and acquired by the graphics queue, which waits on a semaphore instead of the
+//	CPU. Images end up in SHADER_READ_ONLY_OPTIMAL, the transition is part of the acquire. Images uploaded without
+//	their mips get them blitted on the graphics queue as part of the acquire.
+struct UploadEngine
+{
+	struct Copy
+	{
+		VkBuffer dstBuffer;
+		VkDeviceSize dstOffset;
+		VkDeviceSize stagingOffset;
+		VkDeviceSize size;
+		VkPipelineStageFlags dstStageMask;
+		VkAccessFlags dstAccessMask;
+	};
+
+	struct ImageCopy
+	{
+		VkImage dstImage;
+		VkImageSubresourceRange range;
+		std::vector<VkBufferImageCopy> regions;	//	Buffer offsets are into the staging data.
+		VkPipelineStageFlags dstStageMask;
+		VkAccessFlags dstAccessMask;
+		bool generateMips;
+	};
+
+	struct Batch
+	{
+		VkCommandBuffer transferCmd = VK_NULL_HANDLE;
+		VkCommandBuffer acquireCmd = VK_NULL_HANDLE;
+		VkSemaphore transferComplete = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		VkBuffer stagingBuffer = VK_NULL_HANDLE;
+		VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+	};
+
+	uint32_t transferFamily = 0;
+	uint32_t graphicsFamily = 0;
+	VkQueue transferQueue = VK_NULL_HANDLE;
+	VkQueue graphicsQueue = VK_NULL_HANDLE;
+	VkCommandPool transferPool = VK_NULL_HANDLE;
+	VkCommandPool graphicsPool = VK_NULL_HANDLE;
+	std::vector<char> stagingData;
+	std::vector<Copy> pendingCopies;
+	std::vector<ImageCopy> pendingImageCopies;
+	std::vector<Batch> inFlight;
+};
 
-	for (size_t i = 0; i < swapchainImageViews.size(); i++) {
-		VkImageView attachments[] = {
-			swapchainImageViews[i]
-		};
+void CreateUploadEngine(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const VkSurfaceKHR& surface, const VkQueue& transferQueue, const VkQueue& graphicsQueue, UploadEngine& outEngine)
+{
+	QueueFamilyIndices indices = GetVulkanQueueFamilies(physicalDevice, surface);
+	outEngine.graphicsFamily = indices.graphicsFamily.value();
+	outEngine.transferFamily = indices.transferFamily.value_or(outEngine.graphicsFamily);
+	outEngine.transferQueue = transferQueue;
+	outEngine.graphicsQueue = graphicsQueue;
 
-		VkFramebufferCreateInfo framebufferInfo{};
-		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferInfo.renderPass = renderPass;
-		framebufferInfo.attachmentCount = 1;
-		framebufferInfo.pAttachments = attachments;
-		framebufferInfo.width = extents.width;
-		framebufferInfo.height = extents.height;
-		framebufferInfo.layers = 1;
+	VkCommandPoolCreateInfo poolInfo{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-		if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &outSwapchainFramebuffers[i]) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create framebuffer!");
-		}
-	}
-}
+	poolInfo.queueFamilyIndex = outEngine.transferFamily;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &outEngine.transferPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create transfer command pool!");
 
-void CreateVulkanCommandPool(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const VkSurfaceKHR& surface, VkCommandPool& outCmdPool) {
-	QueueFamilyIndices queueFamilyIndices = GetVulkanQueueFamilies(physicalDevice, surface);
+	poolInfo.queueFamilyIndex = outEngine.graphicsFamily;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &outEngine.graphicsPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create upload acquire command pool!");
+}
 
-	VkCommandPoolCreateInfo poolInfo{};
-	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+//	The data is copied immediately, the caller's memory may be released once this returns.
+void QueueBufferUpload(UploadEngine& engine, const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+{
+	VkDeviceSize stagingOffset = (engine.stagingData.size() + 15) & ~static_cast<VkDeviceSize>(15);
+	engine.stagingData.resize(static_cast<size_t>(stagingOffset + size));
+	memcpy(engine.stagingData.data() + stagingOffset, data, static_cast<size_t>(size));
 
-	if (vkCreateCommandPool(device, &poolInfo, nullptr, &outCmdPool) != VK_SUCCESS)
-		throw std::runtime_error("failed to create command pool!");
+	engine.pendingCopies.push_back({ dstBuffer, dstOffset, stagingOffset, size, dstStageMask, dstAccessMask });
 }
 
-void CreateVulkanCommandBuffers(const VkDevice& device, const VkCommandPool& cmdPool, const VkRenderPass& renderPass,  const VkPipeline& gfxPipeline, const VkExtent2D extents, const std::vector<VkFramebuffer>& framebuffers, std::vector<VkCommandBuffer>& outCmdBuffers) {
-	outCmdBuffers.clear();
-	outCmdBuffers.resize(framebuffers.size());
+//	Every mip of the image is copied in one vkCmdCopyBufferToImage. The regions' buffer offsets are relative to
+//	data and must keep the format's block alignment, the staging offset itself is 16 byte aligned.
+//	With generateMips only the base level is copied, the rest of range is blitted down from it, which needs an
+//	image with TRANSFER_SRC usage and a format that supports linear blits.
+void QueueImageUpload(UploadEngine& engine, const void* data, VkDeviceSize size, VkImage dstImage, const VkImageSubresourceRange& range, const std::vector<VkBufferImageCopy>& regions, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask, bool generateMips)
+{
+	VkDeviceSize stagingOffset = (engine.stagingData.size() + 15) & ~static_cast<VkDeviceSize>(15);
+	engine.stagingData.resize(static_cast<size_t>(stagingOffset + size));
+	memcpy(engine.stagingData.data() + stagingOffset, data, static_cast<size_t>(size));
+
+	UploadEngine::ImageCopy copy{ dstImage, range, regions, dstStageMask, dstAccessMask, generateMips };
+	for (auto& region : copy.regions)
+		region.bufferOffset += stagingOffset;
+	engine.pendingImageCopies.push_back(copy);
+}
 
+VkCommandBuffer AllocateUploadCommandBuffer(const VkDevice& device, const VkCommandPool& pool)
+{
 	VkCommandBufferAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
-	allocInfo.commandPool = cmdPool;
+	allocInfo.commandPool = pool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (uint32_t)outCmdBuffers.size();
+	allocInfo.commandBufferCount = 1;
 
-	if (vkAllocateCommandBuffers(device, &allocInfo, outCmdBuffers.data()) != VK_SUCCESS)
-		throw std::runtime_error("failed to allocate command buffers!");
+	VkCommandBuffer cmdBuffer;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate upload command buffer!");
 
-	for (size_t i = 0; i < outCmdBuffers.size(); i++) {
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	VkCommandBufferBeginInfo beginInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(cmdBuffer, &beginInfo);
 
-		if (vkBeginCommandBuffer(outCmdBuffers[i], &beginInfo) != VK_SUCCESS)
-			throw std::runtime_error("failed to begin recording command buffer!");
+	return cmdBuffer;
+}
 
-		VkRenderPassBeginInfo renderPassInfo{};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = framebuffers[i];
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = extents;
+//	Expects the base level in TRANSFER_SRC and the others undefined, leaves every level in SHADER_READ_ONLY. Each
+//	level is blitted from the one above so the filter footprint stays at 2x2.
+void RecordVulkanMipBlits(const VkCommandBuffer& cmdBuffer, const UploadEngine::ImageCopy& copy)
+{
+	VkImageMemoryBarrier barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = copy.dstImage;
+	barrier.subresourceRange = { copy.range.aspectMask, 0, 1, copy.range.baseArrayLayer, copy.range.layerCount };
+
+	VkExtent3D extent = copy.regions.front().imageExtent;
+	for (uint32_t mip = 1; mip < copy.range.levelCount; mip++)
+	{
+		barrier.subresourceRange.baseMipLevel = mip;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkImageBlit blit{};
+		blit.srcSubresource = { copy.range.aspectMask, mip - 1, copy.range.baseArrayLayer, copy.range.layerCount };
+		blit.srcOffsets[1] = { static_cast<int32_t>(std::max(1u, extent.width >> (mip - 1))), static_cast<int32_t>(std::max(1u, extent.height >> (mip - 1))), 1 };
+		blit.dstSubresource = { copy.range.aspectMask, mip, copy.range.baseArrayLayer, copy.range.layerCount };
+		blit.dstOffsets[1] = { static_cast<int32_t>(std::max(1u, extent.width >> mip)), static_cast<int32_t>(std::max(1u, extent.height >> mip)), 1 };
+		vkCmdBlitImage(cmdBuffer, copy.dstImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, copy.dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
 
-		VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
+	barrier.subresourceRange = copy.range;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = copy.dstAccessMask;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, copy.dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
 
-		vkCmdBeginRenderPass(outCmdBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+//	Submits every queued upload as one batch. Graphics work submitted afterwards sees the uploaded data.
+void FlushUploads(const VkPhysicalDevice& physicalDevice, const VkDevice& device, UploadEngine& engine)
+{
+	if (engine.pendingCopies.empty() && engine.pendingImageCopies.empty())
+		return;
 
-		vkCmdBindPipeline(outCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, gfxPipeline);
+	UploadEngine::Batch batch;
+	CreateVulkanBuffer(physicalDevice, device, engine.stagingData.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, batch.stagingBuffer, batch.stagingMemory);
 
-		vkCmdDraw(outCmdBuffers[i], 3, 1, 0, 0);
+	void* mapped;
+	vkMapMemory(device, batch.stagingMemory, 0, engine.stagingData.size(), 0, &mapped);
+	memcpy(mapped, engine.stagingData.data(), engine.stagingData.size());
+	vkUnmapMemory(device, batch.stagingMemory);
 
-		vkCmdEndRenderPass(outCmdBuffers[i]);
+	bool transferOwnership = engine.transferFamily != engine.graphicsFamily;
+	std::vector<VkBufferMemoryBarrier> ownershipBarriers;
+	VkPipelineStageFlags dstStageMask = 0;
 
-		if (vkEndCommandBuffer(outCmdBuffers[i]) != VK_SUCCESS)
-			throw std::runtime_error("failed to record command buffer!");
+	batch.transferCmd = AllocateUploadCommandBuffer(device, engine.transferPool);
+	for (const auto& copy : engine.pendingCopies)
+	{
+		VkBufferCopy region{ copy.stagingOffset, copy.dstOffset, copy.size };
+		vkCmdCopyBuffer(batch.transferCmd, batch.stagingBuffer, copy.dstBuffer, 1, &region);
+
+		VkBufferMemoryBarrier barrier{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = copy.dstAccessMask;
+		barrier.srcQueueFamilyIndex = engine.transferFamily;
+		barrier.dstQueueFamilyIndex = engine.graphicsFamily;
+		barrier.buffer = copy.dstBuffer;
+		barrier.offset = copy.dstOffset;
+		barrier.size = copy.size;
+		ownershipBarriers.push_back(barrier);
+		dstStageMask |= copy.dstStageMask;
 	}
-}
 
-void CreateVulkanSyncObjects(const VkDevice& device, const std::vector<VkImage>& swapChainImages, std::vector<VkSemaphore>& outImageReadySemaphores, std::vector<VkSemaphore>& outRenderFinishedSemaphores, std::vector<VkFence>& outFlightFences, std::vector<VkFence>& outImagesInFlight) 
-{
-	outImageReadySemaphores.clear();
-	outRenderFinishedSemaphores.clear();
-	outFlightFences.clear();
-	outImagesInFlight.clear();
+	//	The layout transition to TRANSFER_DST happens on the transfer queue, the one to SHADER_READ_ONLY is recorded
+	//	identically as release and acquire when ownership moves, and on the graphics queue alone otherwise. Images
+	//	that get their mips blitted only copy and move the base level, to TRANSFER_SRC.
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	VkPipelineStageFlags imageStageMask = 0;
+	bool blitMips = false;
+	for (const auto& copy : engine.pendingImageCopies)
+	{
+		VkImageMemoryBarrier toTransfer{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		toTransfer.image = copy.dstImage;
+		toTransfer.subresourceRange = copy.range;
+		if (copy.generateMips)
+			toTransfer.subresourceRange.levelCount = 1;
+		vkCmdPipelineBarrier(batch.transferCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+		vkCmdCopyBufferToImage(batch.transferCmd, batch.stagingBuffer, copy.dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copy.regions.size()), copy.regions.data());
+
+		//	The semaphore already made the copy visible, the acquire side only transitions.
+		VkImageMemoryBarrier barrier = toTransfer;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = copy.generateMips ? VK_ACCESS_TRANSFER_READ_BIT : copy.dstAccessMask;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = copy.generateMips ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		if (transferOwnership)
+		{
+			barrier.srcQueueFamilyIndex = engine.transferFamily;
+			barrier.dstQueueFamilyIndex = engine.graphicsFamily;
+		}
+		imageBarriers.push_back(barrier);
+		imageStageMask |= copy.generateMips ? VK_PIPELINE_STAGE_TRANSFER_BIT : copy.dstStageMask;
+		blitMips |= copy.generateMips;
+	}
 
-	outImageReadySemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	outRenderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	outFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-	outImagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+	if (transferOwnership)
+	{
+		//	Release, the destination access mask is ignored on the releasing queue.
+		std::vector<VkBufferMemoryBarrier> releaseBarriers = ownershipBarriers;
+		for (auto& barrier : releaseBarriers)
+			barrier.dstAccessMask = 0;
 
-	VkSemaphoreCreateInfo semaphoreInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+		std::vector<VkImageMemoryBarrier> releaseImageBarriers = imageBarriers;
+		for (auto& barrier : releaseImageBarriers)
+		{
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = 0;
+		}
+
+		vkCmdPipelineBarrier(batch.transferCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, static_cast<uint32_t>(releaseBarriers.size()), releaseBarriers.data(), static_cast<uint32_t>(releaseImageBarriers.size()), releaseImageBarriers.data());
+	}
+	vkEndCommandBuffer(batch.transferCmd);
 
+	VkSemaphoreCreateInfo semaphoreInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
 	VkFenceCreateInfo fenceInfo{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &batch.transferComplete) != VK_SUCCESS ||
+		vkCreateFence(device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS)
+		throw std::runtime_error("failed to create upload synchronization objects!");
+
+	VkSubmitInfo transferSubmit{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	transferSubmit.commandBufferCount = 1;
+	transferSubmit.pCommandBuffers = &batch.transferCmd;
+	transferSubmit.signalSemaphoreCount = 1;
+	transferSubmit.pSignalSemaphores = &batch.transferComplete;
+
+	if (vkQueueSubmit(engine.transferQueue, 1, &transferSubmit, VK_NULL_HANDLE) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit upload batch!");
+
+	//	The graphics queue waits on the GPU only, at the first stage that reads the uploaded data. Image
+	//	transitions wait at the top of the pipe since the layout change has to finish before any of it.
+	VkPipelineStageFlags waitStageMask = imageBarriers.empty() ? dstStageMask : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	VkSubmitInfo acquireSubmit{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	acquireSubmit.waitSemaphoreCount = 1;
+	acquireSubmit.pWaitSemaphores = &batch.transferComplete;
+	acquireSubmit.pWaitDstStageMask = &waitStageMask;
+
+	if (transferOwnership || !imageBarriers.empty())
+	{
+		batch.acquireCmd = AllocateUploadCommandBuffer(device, engine.graphicsPool);
+		if (transferOwnership && !ownershipBarriers.empty())
+			vkCmdPipelineBarrier(batch.acquireCmd, dstStageMask, dstStageMask, 0,
+				0, nullptr, static_cast<uint32_t>(ownershipBarriers.size()), ownershipBarriers.data(), 0, nullptr);
+		if (!imageBarriers.empty())
+			vkCmdPipelineBarrier(batch.acquireCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, imageStageMask, 0, 0, nullptr, 0, nullptr,
+				static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+		if (blitMips)
+		{
+			for (const auto& copy : engine.pendingImageCopies)
+				if (copy.generateMips)
+					RecordVulkanMipBlits(batch.acquireCmd, copy);
+		}
+		vkEndCommandBuffer(batch.acquireCmd);
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &outImageReadySemaphores[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &outRenderFinishedSemaphores[i]) != VK_SUCCESS ||
-			vkCreateFence(device, &fenceInfo, nullptr, &outFlightFences[i]) != VK_SUCCESS)
-			throw std::runtime_error("failed to create synchronization objects for a frame!");
+		acquireSubmit.commandBufferCount = 1;
+		acquireSubmit.pCommandBuffers = &batch.acquireCmd;
 	}
+
+	if (vkQueueSubmit(engine.graphicsQueue, 1, &acquireSubmit, batch.fence) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit upload acquire!");
+
+	Print("Upload Engine: Submitted %i copies (%i bytes)", static_cast<int>(engine.pendingCopies.size() + engine.pendingImageCopies.size()), static_cast<int>(engine.stagingData.size()));
+
+	engine.inFlight.push_back(batch);
+	engine.pendingCopies.clear();
+	engine.pendingImageCopies.clear();
+	engine.stagingData.clear();
 }
 
-int main(int argc, char* args[])
+void ReleaseUploadBatch(const VkDevice& device, UploadEngine& engine, UploadEngine::Batch& batch)
 {
-	//	Local Variables
+	vkFreeCommandBuffers(device, engine.transferPool, 1, &batch.transferCmd);
+	if (batch.acquireCmd != VK_NULL_HANDLE)
+		vkFreeCommandBuffers(device, engine.graphicsPool, 1, &batch.acquireCmd);
+
+	vkDestroySemaphore(device, batch.transferComplete, nullptr);
+	vkDestroyFence(device, batch.fence, nullptr);
+	vkDestroyBuffer(device, batch.stagingBuffer, nullptr);
+	vkFreeMemory(device, batch.stagingMemory, nullptr);
+}
+
+//	Frees the staging memory of every batch the GPU has finished with, call once per frame.
+void CollectUploads(const VkDevice& device, UploadEngine& engine)
+{
+	auto it = std::remove_if(engine.inFlight.begin(), engine.inFlight.end(), [&](UploadEngine::Batch& batch)
+	{
+		if (vkGetFenceStatus(device, batch.fence) != VK_SUCCESS)
+			return false;
+
+		ReleaseUploadBatch(device, engine, batch);
+		return true;
+	});
+	engine.inFlight.erase(it, engine.inFlight.end());
+}
+
+void DestroyUploadEngine(const VkDevice& device, UploadEngine& engine)
+{
+	for (auto& batch : engine.inFlight)
+	{
+		vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+		ReleaseUploadBatch(device, engine, batch);
+	}
+	engine.inFlight.clear();
+
+	vkDestroyCommandPool(device, engine.transferPool, nullptr);
+	vkDestroyCommandPool(device, engine.graphicsPool, nullptr);
+}
+
+// Async Compute
+//	Compute work recorded here runs on its own queue and overlaps with rasterization. The graphics submit of the
+//	same frame waits on its semaphore only at the stage that consumes the results.
+//	Resources shared with the graphics queue are created with GetVulkanSharedQueueFamilies.
+struct AsyncComputeContext
+{
+	uint32_t family = 0;
+	bool dedicated = false;
+	VkQueue queue = VK_NULL_HANDLE;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> cmdBuffers;
+	std::vector<VkSemaphore> finishedSemaphores;
+	std::vector<VkFence> fences;
+	std::vector<VkPipelineStageFlags> pendingWaitStages;
+};
+
+void CreateAsyncComputeContext(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const VkSurfaceKHR& surface, const VkQueue& computeQueue, AsyncComputeContext& outContext)
+{
+	QueueFamilyIndices indices = GetVulkanQueueFamilies(physicalDevice, surface);
+	outContext.dedicated = indices.computeFamily.has_value();
+	outContext.family = indices.computeFamily.value_or(indices.graphicsFamily.value());
+	outContext.queue = computeQueue;
+
+	VkCommandPoolCreateInfo poolInfo{ VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = outContext.family;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &outContext.commandPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create compute command pool!");
+
+	outContext.cmdBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	outContext.finishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+	outContext.fences.resize(MAX_FRAMES_IN_FLIGHT);
+	outContext.pendingWaitStages.resize(MAX_FRAMES_IN_FLIGHT, 0);
+
+	VkCommandBufferAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	allocInfo.commandPool = outContext.commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+	if (vkAllocateCommandBuffers(device, &allocInfo, outContext.cmdBuffers.data()) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate compute command buffers!");
+
+	VkSemaphoreCreateInfo semaphoreInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	VkFenceCreateInfo fenceInfo{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &outContext.finishedSemaphores[i]) != VK_SUCCESS ||
+			vkCreateFence(device, &fenceInfo, nullptr, &outContext.fences[i]) != VK_SUCCESS)
+			throw std::runtime_error("failed to create compute synchronization objects!");
+	}
+}
+
+//	Queue families a resource written on one queue and read on the other must list, exclusive if they match.
+void GetVulkanSharedQueueFamilies(const AsyncComputeContext& context, uint32_t graphicsFamily, VkSharingMode& outSharingMode, std::vector<uint32_t>& outFamilies)
+{
+	outFamilies.clear();
+	outSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (context.family != graphicsFamily)
+	{
+		outSharingMode = VK_SHARING_MODE_CONCURRENT;
+		outFamilies = { graphicsFamily, context.family };
+	}
+}
+
+VkCommandBuffer BeginAsyncCompute(const VkDevice& device, AsyncComputeContext& context, size_t frame)
+{
+	vkWaitForFences(device, 1, &context.fences[frame], VK_TRUE, UINT64_MAX);
+
+	VkCommandBuffer cmdBuffer = context.cmdBuffers[frame];
+	vkResetCommandBuffer(cmdBuffer, 0);
+
+	VkCommandBufferBeginInfo beginInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+
+	return cmdBuffer;
+}
+
+//	consumerStageMask is the first graphics stage that reads what this submission writes.
+void SubmitAsyncCompute(const VkDevice& device, AsyncComputeContext& context, size_t frame, VkPipelineStageFlags consumerStageMask,
+	const std::vector<VkSemaphore>& waitSemaphores = {}, const std::vector<VkPipelineStageFlags>& waitStages = {})
+{
+	VkCommandBuffer cmdBuffer = context.cmdBuffers[frame];
+	if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record compute command buffer!");
+
+	VkSubmitInfo submitInfo{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &cmdBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &context.finishedSemaphores[frame];
+
+	vkResetFences(device, 1, &context.fences[frame]);
+	if (vkQueueSubmit(context.queue, 1, &submitInfo, context.fences[frame]) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit compute command buffer!");
+
+	context.pendingWaitStages[frame] = consumerStageMask;
+}
+
+//	Adds the frame's compute semaphore to a graphics submit, if compute work was submitted for it.
+void AddAsyncComputeWait(AsyncComputeContext& context, size_t frame, std::vector<VkSemaphore>& outWaitSemaphores, std::vector<VkPipelineStageFlags>& outWaitStages)
+{
+	if (context.pendingWaitStages[frame] == 0)
+		return;
+
+	outWaitSemaphores.push_back(context.finishedSemaphores[frame]);
+	outWaitStages.push_back(context.pendingWaitStages[frame]);
+	context.pendingWaitStages[frame] = 0;
+}
+
+void DestroyAsyncComputeContext(const VkDevice& device, AsyncComputeContext& context)
+{
+	for (size_t i = 0; i < context.fences.size(); i++)
+	{
+		vkDestroySemaphore(device, context.finishedSemaphores[i], nullptr);
+		vkDestroyFence(device, context.fences[i], nullptr);
+	}
+
+	vkDestroyCommandPool(device, context.commandPool, nullptr);
+}
+
+// Geometry
+enum VertexAttribute : uint8_t
+{
+	VERTEX_ATTRIBUTE_POSITION = 0,
+	VERTEX_ATTRIBUTE_COLOR,
+	VERTEX_ATTRIBUTE_NORMAL,
+	VERTEX_ATTRIBUTE_TEXCOORD,
+	VERTEX_ATTRIBUTE_COUNT
+};
+
+//	Indexed by VertexAttribute, which is also the shader input location.
+const VkFormat VERTEX_ATTRIBUTE_FORMATS[VERTEX_ATTRIBUTE_COUNT] = {
+	VK_FORMAT_R32G32B32_SFLOAT,
+	VK_FORMAT_R32G32B32_SFLOAT,
+	VK_FORMAT_R32G32B32_SFLOAT,
+	VK_FORMAT_R32G32_SFLOAT,
+};
+
+//	Per instance data, streamed through one binding at VK_VERTEX_INPUT_RATE_INSTANCE after the mesh's bindings.
+struct InstanceData
+{
+	float position[3];
+	float scale;
+};
+
+const uint32_t INSTANCE_ATTRIBUTE_LOCATION = VERTEX_ATTRIBUTE_COUNT;
+const VkFormat INSTANCE_ATTRIBUTE_FORMAT = VK_FORMAT_R32G32B32A32_SFLOAT;
+
+enum VertexLayout : uint8_t
+{
+	VERTEX_LAYOUT_INTERLEAVED = 0,	//	One binding, attributes packed per vertex.
+	VERTEX_LAYOUT_SOA,				//	One binding per attribute stream.
+};
+
+struct VertexFormat
+{
+	uint8_t attributeMask = 0;
+	VertexLayout layout = VERTEX_LAYOUT_INTERLEAVED;
+	bool instanced = false;	//	Adds the InstanceData binding, meshes never store it.
+
+	bool Has(VertexAttribute attribute) const { return (attributeMask & (1 << attribute)) != 0; }
+	uint32_t Key() const { return (static_cast<uint32_t>(instanced) << 16) | (static_cast<uint32_t>(layout) << 8) | attributeMask; }
+};
+
+void GetVulkanVertexInputDescriptions(const VertexFormat& format, std::vector<VkVertexInputBindingDescription>& outBindings, std::vector<VkVertexInputAttributeDescription>& outAttributes)
+{
+	outBindings.clear();
+	outAttributes.clear();
+
+	for (uint32_t attribute = 0; attribute < VERTEX_ATTRIBUTE_COUNT; attribute++)
+	{
+		if (!format.Has(static_cast<VertexAttribute>(attribute)))
+			continue;
+
+		if (format.layout == VERTEX_LAYOUT_SOA || outBindings.empty())
+			outBindings.push_back({ static_cast<uint32_t>(outBindings.size()), 0, VK_VERTEX_INPUT_RATE_VERTEX });
+
+		auto& binding = outBindings.back();
+		outAttributes.push_back({ attribute, binding.binding, VERTEX_ATTRIBUTE_FORMATS[attribute], binding.stride });
+		binding.stride += GetVulkanFormatSize(VERTEX_ATTRIBUTE_FORMATS[attribute]);
+	}
+
+	if (format.instanced)
+	{
+		uint32_t binding = static_cast<uint32_t>(outBindings.size());
+		outBindings.push_back({ binding, sizeof(InstanceData), VK_VERTEX_INPUT_RATE_INSTANCE });
+		outAttributes.push_back({ INSTANCE_ATTRIBUTE_LOCATION, binding, INSTANCE_ATTRIBUTE_FORMAT, 0 });
+	}
+}
+
+//	CPU side geometry, one float stream per attribute regardless of the GPU layout.
+struct MeshData
+{
+	VertexFormat format;
+	uint32_t vertexCount = 0;
+	std::vector<float> streams[VERTEX_ATTRIBUTE_COUNT];
+	std::vector<uint32_t> indices;
+};
+
+//	Vertex and index data share one device local buffer and allocation.
+struct Mesh
+{
+	VertexFormat format;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	std::vector<VkDeviceSize> bindingOffsets;
+	VkDeviceSize indexOffset = 0;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	uint32_t indexCount = 0;
+	uint32_t vertexCount = 0;
+};
+
+void PackVertexData(const MeshData& meshData, std::vector<char>& outData, std::vector<VkDeviceSize>& outBindingOffsets)
+{
+	std::vector<VkVertexInputBindingDescription> bindings;
+	std::vector<VkVertexInputAttributeDescription> attributes;
+	GetVulkanVertexInputDescriptions(meshData.format, bindings, attributes);
+
+	outBindingOffsets.clear();
+	VkDeviceSize size = 0;
+	for (const auto& binding : bindings)
+	{
+		outBindingOffsets.push_back(size);
+		size += static_cast<VkDeviceSize>(binding.stride) * meshData.vertexCount;
+	}
+
+	outData.assign(static_cast<size_t>(size), 0);
+
+	for (const auto& attribute : attributes)
+	{
+		const auto& stream = meshData.streams[attribute.location];
+		uint32_t attributeSize = GetVulkanFormatSize(attribute.format);
+		uint32_t stride = bindings[attribute.binding].stride;
+
+		if (stream.size() * sizeof(float) != static_cast<size_t>(attributeSize) * meshData.vertexCount)
+			throw std::runtime_error("Geometry: Vertex stream size does not match the vertex count");
+
+		char* dst = outData.data() + outBindingOffsets[attribute.binding] + attribute.offset;
+		const char* src = reinterpret_cast<const char*>(stream.data());
+		for (uint32_t vertex = 0; vertex < meshData.vertexCount; vertex++)
+			memcpy(dst + static_cast<size_t>(vertex) * stride, src + static_cast<size_t>(vertex) * attributeSize, attributeSize);
+	}
+}
+
+//	The mesh may be bound once the upload engine has been flushed.
+void CreateVulkanMesh(const VkPhysicalDevice& physicalDevice, const VkDevice& device, UploadEngine& uploadEngine, const MeshData& meshData, Mesh& outMesh)
+{
+	std::vector<char> vertexData;
+	PackVertexData(meshData, vertexData, outMesh.bindingOffsets);
+
+	//	16-bit indices halve index bandwidth whenever every vertex is addressable with them.
+	std::vector<uint16_t> indices16;
+	outMesh.indexType = meshData.vertexCount < UINT16_MAX ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	if (outMesh.indexType == VK_INDEX_TYPE_UINT16)
+		indices16.assign(meshData.indices.begin(), meshData.indices.end());
+
+	const void* indexData = outMesh.indexType == VK_INDEX_TYPE_UINT16 ? static_cast<const void*>(indices16.data()) : meshData.indices.data();
+	VkDeviceSize indexSize = meshData.indices.size() * (outMesh.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t));
+
+	outMesh.format = meshData.format;
+	outMesh.vertexCount = meshData.vertexCount;
+	outMesh.indexCount = static_cast<uint32_t>(meshData.indices.size());
+	outMesh.indexOffset = (vertexData.size() + 3) & ~static_cast<VkDeviceSize>(3);
+
+	CreateVulkanBuffer(physicalDevice, device, outMesh.indexOffset + indexSize,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, outMesh.buffer, outMesh.memory);
+
+	QueueBufferUpload(uploadEngine, vertexData.data(), vertexData.size(), outMesh.buffer, 0, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	QueueBufferUpload(uploadEngine, indexData, indexSize, outMesh.buffer, outMesh.indexOffset, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+}
+
+void DestroyVulkanMesh(const VkDevice& device, Mesh& mesh)
+{
+	vkDestroyBuffer(device, mesh.buffer, nullptr);
+	vkFreeMemory(device, mesh.memory, nullptr);
+	mesh.buffer = VK_NULL_HANDLE;
+	mesh.memory = VK_NULL_HANDLE;
+}
+
+void BindVulkanMesh(const VkCommandBuffer& cmdBuffer, const Mesh& mesh)
+{
+	std::vector<VkBuffer> buffers(mesh.bindingOffsets.size(), mesh.buffer);
+	vkCmdBindVertexBuffers(cmdBuffer, 0, static_cast<uint32_t>(buffers.size()), buffers.data(), mesh.bindingOffsets.data());
+	vkCmdBindIndexBuffer(cmdBuffer, mesh.buffer, mesh.indexOffset, mesh.indexType);
+}
+
+//	The instance binding follows the mesh's vertex bindings, firstInstance of each draw indexes into the buffer.
+void BindVulkanInstances(const VkCommandBuffer& cmdBuffer, const Mesh& mesh, VkBuffer buffer, VkDeviceSize offset)
+{
+	vkCmdBindVertexBuffers(cmdBuffer, static_cast<uint32_t>(mesh.bindingOffsets.size()), 1, &buffer, &offset);
+}
+
+MeshData CreateTriangleMeshData()
+{
+	MeshData meshData;
+	meshData.format.attributeMask = (1 << VERTEX_ATTRIBUTE_POSITION) | (1 << VERTEX_ATTRIBUTE_COLOR);
+	meshData.vertexCount = 3;
+	meshData.streams[VERTEX_ATTRIBUTE_POSITION] = { 0.0f, -0.5f, 0.0f, 0.5f, 0.5f, 0.0f, -0.5f, 0.5f, 0.0f };
+	meshData.streams[VERTEX_ATTRIBUTE_COLOR] = { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+	meshData.indices = { 0, 1, 2 };
+	return meshData;
+}
+
+void GetMeshDataBounds(const MeshData& meshData, float outMin[3], float outMax[3])
+{
+	const auto& positions = meshData.streams[VERTEX_ATTRIBUTE_POSITION];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		outMin[axis] = FLT_MAX;
+		outMax[axis] = -FLT_MAX;
+	}
+
+	for (size_t i = 0; i + 2 < positions.size(); i += 3)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			outMin[axis] = std::min(outMin[axis], positions[i + axis]);
+			outMax[axis] = std::max(outMax[axis], positions[i + axis]);
+		}
+	}
+}
+
+void GetInstanceBounds(const InstanceData& instance, const float meshMin[3], const float meshMax[3], float outMin[3], float outMax[3])
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		outMin[axis] = meshMin[axis] * instance.scale + instance.position[axis];
+		outMax[axis] = meshMax[axis] * instance.scale + instance.position[axis];
+		if (instance.scale < 0.0f)
+			std::swap(outMin[axis], outMax[axis]);
+	}
+}
+
+// Textures
+//	Textures load from KTX2 containers. Block compressed levels upload as stored, Basis supercompressed ones (ETC1S
+//	and UASTC) are transcoded to the best block format the device samples from. Transcoding needs the Basis
+//	Universal transcoder, build with AVULKAN_WITH_BASISU and basisu_transcoder.cpp to enable it.
+struct TextureData
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkExtent2D extent = {};
+	std::vector<char> data;
+	std::vector<VkDeviceSize> mipOffsets;	//	Into data, 16 byte aligned so every block format keeps its alignment.
+	std::vector<VkDeviceSize> mipSizes;
+};
+
+struct Texture
+{
+	VkImage image = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkImageView view = VK_NULL_HANDLE;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkExtent2D extent = {};
+	uint32_t mipLevels = 0;
+};
+
+const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+enum Ktx2Supercompression : uint32_t
+{
+	KTX2_SUPERCOMPRESSION_NONE = 0,
+	KTX2_SUPERCOMPRESSION_BASIS_LZ,
+	KTX2_SUPERCOMPRESSION_ZSTD,
+	KTX2_SUPERCOMPRESSION_ZLIB,
+};
+
+//	Data format descriptor values of the basic block, see the Khronos Data Format specification.
+const uint8_t KHR_DF_MODEL_ETC1S = 163;
+const uint8_t KHR_DF_MODEL_UASTC = 166;
+const uint8_t KHR_DF_TRANSFER_SRGB = 2;
+
+#pragma pack(push, 1)
+struct Ktx2Header
+{
+	uint8_t identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+struct Ktx2LevelIndex
+{
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+#pragma pack(pop)
+
+bool IsVulkanFormatSampled(const VkPhysicalDevice& physicalDevice, VkFormat format)
+{
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+	return (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+}
+
+VkDeviceSize AddTextureMip(TextureData& texture, VkDeviceSize size)
+{
+	VkDeviceSize offset = (texture.data.size() + 15) & ~static_cast<VkDeviceSize>(15);
+	texture.data.resize(static_cast<size_t>(offset + size));
+	texture.mipOffsets.push_back(offset);
+	texture.mipSizes.push_back(size);
+	return offset;
+}
+
+#ifdef AVULKAN_WITH_BASISU
+//	Ordered by preference. Opaque only targets are skipped for textures with alpha.
+struct BasisTranscodeTarget
+{
+	VkFormat unorm;
+	VkFormat srgb;
+	basist::transcoder_texture_format format;
+	bool alpha;
+};
+
+const BasisTranscodeTarget BASIS_TRANSCODE_TARGETS[] = {
+	{ VK_FORMAT_BC7_UNORM_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK, basist::transcoder_texture_format::cTFBC7_RGBA, true },
+	{ VK_FORMAT_ASTC_4x4_UNORM_BLOCK, VK_FORMAT_ASTC_4x4_SRGB_BLOCK, basist::transcoder_texture_format::cTFASTC_4x4_RGBA, true },
+	{ VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK, basist::transcoder_texture_format::cTFETC2_RGBA, true },
+	{ VK_FORMAT_BC3_UNORM_BLOCK, VK_FORMAT_BC3_SRGB_BLOCK, basist::transcoder_texture_format::cTFBC3_RGBA, true },
+	{ VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC1_RGB_SRGB_BLOCK, basist::transcoder_texture_format::cTFBC1_RGB, false },
+	{ VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK, basist::transcoder_texture_format::cTFETC1_RGB, false },
+	{ VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB, basist::transcoder_texture_format::cTFRGBA32, true },
+};
+
+void TranscodeKtx2TextureData(const VkPhysicalDevice& physicalDevice, const std::vector<char>& file, bool srgb, TextureData& outTexture)
+{
+	static std::once_flag initialized;
+	std::call_once(initialized, []() { basist::basisu_transcoder_init(); });
+
+	basist::ktx2_transcoder transcoder;
+	if (!transcoder.init(file.data(), static_cast<uint32_t>(file.size())) || !transcoder.start_transcoding())
+		throw std::runtime_error("Texture: failed to start Basis transcoding!");
+
+	const BasisTranscodeTarget* target = nullptr;
+	for (const auto& candidate : BASIS_TRANSCODE_TARGETS)
+	{
+		if ((candidate.alpha || !transcoder.get_has_alpha()) && IsVulkanFormatSampled(physicalDevice, srgb ? candidate.srgb : candidate.unorm))
+		{
+			target = &candidate;
+			break;
+		}
+	}
+	if (!target)
+		throw std::runtime_error("Texture: no transcode target is supported by the device!");
+
+	outTexture.format = srgb ? target->srgb : target->unorm;
+	uint32_t bytesPerBlock = basist::basis_get_bytes_per_block_or_pixel(target->format);
+	bool uncompressed = basist::basis_transcoder_format_is_uncompressed(target->format);
+
+	for (uint32_t level = 0; level < transcoder.get_levels(); level++)
+	{
+		basist::ktx2_image_level_info info;
+		if (!transcoder.get_image_level_info(info, level, 0, 0))
+			throw std::runtime_error("Texture: failed to read Basis level info!");
+
+		uint32_t units = uncompressed ? info.m_orig_width * info.m_orig_height : info.m_total_blocks;
+		VkDeviceSize offset = AddTextureMip(outTexture, static_cast<VkDeviceSize>(units) * bytesPerBlock);
+
+		if (!transcoder.transcode_image_level(level, 0, 0, outTexture.data.data() + offset, units, target->format))
+			throw std::runtime_error("Texture: failed to transcode Basis level!");
+	}
+}
+#endif
+
+//	Only 2D textures without array layers or cube faces are supported. A level count of zero means the file
+//	expects mips to be generated, only the base level is loaded then.
+void LoadKtx2TextureData(const VkPhysicalDevice& physicalDevice, const std::string& path, TextureData& outTexture)
+{
+	std::vector<char> file = ReadFile(path);
+
+	Ktx2Header header;
+	if (file.size() < sizeof(header))
+		throw std::runtime_error("Texture: file too small for a KTX2 header!");
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		throw std::runtime_error("Texture: not a KTX2 file!");
+	if (header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1)
+		throw std::runtime_error("Texture: only 2D KTX2 textures are supported!");
+
+	uint32_t levelCount = std::max(1u, header.levelCount);
+	if (sizeof(header) + levelCount * sizeof(Ktx2LevelIndex) > file.size() || header.dfdByteOffset + header.dfdByteLength > file.size())
+		throw std::runtime_error("Texture: truncated KTX2 file!");
+
+	std::vector<Ktx2LevelIndex> levels(levelCount);
+	memcpy(levels.data(), file.data() + sizeof(header), levelCount * sizeof(Ktx2LevelIndex));
+
+	//	The basic descriptor block follows the DFD's total size and the block's two header words.
+	bool hasDescriptor = header.dfdByteLength >= 16;
+	uint8_t colorModel = hasDescriptor ? static_cast<uint8_t>(file[header.dfdByteOffset + 12]) : 0;
+
+	outTexture = TextureData();
+	outTexture.extent = { header.pixelWidth, header.pixelHeight };
+
+	bool basis = header.supercompressionScheme == KTX2_SUPERCOMPRESSION_BASIS_LZ || colorModel == KHR_DF_MODEL_UASTC || colorModel == KHR_DF_MODEL_ETC1S;
+	if (basis)
+	{
+#ifdef AVULKAN_WITH_BASISU
+		bool srgb = hasDescriptor && static_cast<uint8_t>(file[header.dfdByteOffset + 14]) == KHR_DF_TRANSFER_SRGB;
+		TranscodeKtx2TextureData(physicalDevice, file, srgb, outTexture);
+#else
+		throw std::runtime_error("Texture: Basis KTX2 files need a build with AVULKAN_WITH_BASISU!");
+#endif
+	}
+	else
+	{
+		if (header.supercompressionScheme != KTX2_SUPERCOMPRESSION_NONE)
+			throw std::runtime_error("Texture: unsupported KTX2 supercompression scheme!");
+
+		outTexture.format = static_cast<VkFormat>(header.vkFormat);
+		if (!IsVulkanFormatSampled(physicalDevice, outTexture.format))
+			throw std::runtime_error("Texture: the device cannot sample the KTX2 file's format!");
+
+		for (const auto& level : levels)
+		{
+			if (level.byteOffset + level.byteLength > file.size())
+				throw std::runtime_error("Texture: truncated KTX2 level!");
+
+			VkDeviceSize offset = AddTextureMip(outTexture, level.byteLength);
+			memcpy(outTexture.data.data() + offset, file.data() + level.byteOffset, static_cast<size_t>(level.byteLength));
+		}
+	}
+
+	Print("Texture: Loaded %s, %ix%i with %i mip(s), format %i", path.c_str(), static_cast<int>(outTexture.extent.width), static_cast<int>(outTexture.extent.height),
+		static_cast<int>(outTexture.mipOffsets.size()), static_cast<int>(outTexture.format));
+}
+
+uint32_t GetFullMipCount(VkExtent2D extent)
+{
+	uint32_t mipLevels = 1;
+	while ((extent.width | extent.height) >> mipLevels)
+		mipLevels++;
+	return mipLevels;
+}
+
+//	Linear blits are what the GPU fallback of mip generation needs.
+bool IsVulkanFormatBlittable(const VkPhysicalDevice& physicalDevice, VkFormat format)
+{
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+	return (properties.optimalTilingFeatures & required) == required;
+}
+
+//	Queues every mip as one upload, the texture is ready for fragment shaders once the uploads are flushed. With
+//	generateMips a texture that only has its base level gets the rest of the chain blitted on the GPU. Prefer
+//	GenerateTextureMips for the formats it handles, its filters are better than the blit's bilinear one.
+void CreateVulkanTexture(const VkPhysicalDevice& physicalDevice, const VkDevice& device, UploadEngine& uploadEngine, const TextureData& textureData, bool generateMips, Texture& outTexture)
+{
+	outTexture.format = textureData.format;
+	outTexture.extent = textureData.extent;
+	outTexture.mipLevels = static_cast<uint32_t>(textureData.mipOffsets.size());
+
+	bool blitMips = generateMips && outTexture.mipLevels == 1 && GetFullMipCount(outTexture.extent) > 1;
+	if (blitMips && !IsVulkanFormatBlittable(physicalDevice, outTexture.format))
+	{
+		Print("Texture: format %i does not support linear blits, keeping a single mip", static_cast<int>(outTexture.format));
+		blitMips = false;
+	}
+	if (blitMips)
+		outTexture.mipLevels = GetFullMipCount(outTexture.extent);
+
+	VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = outTexture.format;
+	imageInfo.extent = { outTexture.extent.width, outTexture.extent.height, 1 };
+	imageInfo.mipLevels = outTexture.mipLevels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | (blitMips ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(device, &imageInfo, nullptr, &outTexture.image) != VK_SUCCESS)
+		throw std::runtime_error("failed to create texture image!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, outTexture.image, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = FindVulkanMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &outTexture.memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate texture memory!");
+	vkBindImageMemory(device, outTexture.image, outTexture.memory, 0);
+
+	VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, outTexture.mipLevels, 0, 1 };
+
+	std::vector<VkBufferImageCopy> regions;
+	for (uint32_t mip = 0; mip < textureData.mipOffsets.size(); mip++)
+	{
+		VkBufferImageCopy region{};
+		region.bufferOffset = textureData.mipOffsets[mip];
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 };
+		region.imageExtent = { std::max(1u, outTexture.extent.width >> mip), std::max(1u, outTexture.extent.height >> mip), 1 };
+		regions.push_back(region);
+	}
+
+	QueueImageUpload(uploadEngine, textureData.data.data(), textureData.data.size(), outTexture.image, range, regions, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, blitMips);
+
+	VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+	viewInfo.image = outTexture.image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = outTexture.format;
+	viewInfo.subresourceRange = range;
+
+	if (vkCreateImageView(device, &viewInfo, nullptr, &outTexture.view) != VK_SUCCESS)
+		throw std::runtime_error("failed to create texture image view!");
+}
+
+void DestroyVulkanTexture(const VkDevice& device, Texture& texture)
+{
+	vkDestroyImageView(device, texture.view, nullptr);
+	vkDestroyImage(device, texture.image, nullptr);
+	vkFreeMemory(device, texture.memory, nullptr);
+	texture = Texture();
+}
+
+// Parallel For
+//	Splits [0, count) into chunks of grainSize and runs body on the calling thread plus up to one worker per core.
+//	Threads are started per call, so the grain size should keep each chunk well above the cost of starting one.
+//	body must not throw.
+void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body)
+{
+	size_t chunkCount = (count + grainSize - 1) / grainSize;
+	size_t threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), chunkCount);
+
+	if (threadCount <= 1)
+	{
+		if (count > 0)
+			body(0, count);
+		return;
+	}
+
+	std::atomic<size_t> nextChunk{ 0 };
+	auto worker = [&]()
+	{
+		for (size_t chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++)
+			body(chunk * grainSize, std::min(count, (chunk + 1) * grainSize));
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < threadCount; i++)
+		threads.emplace_back(worker);
+
+	worker();
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+//	Best of repeats runs in milliseconds, for the --benchmark modes.
+template<typename Function>
+float TimeBestOf(uint32_t repeats, Function&& function)
+{
+	float best = FLT_MAX;
+	for (uint32_t i = 0; i < repeats; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		function();
+		best = std::min(best, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+
+// Radix Sort
+const size_t RADIX_SORT_GRAIN_SIZE = 16384;
+
+struct RadixSortEntry
+{
+	uint64_t key;
+	uint32_t value;
+};
+
+//	Stable LSD radix sort on 8 bit digits. Each pass histograms and scatters chunks of the input in parallel, and
+//	digits that every key shares are skipped, so keys with unused bits cost fewer passes.
+void RadixSort(std::vector<RadixSortEntry>& entries, std::vector<RadixSortEntry>& scratch)
+{
+	const size_t count = entries.size();
+	const size_t chunkCount = std::max<size_t>(1, (count + RADIX_SORT_GRAIN_SIZE - 1) / RADIX_SORT_GRAIN_SIZE);
+	std::vector<size_t> offsets(chunkCount * 256);
+	scratch.resize(count);
+
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		ParallelFor(chunkCount, 1, [&](size_t begin, size_t end)
+		{
+			for (size_t chunk = begin; chunk < end; chunk++)
+			{
+				size_t* histogram = &offsets[chunk * 256];
+				std::fill(histogram, histogram + 256, 0);
+				for (size_t i = chunk * RADIX_SORT_GRAIN_SIZE; i < std::min(count, (chunk + 1) * RADIX_SORT_GRAIN_SIZE); i++)
+					histogram[(entries[i].key >> shift) & 0xFF]++;
+			}
+		});
+
+		//	Exclusive prefix sum over digits and then chunks, so equal digits keep their input order.
+		bool sharedDigit = false;
+		size_t offset = 0;
+		for (uint32_t digit = 0; digit < 256; digit++)
+		{
+			size_t digitCount = 0;
+			for (size_t chunk = 0; chunk < chunkCount; chunk++)
+			{
+				size_t n = offsets[chunk * 256 + digit];
+				offsets[chunk * 256 + digit] = offset;
+				offset += n;
+				digitCount += n;
+			}
+			sharedDigit |= digitCount == count;
+		}
+
+		if (sharedDigit)
+			continue;
+
+		ParallelFor(chunkCount, 1, [&](size_t begin, size_t end)
+		{
+			for (size_t chunk = begin; chunk < end; chunk++)
+			{
+				size_t* chunkOffsets = &offsets[chunk * 256];
+				for (size_t i = chunk * RADIX_SORT_GRAIN_SIZE; i < std::min(count, (chunk + 1) * RADIX_SORT_GRAIN_SIZE); i++)
+					scratch[chunkOffsets[(entries[i].key >> shift) & 0xFF]++] = entries[i];
+			}
+		});
+
+		entries.swap(scratch);
+	}
+}
+
+// Frustum Culling
+const size_t CULLING_GRAIN_SIZE = 16384;
+
+//	Plane normals point into the frustum and are normalized, so a point is inside when dot(n, p) + d >= 0.
+struct FrustumPlanes
+{
+	float x[6], y[6], z[6], d[6];
+};
+
+//	Gribb/Hartmann extraction from a column major view projection matrix with Vulkan's [0, 1] depth range.
+void ExtractFrustumPlanes(const float viewProjection[16], FrustumPlanes& outPlanes)
+{
+	auto row = [&](int r, int c) { return viewProjection[c * 4 + r]; };
+
+	for (int plane = 0; plane < 6; plane++)
+	{
+		int axis = plane / 2;
+		float sign = plane % 2 ? -1.0f : 1.0f;
+
+		float coefficients[4];
+		for (int c = 0; c < 4; c++)
+		{
+			//	Left/right and bottom/top are w +- x and w +- y, near is z and far is w - z.
+			if (axis < 2)
+				coefficients[c] = row(3, c) + sign * row(axis, c);
+			else
+				coefficients[c] = plane == 4 ? row(2, c) : row(3, c) - row(2, c);
+		}
+
+		float length = std::sqrt(coefficients[0] * coefficients[0] + coefficients[1] * coefficients[1] + coefficients[2] * coefficients[2]);
+		outPlanes.x[plane] = coefficients[0] / length;
+		outPlanes.y[plane] = coefficients[1] / length;
+		outPlanes.z[plane] = coefficients[2] / length;
+		outPlanes.d[plane] = coefficients[3] / length;
+	}
+}
+
+enum CullingShape : uint8_t
+{
+	CULLING_SHAPE_AABB = 0,		//	Center and half extents.
+	CULLING_SHAPE_SPHERE,		//	Center and radius.
+};
+
+//	Object bounds as structure of arrays, so one SIMD load fetches the same component of 4 or 8 objects.
+struct CullingBounds
+{
+	CullingShape shape = CULLING_SHAPE_AABB;
+	size_t count = 0;
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<float> radius;
+};
+
+uint32_t AddCullingAABB(CullingBounds& bounds, const float min[3], const float max[3])
+{
+	assert(bounds.shape == CULLING_SHAPE_AABB);
+
+	bounds.centerX.push_back((min[0] + max[0]) * 0.5f);
+	bounds.centerY.push_back((min[1] + max[1]) * 0.5f);
+	bounds.centerZ.push_back((min[2] + max[2]) * 0.5f);
+	bounds.extentX.push_back((max[0] - min[0]) * 0.5f);
+	bounds.extentY.push_back((max[1] - min[1]) * 0.5f);
+	bounds.extentZ.push_back((max[2] - min[2]) * 0.5f);
+	return static_cast<uint32_t>(bounds.count++);
+}
+
+uint32_t AddCullingSphere(CullingBounds& bounds, const float center[3], float radius)
+{
+	assert(bounds.shape == CULLING_SHAPE_SPHERE);
+
+	bounds.centerX.push_back(center[0]);
+	bounds.centerY.push_back(center[1]);
+	bounds.centerZ.push_back(center[2]);
+	bounds.radius.push_back(radius);
+	return static_cast<uint32_t>(bounds.count++);
+}
+
+//	An object is culled when it lies entirely behind any plane. For an AABB the furthest point along the normal
+//	is center + |n| . extents, for a sphere it is center + radius. The sums are grouped like the SIMD paths', so
+//	every path reaches the same result for objects touching a plane.
+template<CullingShape shape>
+void CullFrustumScalar(const FrustumPlanes& planes, const CullingBounds& bounds, size_t begin, size_t end, uint8_t* outVisible)
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		bool visible = true;
+		for (int p = 0; p < 6 && visible; p++)
+		{
+			float distance = (planes.x[p] * bounds.centerX[i] + planes.y[p] * bounds.centerY[i]) + (planes.z[p] * bounds.centerZ[i] + planes.d[p]);
+			if constexpr (shape == CULLING_SHAPE_AABB)
+				distance += (std::abs(planes.x[p]) * bounds.extentX[i] + std::abs(planes.y[p]) * bounds.extentY[i]) + std::abs(planes.z[p]) * bounds.extentZ[i];
+			else
+				distance += bounds.radius[i];
+			visible = distance >= 0.0f;
+		}
+		outVisible[i] = visible;
+	}
+}
+
+#ifdef AVULKAN_X86
+template<CullingShape shape>
+void CullFrustumSSE(const FrustumPlanes& planes, const CullingBounds& bounds, size_t begin, size_t end, uint8_t* outVisible)
+{
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128 zero = _mm_setzero_ps();
+
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&bounds.centerX[i]), cy = _mm_loadu_ps(&bounds.centerY[i]), cz = _mm_loadu_ps(&bounds.centerZ[i]);
+		__m128 ex, ey, ez, r;
+		if constexpr (shape == CULLING_SHAPE_AABB)
+		{
+			ex = _mm_loadu_ps(&bounds.extentX[i]);
+			ey = _mm_loadu_ps(&bounds.extentY[i]);
+			ez = _mm_loadu_ps(&bounds.extentZ[i]);
+		}
+		else
+			r = _mm_loadu_ps(&bounds.radius[i]);
+
+		__m128 outside = zero;
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 nx = _mm_set1_ps(planes.x[p]), ny = _mm_set1_ps(planes.y[p]), nz = _mm_set1_ps(planes.z[p]);
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(planes.d[p])));
+			if constexpr (shape == CULLING_SHAPE_AABB)
+			{
+				__m128 extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(nx, absMask), ex), _mm_mul_ps(_mm_and_ps(ny, absMask), ey)), _mm_mul_ps(_mm_and_ps(nz, absMask), ez));
+				distance = _mm_add_ps(distance, extent);
+			}
+			else
+				distance = _mm_add_ps(distance, r);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		for (int lane = 0; lane < 4; lane++)
+			outVisible[i + lane] = !(mask & (1 << lane));
+	}
+
+	CullFrustumScalar<shape>(planes, bounds, i, end, outVisible);
+}
+
+template<CullingShape shape>
+AVULKAN_TARGET_AVX void CullFrustumAVX(const FrustumPlanes& planes, const CullingBounds& bounds, size_t begin, size_t end, uint8_t* outVisible)
+{
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(&bounds.centerX[i]), cy = _mm256_loadu_ps(&bounds.centerY[i]), cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+		__m256 ex, ey, ez, r;
+		if constexpr (shape == CULLING_SHAPE_AABB)
+		{
+			ex = _mm256_loadu_ps(&bounds.extentX[i]);
+			ey = _mm256_loadu_ps(&bounds.extentY[i]);
+			ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+		}
+		else
+			r = _mm256_loadu_ps(&bounds.radius[i]);
+
+		__m256 outside = zero;
+		for (int p = 0; p < 6; p++)
+		{
+			__m256 nx = _mm256_set1_ps(planes.x[p]), ny = _mm256_set1_ps(planes.y[p]), nz = _mm256_set1_ps(planes.z[p]);
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)), _mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(planes.d[p])));
+			if constexpr (shape == CULLING_SHAPE_AABB)
+			{
+				__m256 extent = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_and_ps(nx, absMask), ex), _mm256_mul_ps(_mm256_and_ps(ny, absMask), ey)), _mm256_mul_ps(_mm256_and_ps(nz, absMask), ez));
+				distance = _mm256_add_ps(distance, extent);
+			}
+			else
+				distance = _mm256_add_ps(distance, r);
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, zero, _CMP_LT_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(outside);
+		for (int lane = 0; lane < 8; lane++)
+			outVisible[i + lane] = !(mask & (1 << lane));
+	}
+
+	CullFrustumScalar<shape>(planes, bounds, i, end, outVisible);
+}
+
+bool IsAVXSupported()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+	return __builtin_cpu_supports("avx");
+#endif
+}
+#endif
+
+template<CullingShape shape>
+void CullFrustumRange(const FrustumPlanes& planes, const CullingBounds& bounds, size_t begin, size_t end, uint8_t* outVisible)
+{
+#ifdef AVULKAN_X86
+	static const bool avx = IsAVXSupported();
+	if (avx)
+		CullFrustumAVX<shape>(planes, bounds, begin, end, outVisible);
+	else
+		CullFrustumSSE<shape>(planes, bounds, begin, end, outVisible);
+#else
+	CullFrustumScalar<shape>(planes, bounds, begin, end, outVisible);
+#endif
+}
+
+//	Writes one visibility byte per object.
+void CullFrustum(const FrustumPlanes& planes, const CullingBounds& bounds, std::vector<uint8_t>& outVisible)
+{
+	outVisible.resize(bounds.count);
+
+	ParallelFor(bounds.count, CULLING_GRAIN_SIZE, [&](size_t begin, size_t end)
+	{
+		if (bounds.shape == CULLING_SHAPE_AABB)
+			CullFrustumRange<CULLING_SHAPE_AABB>(planes, bounds, begin, end, outVisible.data());
+		else
+			CullFrustumRange<CULLING_SHAPE_SPHERE>(planes, bounds, begin, end, outVisible.data());
+	});
+}
+
+//	AVulkan --benchmark-culling
+//	Times each path on one thread over random objects around a perspective frustum, and fails when a path's
+//	visibility differs from the scalar one.
+int BenchmarkCulling()
+{
+	//	90 degree vertical field of view, 16:9, near 0.1 and far 1000, looking down -z.
+	const float aspect = 16.0f / 9.0f, zNear = 0.1f, zFar = 1000.0f;
+	const float viewProjection[16] = {
+		1.0f / aspect, 0.0f, 0.0f, 0.0f,
+		0.0f, -1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, zFar / (zNear - zFar), -1.0f,
+		0.0f, 0.0f, zNear * zFar / (zNear - zFar), 0.0f };
+	FrustumPlanes planes;
+	ExtractFrustumPlanes(viewProjection, planes);
+
+	using CullFunction = void(*)(const FrustumPlanes&, const CullingBounds&, size_t, size_t, uint8_t*);
+	struct CullPath
+	{
+		const char* name;
+		CullFunction aabb;
+		CullFunction sphere;
+	};
+
+	std::vector<CullPath> paths = { { "scalar", CullFrustumScalar<CULLING_SHAPE_AABB>, CullFrustumScalar<CULLING_SHAPE_SPHERE> } };
+#ifdef AVULKAN_X86
+	paths.push_back({ "SSE", CullFrustumSSE<CULLING_SHAPE_AABB>, CullFrustumSSE<CULLING_SHAPE_SPHERE> });
+	if (IsAVXSupported())
+		paths.push_back({ "AVX", CullFrustumAVX<CULLING_SHAPE_AABB>, CullFrustumAVX<CULLING_SHAPE_SPHERE> });
+	else
+		Print("Culling Benchmark: AVX is not supported, skipping it");
+#endif
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-zFar, zFar);
+	std::uniform_real_distribution<float> size(0.1f, 20.0f);
+
+	bool mismatch = false;
+	for (size_t count : { size_t(100000), size_t(1000000) })
+	{
+		for (CullingShape shape : { CULLING_SHAPE_AABB, CULLING_SHAPE_SPHERE })
+		{
+			CullingBounds bounds;
+			bounds.shape = shape;
+			for (size_t i = 0; i < count; i++)
+			{
+				float center[3] = { position(random), position(random), position(random) };
+				if (shape == CULLING_SHAPE_SPHERE)
+				{
+					AddCullingSphere(bounds, center, size(random));
+					continue;
+				}
+
+				float extent[3] = { size(random), size(random), size(random) };
+				float min[3] = { center[0] - extent[0], center[1] - extent[1], center[2] - extent[2] };
+				float max[3] = { center[0] + extent[0], center[1] + extent[1], center[2] + extent[2] };
+				AddCullingAABB(bounds, min, max);
+			}
+
+			std::vector<uint8_t> reference(count), visible(count);
+			for (const auto& path : paths)
+			{
+				CullFunction cull = shape == CULLING_SHAPE_AABB ? path.aabb : path.sphere;
+				std::vector<uint8_t>& output = &path == &paths.front() ? reference : visible;
+				float milliseconds = TimeBestOf(10, [&]() { cull(planes, bounds, 0, count, output.data()); });
+
+				size_t differences = 0;
+				for (size_t i = 0; i < count; i++)
+					differences += output[i] != reference[i];
+				mismatch |= differences > 0;
+
+				Print("Culling Benchmark: %7i %-7s %-6s %8.3f ms, %i visible, %i differ from scalar", static_cast<int>(count), shape == CULLING_SHAPE_AABB ? "AABBs" : "spheres",
+					path.name, milliseconds, static_cast<int>(std::count(output.begin(), output.end(), 1)), static_cast<int>(differences));
+			}
+		}
+	}
+
+	if (mismatch)
+		Print("Culling Benchmark: FAILED, the SIMD paths disagree with the scalar path");
+	return mismatch ? 1 : 0;
+}
+
+// Mip Generation
+//	Builds the mip chain of 8 bit RGBA and BGRA textures on the CPU. Filtering happens in linear float, sRGB colour
+//	is decoded before and encoded after while alpha always stays linear. Each level filters the one above it, so
+//	levels run one after another and their rows are split across threads.
+const size_t MIP_GENERATION_GRAIN_SIZE = 16;
+const int MIP_KAISER_TAPS = 6;
+const float MIP_KAISER_ALPHA = 4.0f;
+
+enum MipFilter : uint8_t
+{
+	MIP_FILTER_BOX = 0,		//	2x2 average.
+	MIP_FILTER_KAISER,		//	Kaiser windowed sinc over 6x6 texels, sharper than the box and aliases less.
+};
+
+enum MipPath : uint8_t
+{
+	MIP_PATH_BEST = 0,		//	AVX when the CPU has it, SSE otherwise.
+	MIP_PATH_SCALAR,
+	MIP_PATH_SSE,
+	MIP_PATH_AVX,
+};
+
+bool CanGenerateTextureMips(VkFormat format)
+{
+	return format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+}
+
+struct SrgbTables
+{
+	float decode[256];
+	uint8_t encode[65536];	//	Indexed by linear value in 1/65535 steps, fine enough for every 8 bit value to round trip.
+};
+
+const SrgbTables& GetSrgbTables()
+{
+	static SrgbTables tables;
+	static std::once_flag initialized;
+	std::call_once(initialized, []()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			float srgb = i / 255.0f;
+			tables.decode[i] = srgb <= 0.04045f ? srgb / 12.92f : std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < 65536; i++)
+		{
+			float linear = i / 65535.0f;
+			float srgb = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+			tables.encode[i] = static_cast<uint8_t>(std::min(255.0f, srgb * 255.0f + 0.5f));
+		}
+	});
+	return tables;
+}
+
+void DecodeMipRow(const uint8_t* src, uint32_t width, bool srgb, float* out)
+{
+	const SrgbTables& tables = GetSrgbTables();
+	for (uint32_t i = 0; i < width * 4; i++)
+		out[i] = srgb && (i & 3) != 3 ? tables.decode[src[i]] : src[i] * (1.0f / 255.0f);
+}
+
+//	Clamps first, the Kaiser filter's negative lobes can overshoot.
+void EncodeMipRow(const float* src, uint32_t width, bool srgb, uint8_t* out)
+{
+	const SrgbTables& tables = GetSrgbTables();
+	for (uint32_t i = 0; i < width * 4; i++)
+	{
+		float value = std::min(std::max(src[i], 0.0f), 1.0f);
+		out[i] = srgb && (i & 3) != 3 ? tables.encode[static_cast<uint32_t>(value * 65535.0f + 0.5f)] : static_cast<uint8_t>(value * 255.0f + 0.5f);
+	}
+}
+
+//	Taps sit at -2.5 to 2.5 source texels from the output texel's center. The sinc is scaled to the output's
+//	Nyquist frequency and windowed over 3 texels, the weights are normalized so flat areas stay flat.
+struct KaiserMipWeights
+{
+	float weights[MIP_KAISER_TAPS];
+};
+
+const KaiserMipWeights& GetKaiserMipWeights()
+{
+	static const KaiserMipWeights kaiser = []()
+	{
+		auto besselI0 = [](float x)
+		{
+			float sum = 1.0f, term = 1.0f;
+			for (int k = 1; k < 32; k++)
+			{
+				term *= (x * 0.5f / k) * (x * 0.5f / k);
+				sum += term;
+			}
+			return sum;
+		};
+
+		const float pi = 3.14159265f;
+		KaiserMipWeights result;
+		float total = 0.0f;
+		for (int tap = 0; tap < MIP_KAISER_TAPS; tap++)
+		{
+			float distance = tap - 2.5f;
+			float t = distance * 0.5f;
+			float sinc = std::sin(pi * t) / (pi * t);
+			float u = distance / 3.0f;
+			float window = besselI0(MIP_KAISER_ALPHA * std::sqrt(1.0f - u * u)) / besselI0(MIP_KAISER_ALPHA);
+			result.weights[tap] = sinc * window;
+			total += result.weights[tap];
+		}
+		for (float& weight : result.weights)
+			weight /= total;
+		return result;
+	}();
+	return kaiser;
+}
+
+//	Rows are RGBA floats. row1 is the row below row0, or row0 again for a single row source.
+void BoxFilterMipRowScalar(const float* row0, const float* row1, uint32_t srcWidth, float* out, uint32_t begin, uint32_t outWidth)
+{
+	for (uint32_t x = begin; x < outWidth; x++)
+	{
+		uint32_t x0 = std::min(2 * x, srcWidth - 1) * 4, x1 = std::min(2 * x + 1, srcWidth - 1) * 4;
+		for (uint32_t c = 0; c < 4; c++)
+			out[x * 4 + c] = 0.25f * (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]);
+	}
+}
+
+//	Horizontal pass, clamps at the edges.
+void KaiserFilterMipRowScalar(const float* src, uint32_t srcWidth, float* out, uint32_t begin, uint32_t end)
+{
+	const float* weights = GetKaiserMipWeights().weights;
+	for (uint32_t x = begin; x < end; x++)
+	{
+		float sum[4] = {};
+		for (int tap = 0; tap < MIP_KAISER_TAPS; tap++)
+		{
+			int64_t column = std::min<int64_t>(std::max<int64_t>(2 * static_cast<int64_t>(x) - 2 + tap, 0), srcWidth - 1);
+			for (uint32_t c = 0; c < 4; c++)
+				sum[c] += weights[tap] * src[column * 4 + c];
+		}
+		for (uint32_t c = 0; c < 4; c++)
+			out[x * 4 + c] = sum[c];
+	}
+}
+
+//	Vertical pass over horizontally filtered rows, count is in floats.
+void KaiserCombineMipRowsScalar(const float* const* rows, float* out, size_t begin, size_t count)
+{
+	const float* weights = GetKaiserMipWeights().weights;
+	for (size_t i = begin; i < count; i++)
+	{
+		float sum = 0.0f;
+		for (int tap = 0; tap < MIP_KAISER_TAPS; tap++)
+			sum += weights[tap] * rows[tap][i];
+		out[i] = sum;
+	}
+}
+
+#ifdef AVULKAN_X86
+//	One RGBA texel per register, two source texels per output texel from each row.
+void BoxFilterMipRowSSE(const float* row0, const float* row1, uint32_t srcWidth, float* out, uint32_t outWidth)
+{
+	const __m128 quarter = _mm_set1_ps(0.25f);
+
+	uint32_t x = 0;
+	if (srcWidth >= 2)
+	{
+		for (; x < outWidth; x++)
+		{
+			__m128 left = _mm_add_ps(_mm_loadu_ps(row0 + x * 8), _mm_loadu_ps(row1 + x * 8));
+			__m128 right = _mm_add_ps(_mm_loadu_ps(row0 + x * 8 + 4), _mm_loadu_ps(row1 + x * 8 + 4));
+			_mm_storeu_ps(out + x * 4, _mm_mul_ps(_mm_add_ps(left, right), quarter));
+		}
+	}
+
+	BoxFilterMipRowScalar(row0, row1, srcWidth, out, x, outWidth);
+}
+
+//	Only texels whose taps are all inside the row, the scalar version clamps the edges.
+void KaiserFilterMipRowSSE(const float* src, uint32_t srcWidth, float* out, uint32_t outWidth)
+{
+	const float* weights = GetKaiserMipWeights().weights;
+	uint32_t interiorEnd = srcWidth >= 4 ? std::min(outWidth, (srcWidth - 4) / 2 + 1) : 0;
+
+	KaiserFilterMipRowScalar(src, srcWidth, out, 0, std::min(1u, outWidth));
+	uint32_t x = 1;
+	for (; x < interiorEnd; x++)
+	{
+		const float* taps = src + (2 * x - 2) * 4;
+		__m128 sum = _mm_setzero_ps();
+		for (int tap = 0; tap < MIP_KAISER_TAPS; tap++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[tap]), _mm_loadu_ps(taps + tap * 4)));
+		_mm_storeu_ps(out + x * 4, sum);
+	}
+	KaiserFilterMipRowScalar(src, srcWidth, out, std::max(x, std::min(1u, outWidth)), outWidth);
+}
+
+void KaiserCombineMipRowsSSE(const float* const* rows, float* out, size_t count)
+{
+	const float* weights = GetKaiserMipWeights().weights;
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 sum = _mm_setzero_ps();
+		for (int tap = 0; tap < MIP_KAISER_TAPS; tap++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[tap]), _mm_loadu_ps(rows[tap] + i)));
+		_mm_storeu_ps(out + i, sum);
+	}
+
+	KaiserCombineMipRowsScalar(rows, out, i, count);
+}
+
+//	Two output texels per iteration. The four source texels of a row pair are summed vertically, then the 128 bit
+//	lanes are shuffled so texels 0 and 2 add to texels 1 and 3.
+AVULKAN_TARGET_AVX void BoxFilterMipRowAVX(const float* row0, const float* row1, uint32_t srcWidth, float* out, uint32_t outWidth)
+{
+	const __m256 quarter = _mm256_set1_ps(0.25f);
+
+	uint32_t x = 0;
+	if (srcWidth >= 2)
+	{
+		for (; x + 2 <= outWidth; x += 2)
+		{
+			__m256 first = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8), _mm256_loadu_ps(row1 + x * 8));
+			__m256 second = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8 + 8), _mm256_loadu_ps(row1 + x * 8 + 8));
+			__m256 even = _mm256_permute2f128_ps(first, second, 0x20);
+			__m256 odd = _mm256_permute2f128_ps(first, second, 0x31);
+			_mm256_storeu_ps(out + x * 4, _mm256_mul_ps(_mm256_add_ps(even, odd), quarter));
+		}
+	}
+
+	BoxFilterMipRowScalar(row0, row1, srcWidth, out, x, outWidth);
+}
+
+//	Two output texels per iteration, their taps are two source texels apart.
+AVULKAN_TARGET_AVX void KaiserFilterMipRowAVX(const float* src, uint32_t srcWidth, float* out, uint32_t outWidth)
+{
+	const float* weights = GetKaiserMipWeights().weights;
+	uint32_t interiorEnd = srcWidth >= 4 ? std::min(outWidth, (srcWidth - 4) / 2 + 1) : 0;
+
+	KaiserFilterMipRowScalar(src, srcWidth, out, 0, std::min(1u, outWidth));
+	uint32_t x = 1;
+	for (; x + 2 <= interiorEnd; x += 2)
+	{
+		const float* taps = src + (2 * x - 2) * 4;
+		__m256 sum = _mm256_setzero_ps();
+		for (int tap = 0; tap < MIP_KAISER_TAPS; tap++)
+		{
+			__m256 texels = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(taps + tap * 4)), _mm_loadu_ps(taps + tap * 4 + 8), 1);
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[tap]), texels));
+		}
+		_mm256_storeu_ps(out + x * 4, sum);
+	}
+	KaiserFilterMipRowScalar(src, srcWidth, out, std::max(x, std::min(1u, outWidth)), outWidth);
+}
+
+AVULKAN_TARGET_AVX void KaiserCombineMipRowsAVX(const float* const* rows, float* out, size_t count)
+{
+	const float* weights = GetKaiserMipWeights().weights;
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 sum = _mm256_setzero_ps();
+		for (int tap = 0; tap < MIP_KAISER_TAPS; tap++)
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[tap]), _mm256_loadu_ps(rows[tap] + i)));
+		_mm256_storeu_ps(out + i, sum);
+	}
+
+	KaiserCombineMipRowsScalar(rows, out, i, count);
+}
+#endif
+
+//	Picks what MIP_PATH_BEST stands for, and falls back to scalar where the instruction set is unavailable.
+MipPath ResolveMipPath(MipPath path)
+{
+#ifdef AVULKAN_X86
+	static const bool avx = IsAVXSupported();
+	if (path == MIP_PATH_BEST)
+		return avx ? MIP_PATH_AVX : MIP_PATH_SSE;
+	return path == MIP_PATH_AVX && !avx ? MIP_PATH_SSE : path;
+#else
+	return MIP_PATH_SCALAR;
+#endif
+}
+
+//	path must be resolved.
+void BoxFilterMipRow(const float* row0, const float* row1, uint32_t srcWidth, float* out, uint32_t outWidth, MipPath path)
+{
+#ifdef AVULKAN_X86
+	if (path == MIP_PATH_AVX)
+		return BoxFilterMipRowAVX(row0, row1, srcWidth, out, outWidth);
+	if (path == MIP_PATH_SSE)
+		return BoxFilterMipRowSSE(row0, row1, srcWidth, out, outWidth);
+#endif
+	BoxFilterMipRowScalar(row0, row1, srcWidth, out, 0, outWidth);
+}
+
+void KaiserFilterMipRow(const float* src, uint32_t srcWidth, float* out, uint32_t outWidth, MipPath path)
+{
+#ifdef AVULKAN_X86
+	if (path == MIP_PATH_AVX)
+		return KaiserFilterMipRowAVX(src, srcWidth, out, outWidth);
+	if (path == MIP_PATH_SSE)
+		return KaiserFilterMipRowSSE(src, srcWidth, out, outWidth);
+#endif
+	KaiserFilterMipRowScalar(src, srcWidth, out, 0, outWidth);
+}
+
+void KaiserCombineMipRows(const float* const* rows, float* out, size_t count, MipPath path)
+{
+#ifdef AVULKAN_X86
+	if (path == MIP_PATH_AVX)
+		return KaiserCombineMipRowsAVX(rows, out, count);
+	if (path == MIP_PATH_SSE)
+		return KaiserCombineMipRowsSSE(rows, out, count);
+#endif
+	KaiserCombineMipRowsScalar(rows, out, 0, count);
+}
+
+//	Source rows are decoded as they are needed, so no level is ever held in float as a whole. The Kaiser filter
+//	keeps its horizontally filtered rows in a ring, consecutive output rows share four of their six.
+void GenerateMipLevel(const uint8_t* src, VkExtent2D srcExtent, uint8_t* dst, VkExtent2D dstExtent, bool srgb, MipFilter filter, MipPath path)
+{
+	const uint32_t ringSize = 8;
+
+	ParallelFor(dstExtent.height, MIP_GENERATION_GRAIN_SIZE, [&](size_t begin, size_t end)
+	{
+		size_t srcRowFloats = srcExtent.width * 4, dstRowFloats = dstExtent.width * 4;
+		std::vector<float> decoded(srcRowFloats * 2), filtered(dstRowFloats);
+		std::vector<float> ring(filter == MIP_FILTER_KAISER ? dstRowFloats * ringSize : 0);
+		int64_t ringRows[ringSize];
+		std::fill(ringRows, ringRows + ringSize, -1);
+
+		for (size_t y = begin; y < end; y++)
+		{
+			if (filter == MIP_FILTER_BOX)
+			{
+				uint32_t row0 = std::min(static_cast<uint32_t>(2 * y), srcExtent.height - 1), row1 = std::min(static_cast<uint32_t>(2 * y + 1), srcExtent.height - 1);
+				DecodeMipRow(src + row0 * srcRowFloats, srcExtent.width, srgb, decoded.data());
+				DecodeMipRow(src + row1 * srcRowFloats, srcExtent.width, srgb, decoded.data() + srcRowFloats);
+				BoxFilterMipRow(decoded.data(), decoded.data() + srcRowFloats, srcExtent.width, filtered.data(), dstExtent.width, path);
+			}
+			else
+			{
+				const float* rows[MIP_KAISER_TAPS];
+				for (int tap = 0; tap < MIP_KAISER_TAPS; tap++)
+				{
+					int64_t row = std::min<int64_t>(std::max<int64_t>(2 * static_cast<int64_t>(y) - 2 + tap, 0), srcExtent.height - 1);
+					float* slot = ring.data() + (row % ringSize) * dstRowFloats;
+					if (ringRows[row % ringSize] != row)
+					{
+						DecodeMipRow(src + row * srcRowFloats, srcExtent.width, srgb, decoded.data());
+						KaiserFilterMipRow(decoded.data(), srcExtent.width, slot, dstExtent.width, path);
+						ringRows[row % ringSize] = row;
+					}
+					rows[tap] = slot;
+				}
+				KaiserCombineMipRows(rows, filtered.data(), dstRowFloats, path);
+			}
+
+			EncodeMipRow(filtered.data(), dstExtent.width, srgb, dst + y * dstRowFloats);
+		}
+	});
+}
+
+//	Replaces every level below the base with a full chain. The result can go straight to CreateVulkanTexture.
+void GenerateTextureMips(TextureData& texture, MipFilter filter, MipPath path = MIP_PATH_BEST)
+{
+	if (!CanGenerateTextureMips(texture.format))
+		throw std::runtime_error("Texture: mips can only be generated for 8 bit RGBA and BGRA formats!");
+	if (texture.mipOffsets.empty())
+		throw std::runtime_error("Texture: no base level to generate mips from!");
+
+	texture.data.resize(static_cast<size_t>(texture.mipOffsets[0] + texture.mipSizes[0]));
+	texture.mipOffsets.resize(1);
+	texture.mipSizes.resize(1);
+
+	//	Every level is allocated up front, data must not move while the levels are filtered.
+	uint32_t mipLevels = GetFullMipCount(texture.extent);
+	for (uint32_t mip = 1; mip < mipLevels; mip++)
+		AddTextureMip(texture, static_cast<VkDeviceSize>(std::max(1u, texture.extent.width >> mip)) * std::max(1u, texture.extent.height >> mip) * 4);
+
+	bool srgb = texture.format == VK_FORMAT_R8G8B8A8_SRGB || texture.format == VK_FORMAT_B8G8R8A8_SRGB;
+	uint8_t* data = reinterpret_cast<uint8_t*>(texture.data.data());
+	path = ResolveMipPath(path);
+	for (uint32_t mip = 1; mip < mipLevels; mip++)
+	{
+		VkExtent2D srcExtent = { std::max(1u, texture.extent.width >> (mip - 1)), std::max(1u, texture.extent.height >> (mip - 1)) };
+		VkExtent2D dstExtent = { std::max(1u, texture.extent.width >> mip), std::max(1u, texture.extent.height >> mip) };
+		GenerateMipLevel(data + texture.mipOffsets[mip - 1], srcExtent, data + texture.mipOffsets[mip], dstExtent, srgb, filter, path);
+	}
+}
+
+//	AVulkan --benchmark-mips
+//	Builds the chain of a 4096x4096 sRGB texture with each path and filter, and fails when a SIMD path's texels
+//	differ from the scalar ones by more than one step of rounding.
+int BenchmarkMips()
+{
+	const uint32_t size = 4096;
+
+	//	Gradients under noise, so both smooth areas and sharp edges are filtered.
+	TextureData source;
+	source.format = VK_FORMAT_R8G8B8A8_SRGB;
+	source.extent = { size, size };
+	AddTextureMip(source, static_cast<VkDeviceSize>(size) * size * 4);
+	std::mt19937 random(1234);
+	uint8_t* texels = reinterpret_cast<uint8_t*>(source.data.data());
+	for (uint32_t y = 0; y < size; y++)
+	{
+		for (uint32_t x = 0; x < size; x++)
+		{
+			uint8_t* texel = texels + (static_cast<size_t>(y) * size + x) * 4;
+			texel[0] = static_cast<uint8_t>(x * 255 / size);
+			texel[1] = static_cast<uint8_t>(y * 255 / size);
+			texel[2] = static_cast<uint8_t>(random() & 0xFF);
+			texel[3] = (x / 64 + y / 64) % 2 ? 255 : 0;
+		}
+	}
+
+	std::vector<MipPath> paths = { MIP_PATH_SCALAR };
+#ifdef AVULKAN_X86
+	paths.push_back(MIP_PATH_SSE);
+	if (IsAVXSupported())
+		paths.push_back(MIP_PATH_AVX);
+	else
+		Print("Mip Benchmark: AVX is not supported, skipping it");
+#endif
+	const char* pathNames[] = { "best", "scalar", "SSE", "AVX" };
+
+	bool mismatch = false;
+	for (MipFilter filter : { MIP_FILTER_BOX, MIP_FILTER_KAISER })
+	{
+		TextureData reference;
+		for (MipPath path : paths)
+		{
+			//	Each run drops the previous chain and rebuilds it from the base level.
+			TextureData texture = source;
+			float milliseconds = TimeBestOf(3, [&]() { GenerateTextureMips(texture, filter, path); });
+
+			if (path == MIP_PATH_SCALAR)
+				reference = texture;
+
+			int maxDifference = 0;
+			size_t differences = 0;
+			for (size_t i = static_cast<size_t>(texture.mipOffsets[1]); i < texture.data.size(); i++)
+			{
+				int difference = std::abs(static_cast<uint8_t>(texture.data[i]) - static_cast<uint8_t>(reference.data[i]));
+				maxDifference = std::max(maxDifference, difference);
+				differences += difference > 1;
+			}
+			mismatch |= differences > 0;
+
+			Print("Mip Benchmark: %ix%i %-6s %-6s %8.1f ms, %i mip(s), max difference %i, %i texel channel(s) beyond rounding", static_cast<int>(size), static_cast<int>(size),
+				filter == MIP_FILTER_BOX ? "box" : "kaiser", pathNames[path], milliseconds, static_cast<int>(texture.mipOffsets.size() - 1), maxDifference, static_cast<int>(differences));
+		}
+	}
+
+	if (mismatch)
+		Print("Mip Benchmark: FAILED, the SIMD paths disagree with the scalar path");
+	return mismatch ? 1 : 0;
+}
+
+// Texture Baking
+//	Offline compression of source images to block compressed KTX2, run as AVulkan --bake-textures. Colour textures
+//	become BC1 when opaque and BC7 when they have alpha, both sRGB. Names ending in _n or _normal are normal maps
+//	and become BC5. The whole mip chain is generated and compressed, block rows are split across threads and every
+//	encoder's palette search runs on 4 or 8 texels at a time. Outputs keep a hash of their source and settings in
+//	their key/value data, so textures that did not change are skipped on the next bake.
+const uint32_t TEXTURE_BAKE_VERSION = 1;	//	Bump when encoder output changes, every texture rebakes.
+const size_t TEXTURE_BAKE_GRAIN_SIZE = 4;	//	Block rows per task.
+const char TEXTURE_BAKE_HASH_KEY[] = "AVulkanBakeHash";
+const char TEXTURE_BAKE_WRITER[] = "AVulkan texture baker";
+
+enum TextureQuality : uint8_t
+{
+	TEXTURE_QUALITY_FAST = 0,	//	Bounding box endpoints, no refinement.
+	TEXTURE_QUALITY_NORMAL,		//	Principal axis endpoints, one least squares refinement.
+	TEXTURE_QUALITY_HIGH,		//	More refinements and every alternative block mode.
+};
+
+//	One 4x4 block in 0-255, planar so a SIMD load fetches one channel of 4 or 8 texels.
+struct BlockTexels
+{
+	alignas(32) float channels[4][16];
+};
+
+struct BlockPalette
+{
+	float colors[16][4];
+	uint32_t size;
+};
+
+//	Writes the closest palette entry of every texel and returns the block's weighted squared error. A zero weight
+//	leaves a channel out.
+float SelectBlockIndicesScalar(const BlockTexels& texels, const BlockPalette& palette, const float weights[4], uint8_t* outIndices)
+{
+	float total = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float best = FLT_MAX;
+		for (uint32_t entry = 0; entry < palette.size; entry++)
+		{
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				float difference = texels.channels[c][i] - palette.colors[entry][c];
+				error += weights[c] * difference * difference;
+			}
+			if (error < best)
+			{
+				best = error;
+				outIndices[i] = static_cast<uint8_t>(entry);
+			}
+		}
+		total += best;
+	}
+	return total;
+}
+
+#ifdef AVULKAN_X86
+//	The running best index is kept as a float so it can be selected with the same mask as the error.
+float SelectBlockIndicesSSE(const BlockTexels& texels, const BlockPalette& palette, const float weights[4], uint8_t* outIndices)
+{
+	__m128 total = _mm_setzero_ps();
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 best = _mm_set1_ps(FLT_MAX), bestIndex = _mm_setzero_ps();
+		for (uint32_t entry = 0; entry < palette.size; entry++)
+		{
+			__m128 error = _mm_setzero_ps();
+			for (int c = 0; c < 4; c++)
+			{
+				__m128 difference = _mm_sub_ps(_mm_load_ps(&texels.channels[c][i]), _mm_set1_ps(palette.colors[entry][c]));
+				error = _mm_add_ps(error, _mm_mul_ps(_mm_set1_ps(weights[c]), _mm_mul_ps(difference, difference)));
+			}
+			__m128 closer = _mm_cmplt_ps(error, best);
+			best = _mm_min_ps(error, best);
+			bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps(static_cast<float>(entry))), _mm_andnot_ps(closer, bestIndex));
+		}
+		total = _mm_add_ps(total, best);
+
+		alignas(16) int32_t indices[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_cvtps_epi32(bestIndex));
+		for (int lane = 0; lane < 4; lane++)
+			outIndices[i + lane] = static_cast<uint8_t>(indices[lane]);
+	}
+
+	alignas(16) float sums[4];
+	_mm_store_ps(sums, total);
+	return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+AVULKAN_TARGET_AVX float SelectBlockIndicesAVX(const BlockTexels& texels, const BlockPalette& palette, const float weights[4], uint8_t* outIndices)
+{
+	__m256 total = _mm256_setzero_ps();
+	for (int i = 0; i < 16; i += 8)
+	{
+		__m256 best = _mm256_set1_ps(FLT_MAX), bestIndex = _mm256_setzero_ps();
+		for (uint32_t entry = 0; entry < palette.size; entry++)
+		{
+			__m256 error = _mm256_setzero_ps();
+			for (int c = 0; c < 4; c++)
+			{
+				__m256 difference = _mm256_sub_ps(_mm256_load_ps(&texels.channels[c][i]), _mm256_set1_ps(palette.colors[entry][c]));
+				error = _mm256_add_ps(error, _mm256_mul_ps(_mm256_set1_ps(weights[c]), _mm256_mul_ps(difference, difference)));
+			}
+			__m256 closer = _mm256_cmp_ps(error, best, _CMP_LT_OQ);
+			best = _mm256_min_ps(error, best);
+			bestIndex = _mm256_blendv_ps(bestIndex, _mm256_set1_ps(static_cast<float>(entry)), closer);
+		}
+		total = _mm256_add_ps(total, best);
+
+		alignas(32) int32_t indices[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(indices), _mm256_cvtps_epi32(bestIndex));
+		for (int lane = 0; lane < 8; lane++)
+			outIndices[i + lane] = static_cast<uint8_t>(indices[lane]);
+	}
+
+	alignas(32) float sums[8];
+	_mm256_store_ps(sums, total);
+	return sums[0] + sums[1] + sums[2] + sums[3] + sums[4] + sums[5] + sums[6] + sums[7];
+}
+#endif
+
+float SelectBlockIndices(const BlockTexels& texels, const BlockPalette& palette, const float weights[4], uint8_t* outIndices)
+{
+#ifdef AVULKAN_X86
+	static const bool avx = IsAVXSupported();
+	if (avx)
+		return SelectBlockIndicesAVX(texels, palette, weights, outIndices);
+	return SelectBlockIndicesSSE(texels, palette, weights, outIndices);
+#else
+	return SelectBlockIndicesScalar(texels, palette, weights, outIndices);
+#endif
+}
+
+//	Endpoints on the line through the block's principal axis, or the bounding box diagonal for fast. Channels
+//	with a zero weight are ignored.
+void FitBlockEndpoints(const BlockTexels& texels, const float weights[4], TextureQuality quality, float outLow[4], float outHigh[4])
+{
+	float mean[4] = {}, minimum[4], maximum[4];
+	for (int c = 0; c < 4; c++)
+	{
+		minimum[c] = maximum[c] = texels.channels[c][0];
+		for (int i = 0; i < 16; i++)
+		{
+			mean[c] += texels.channels[c][i] / 16.0f;
+			minimum[c] = std::min(minimum[c], texels.channels[c][i]);
+			maximum[c] = std::max(maximum[c], texels.channels[c][i]);
+		}
+	}
+
+	if (quality == TEXTURE_QUALITY_FAST)
+	{
+		//	Insetting by a sixteenth pulls the endpoints toward the texels the interpolated entries cover.
+		for (int c = 0; c < 4; c++)
+		{
+			float inset = (maximum[c] - minimum[c]) / 16.0f;
+			outLow[c] = minimum[c] + inset;
+			outHigh[c] = maximum[c] - inset;
+		}
+		return;
+	}
+
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; i++)
+		for (int a = 0; a < 4; a++)
+			for (int b = 0; b < 4; b++)
+				if (weights[a] > 0.0f && weights[b] > 0.0f)
+					covariance[a][b] += (texels.channels[a][i] - mean[a]) * (texels.channels[b][i] - mean[b]);
+
+	//	Power iteration, started on the bounding box diagonal.
+	float axis[4];
+	for (int c = 0; c < 4; c++)
+		axis[c] = weights[c] > 0.0f ? maximum[c] - minimum[c] : 0.0f;
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = {};
+		for (int a = 0; a < 4; a++)
+			for (int b = 0; b < 4; b++)
+				next[a] += covariance[a][b] * axis[b];
+
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+		if (length < FLT_EPSILON)
+			break;
+		for (int c = 0; c < 4; c++)
+			axis[c] = next[c] / length;
+	}
+
+	float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3]);
+	if (length < FLT_EPSILON)
+	{
+		memcpy(outLow, mean, sizeof(mean));
+		memcpy(outHigh, mean, sizeof(mean));
+		return;
+	}
+
+	float lowT = FLT_MAX, highT = -FLT_MAX;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < 4; c++)
+			t += (texels.channels[c][i] - mean[c]) * axis[c] / length;
+		lowT = std::min(lowT, t);
+		highT = std::max(highT, t);
+	}
+	for (int c = 0; c < 4; c++)
+	{
+		outLow[c] = mean[c] + lowT * axis[c] / length;
+		outHigh[c] = mean[c] + highT * axis[c] / length;
+	}
+}
+
+//	Least squares endpoints for fixed indices, positions are where each texel's entry sits between the endpoints.
+//	Texels with a negative position take no part. Fails when every texel sits at the same position.
+bool RefineBlockEndpoints(const BlockTexels& texels, const float positions[16], float outFirst[4], float outSecond[4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f, x[4] = {}, y[4] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		if (positions[i] < 0.0f)
+			continue;
+
+		float a = 1.0f - positions[i], b = positions[i];
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < 4; c++)
+		{
+			x[c] += a * texels.channels[c][i];
+			y[c] += b * texels.channels[c][i];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (std::abs(determinant) < FLT_EPSILON)
+		return false;
+
+	for (int c = 0; c < 4; c++)
+	{
+		outFirst[c] = clamp((bb * x[c] - ab * y[c]) / determinant, 0.0f, 255.0f);
+		outSecond[c] = clamp((aa * y[c] - ab * x[c]) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+int GetBlockRefinements(TextureQuality quality)
+{
+	return quality == TEXTURE_QUALITY_FAST ? 0 : quality == TEXTURE_QUALITY_NORMAL ? 1 : 4;
+}
+
+//	Indices are written from the lowest bit up, as every BC format stores them.
+void WriteBlockBits(uint8_t* block, uint32_t& position, uint32_t value, uint32_t bits)
+{
+	for (uint32_t bit = 0; bit < bits; bit++, position++)
+		block[position / 8] |= static_cast<uint8_t>(((value >> bit) & 1) << (position % 8));
+}
+
+uint16_t QuantizeRGB565(const float color[4])
+{
+	uint32_t r = static_cast<uint32_t>(clamp(color[0], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+	uint32_t g = static_cast<uint32_t>(clamp(color[1], 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+	uint32_t b = static_cast<uint32_t>(clamp(color[2], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void ExpandRGB565(uint16_t color, float outColor[4])
+{
+	uint32_t r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+	outColor[0] = static_cast<float>((r << 3) | (r >> 2));
+	outColor[1] = static_cast<float>((g << 2) | (g >> 4));
+	outColor[2] = static_cast<float>((b << 3) | (b >> 2));
+	outColor[3] = 255.0f;
+}
+
+//	Four colours when color0 > color1, otherwise three and black.
+void BuildBC1Palette(uint16_t color0, uint16_t color1, BlockPalette& outPalette)
+{
+	float first[4], second[4];
+	ExpandRGB565(color0, first);
+	ExpandRGB565(color1, second);
+
+	outPalette.size = 4;
+	for (int c = 0; c < 4; c++)
+	{
+		outPalette.colors[0][c] = first[c];
+		outPalette.colors[1][c] = second[c];
+		if (color0 > color1)
+		{
+			outPalette.colors[2][c] = (2.0f * first[c] + second[c]) / 3.0f;
+			outPalette.colors[3][c] = (first[c] + 2.0f * second[c]) / 3.0f;
+		}
+		else
+		{
+			outPalette.colors[2][c] = (first[c] + second[c]) / 2.0f;
+			outPalette.colors[3][c] = c == 3 ? 255.0f : 0.0f;
+		}
+	}
+}
+
+void EncodeBC1Block(const BlockTexels& texels, TextureQuality quality, uint8_t* outBlock)
+{
+	const float weights[4] = { 1.0f, 1.0f, 1.0f, 0.0f };
+	const float positions4[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	float first[4], second[4];
+	FitBlockEndpoints(texels, weights, quality, second, first);
+
+	float bestError = FLT_MAX;
+	uint16_t bestColors[2] = {};
+	uint8_t bestIndices[16] = {};
+
+	int refinements = GetBlockRefinements(quality);
+	for (int pass = 0; pass <= refinements; pass++)
+	{
+		uint16_t color0 = QuantizeRGB565(first), color1 = QuantizeRGB565(second);
+		if (color0 < color1)
+			std::swap(color0, color1);
+
+		BlockPalette palette;
+		uint8_t indices[16];
+		BuildBC1Palette(color0, color1, palette);
+		float error = SelectBlockIndices(texels, palette, weights, indices);
+		if (error < bestError)
+		{
+			bestError = error;
+			bestColors[0] = color0;
+			bestColors[1] = color1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+
+		//	The three colour mode wins on blocks with black texels or a midpoint the 4 colour mode misses.
+		if (quality == TEXTURE_QUALITY_HIGH && color0 != color1)
+		{
+			BlockPalette threeColor;
+			uint8_t threeColorIndices[16];
+			BuildBC1Palette(color1, color0, threeColor);
+			float threeColorError = SelectBlockIndices(texels, threeColor, weights, threeColorIndices);
+			if (threeColorError < bestError)
+			{
+				bestError = threeColorError;
+				bestColors[0] = color1;
+				bestColors[1] = color0;
+				memcpy(bestIndices, threeColorIndices, sizeof(threeColorIndices));
+			}
+		}
+
+		if (pass == refinements || color0 == color1)
+			break;
+
+		float texelPositions[16];
+		for (int i = 0; i < 16; i++)
+			texelPositions[i] = positions4[indices[i]];
+		if (!RefineBlockEndpoints(texels, texelPositions, first, second))
+			break;
+	}
+
+	memset(outBlock, 0, 8);
+	uint32_t position = 0;
+	WriteBlockBits(outBlock, position, bestColors[0], 16);
+	WriteBlockBits(outBlock, position, bestColors[1], 16);
+	for (int i = 0; i < 16; i++)
+		WriteBlockBits(outBlock, position, bestIndices[i], 2);
+}
+
+//	Eight values when value0 > value1, otherwise six and 0 and 255.
+void BuildBC4Palette(uint32_t value0, uint32_t value1, int channel, BlockPalette& outPalette)
+{
+	memset(outPalette.colors, 0, sizeof(outPalette.colors));
+	outPalette.size = 8;
+	outPalette.colors[0][channel] = static_cast<float>(value0);
+	outPalette.colors[1][channel] = static_cast<float>(value1);
+
+	uint32_t steps = value0 > value1 ? 7 : 5;
+	for (uint32_t i = 1; i < steps; i++)
+		outPalette.colors[i + 1][channel] = ((steps - i) * value0 + i * value1) / static_cast<float>(steps);
+	if (steps == 5)
+	{
+		outPalette.colors[6][channel] = 0.0f;
+		outPalette.colors[7][channel] = 255.0f;
+	}
+}
+
+//	Searches endpoints around the block's range, wider with quality. High also tries the six value mode on the
+//	range without the texels at 0 and 255, which that mode has exact entries for.
+void EncodeBC4Block(const BlockTexels& texels, int channel, TextureQuality quality, uint8_t* outBlock)
+{
+	float weights[4] = {};
+	weights[channel] = 1.0f;
+
+	int minimum = 255, maximum = 0, innerMinimum = 255, innerMaximum = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int value = static_cast<int>(texels.channels[channel][i] + 0.5f);
+		minimum = std::min(minimum, value);
+		maximum = std::max(maximum, value);
+		if (value > 0 && value < 255)
+		{
+			innerMinimum = std::min(innerMinimum, value);
+			innerMaximum = std::max(innerMaximum, value);
+		}
+	}
+
+	float bestError = FLT_MAX;
+	uint32_t bestValues[2] = {};
+	uint8_t bestIndices[16] = {};
+	auto tryEndpoints = [&](int value0, int value1)
+	{
+		BlockPalette palette;
+		uint8_t indices[16];
+		BuildBC4Palette(value0, value1, channel, palette);
+		float error = SelectBlockIndices(texels, palette, weights, indices);
+		if (error < bestError)
+		{
+			bestError = error;
+			bestValues[0] = value0;
+			bestValues[1] = value1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+	};
+
+	int radius = quality == TEXTURE_QUALITY_FAST ? 0 : quality == TEXTURE_QUALITY_NORMAL ? 1 : 3;
+	for (int high = maximum - radius; high <= maximum + radius; high++)
+		for (int low = minimum - radius; low <= minimum + radius; low++)
+			if (low >= 0 && high <= 255 && high > low)
+				tryEndpoints(high, low);
+	if (minimum == maximum)
+		tryEndpoints(maximum, minimum);
+	if (quality == TEXTURE_QUALITY_HIGH && innerMinimum <= innerMaximum)
+		tryEndpoints(innerMinimum, innerMaximum);
+
+	memset(outBlock, 0, 8);
+	uint32_t position = 0;
+	WriteBlockBits(outBlock, position, bestValues[0], 8);
+	WriteBlockBits(outBlock, position, bestValues[1], 8);
+	for (int i = 0; i < 16; i++)
+		WriteBlockBits(outBlock, position, bestIndices[i], 3);
+}
+
+void EncodeBC5Block(const BlockTexels& texels, TextureQuality quality, uint8_t* outBlock)
+{
+	EncodeBC4Block(texels, 0, quality, outBlock);
+	EncodeBC4Block(texels, 1, quality, outBlock + 8);
+}
+
+const uint32_t BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+//	Endpoints are 7 bits per channel plus a p-bit shared by the endpoint's channels.
+void QuantizeBC7Endpoint(const float color[4], uint32_t pBit, uint32_t outEndpoint[4])
+{
+	for (int c = 0; c < 4; c++)
+	{
+		uint32_t value = static_cast<uint32_t>(clamp((color[c] - pBit) / 2.0f + 0.5f, 0.0f, 127.0f));
+		outEndpoint[c] = (value << 1) | pBit;
+	}
+}
+
+void BuildBC7Mode6Palette(const uint32_t endpoint0[4], const uint32_t endpoint1[4], BlockPalette& outPalette)
+{
+	outPalette.size = 16;
+	for (uint32_t entry = 0; entry < 16; entry++)
+		for (int c = 0; c < 4; c++)
+			outPalette.colors[entry][c] = static_cast<float>(((64 - BC7_WEIGHTS4[entry]) * endpoint0[c] + BC7_WEIGHTS4[entry] * endpoint1[c] + 32) >> 6);
+}
+
+//	Mode 6 only: one subset, RGBA endpoints and 4 bit indices, which covers colour with alpha evenly. Fast picks
+//	each endpoint's p-bit by its rounding, the other presets try all four combinations.
+void EncodeBC7Block(const BlockTexels& texels, TextureQuality quality, uint8_t* outBlock)
+{
+	const float weights[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	float first[4], second[4];
+	FitBlockEndpoints(texels, weights, quality, first, second);
+
+	float bestError = FLT_MAX;
+	uint32_t bestEndpoints[2][4] = {};
+	uint32_t bestPBits[2] = {};
+	uint8_t bestIndices[16] = {};
+
+	auto quantizationError = [](const float color[4], uint32_t pBit)
+	{
+		uint32_t endpoint[4];
+		QuantizeBC7Endpoint(color, pBit, endpoint);
+		float error = 0.0f;
+		for (int c = 0; c < 4; c++)
+			error += (color[c] - endpoint[c]) * (color[c] - endpoint[c]);
+		return error;
+	};
+
+	int refinements = GetBlockRefinements(quality);
+	for (int pass = 0; pass <= refinements; pass++)
+	{
+		uint8_t passIndices[16] = {};
+		float passError = FLT_MAX;
+		for (uint32_t combination = 0; combination < 4; combination++)
+		{
+			uint32_t pBits[2] = { combination & 1, combination >> 1 };
+			if (quality == TEXTURE_QUALITY_FAST)
+			{
+				pBits[0] = quantizationError(first, 1) < quantizationError(first, 0);
+				pBits[1] = quantizationError(second, 1) < quantizationError(second, 0);
+			}
+
+			uint32_t endpoints[2][4];
+			QuantizeBC7Endpoint(first, pBits[0], endpoints[0]);
+			QuantizeBC7Endpoint(second, pBits[1], endpoints[1]);
+
+			BlockPalette palette;
+			uint8_t indices[16];
+			BuildBC7Mode6Palette(endpoints[0], endpoints[1], palette);
+			float error = SelectBlockIndices(texels, palette, weights, indices);
+			if (error < passError)
+			{
+				passError = error;
+				memcpy(passIndices, indices, sizeof(indices));
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+				memcpy(bestPBits, pBits, sizeof(pBits));
+				memcpy(bestIndices, indices, sizeof(indices));
+			}
+
+			if (quality == TEXTURE_QUALITY_FAST)
+				break;
+		}
+
+		if (pass == refinements)
+			break;
+
+		float texelPositions[16];
+		for (int i = 0; i < 16; i++)
+			texelPositions[i] = BC7_WEIGHTS4[passIndices[i]] / 64.0f;
+		if (!RefineBlockEndpoints(texels, texelPositions, first, second))
+			break;
+	}
+
+	//	The anchor texel's index drops its top bit, so it has to point into the first half of the palette.
+	if (bestIndices[0] >= 8)
+	{
+		std::swap(bestEndpoints[0], bestEndpoints[1]);
+		std::swap(bestPBits[0], bestPBits[1]);
+		for (auto& index : bestIndices)
+			index = static_cast<uint8_t>(15 - index);
+	}
+
+	memset(outBlock, 0, 16);
+	uint32_t position = 0;
+	WriteBlockBits(outBlock, position, 1 << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		WriteBlockBits(outBlock, position, bestEndpoints[0][c] >> 1, 7);
+		WriteBlockBits(outBlock, position, bestEndpoints[1][c] >> 1, 7);
+	}
+	WriteBlockBits(outBlock, position, bestPBits[0], 1);
+	WriteBlockBits(outBlock, position, bestPBits[1], 1);
+	for (int i = 0; i < 16; i++)
+		WriteBlockBits(outBlock, position, bestIndices[i], i == 0 ? 3 : 4);
+}
+
+uint32_t GetBlockSize(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK: return 8;
+	default: return 16;
+	}
+}
+
+//	source holds 8 bit RGBA levels. Edge blocks of levels that are not a multiple of 4 repeat the last row and column.
+void CompressTextureData(const TextureData& source, VkFormat format, TextureQuality quality, TextureData& outTexture)
+{
+	outTexture = TextureData();
+	outTexture.format = format;
+	outTexture.extent = source.extent;
+
+	uint32_t blockSize = GetBlockSize(format);
+	for (size_t mip = 0; mip < source.mipOffsets.size(); mip++)
+	{
+		uint32_t width = std::max(1u, source.extent.width >> mip), height = std::max(1u, source.extent.height >> mip);
+		AddTextureMip(outTexture, static_cast<VkDeviceSize>((width + 3) / 4) * ((height + 3) / 4) * blockSize);
+	}
+
+	for (size_t mip = 0; mip < source.mipOffsets.size(); mip++)
+	{
+		uint32_t width = std::max(1u, source.extent.width >> mip), height = std::max(1u, source.extent.height >> mip);
+		uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+		const uint8_t* texels = reinterpret_cast<const uint8_t*>(source.data.data() + source.mipOffsets[mip]);
+		uint8_t* blocks = reinterpret_cast<uint8_t*>(outTexture.data.data() + outTexture.mipOffsets[mip]);
+
+		ParallelFor(blocksY, TEXTURE_BAKE_GRAIN_SIZE, [&](size_t begin, size_t end)
+		{
+			BlockTexels block;
+			for (size_t blockY = begin; blockY < end; blockY++)
+			{
+				for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+				{
+					for (uint32_t i = 0; i < 16; i++)
+					{
+						uint32_t x = std::min(blockX * 4 + i % 4, width - 1), y = std::min(static_cast<uint32_t>(blockY) * 4 + i / 4, height - 1);
+						for (int c = 0; c < 4; c++)
+							block.channels[c][i] = texels[(static_cast<size_t>(y) * width + x) * 4 + c];
+					}
+
+					uint8_t* output = blocks + (blockY * blocksX + blockX) * blockSize;
+					if (format == VK_FORMAT_BC5_UNORM_BLOCK)
+						EncodeBC5Block(block, quality, output);
+					else if (blockSize == 8)
+						EncodeBC1Block(block, quality, output);
+					else
+						EncodeBC7Block(block, quality, output);
+				}
+			}
+		});
+	}
+}
+
+#pragma pack(push, 1)
+struct TgaHeader
+{
+	uint8_t idLength;
+	uint8_t colorMapType;
+	uint8_t imageType;
+	uint16_t colorMapOrigin;
+	uint16_t colorMapLength;
+	uint8_t colorMapDepth;
+	uint16_t xOrigin;
+	uint16_t yOrigin;
+	uint16_t width;
+	uint16_t height;
+	uint8_t pixelDepth;
+	uint8_t descriptor;
+};
+#pragma pack(pop)
+
+//	True colour and greyscale TGA, raw or run length encoded, loaded as 8 bit RGBA with the first row on top.
+void LoadTgaTextureData(const std::string& path, TextureData& outTexture)
+{
+	std::vector<char> file = ReadFile(path);
+
+	TgaHeader header;
+	if (file.size() < sizeof(header))
+		throw std::runtime_error("Texture: file too small for a TGA header!");
+	memcpy(&header, file.data(), sizeof(header));
+
+	uint32_t type = header.imageType & ~8u;
+	bool rle = (header.imageType & 8) != 0;
+	uint32_t bytesPerPixel = header.pixelDepth / 8;
+	if (!((type == 2 && (bytesPerPixel == 3 || bytesPerPixel == 4)) || (type == 3 && bytesPerPixel == 1)) || header.width == 0 || header.height == 0)
+		throw std::runtime_error("Texture: only 24 and 32 bit colour and 8 bit greyscale TGA files are supported!");
+
+	size_t offset = sizeof(header) + header.idLength + (header.colorMapType ? header.colorMapLength * ((header.colorMapDepth + 7) / 8) : 0);
+	size_t pixelCount = static_cast<size_t>(header.width) * header.height;
+	std::vector<uint8_t> pixels(pixelCount * bytesPerPixel);
+
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(file.data());
+	for (size_t pixel = 0; pixel < pixelCount;)
+	{
+		bool run = false;
+		size_t count = pixelCount - pixel;
+		if (rle)
+		{
+			if (offset >= file.size())
+				throw std::runtime_error("Texture: truncated TGA file!");
+			run = (data[offset] & 0x80) != 0;
+			count = std::min<size_t>((data[offset] & 0x7F) + 1, pixelCount - pixel);
+			offset++;
+		}
+
+		size_t readSize = (run ? 1 : count) * bytesPerPixel;
+		if (offset + readSize > file.size())
+			throw std::runtime_error("Texture: truncated TGA file!");
+		for (size_t i = 0; i < count; i++)
+			memcpy(&pixels[(pixel + i) * bytesPerPixel], data + offset + (run ? 0 : i * bytesPerPixel), bytesPerPixel);
+		offset += readSize;
+		pixel += count;
+	}
+
+	outTexture = TextureData();
+	outTexture.format = VK_FORMAT_R8G8B8A8_SRGB;
+	outTexture.extent = { header.width, header.height };
+	VkDeviceSize levelOffset = AddTextureMip(outTexture, pixelCount * 4);
+	uint8_t* rgba = reinterpret_cast<uint8_t*>(outTexture.data.data() + levelOffset);
+
+	//	Rows are stored bottom up unless the descriptor says otherwise, colour is BGR(A).
+	bool topDown = (header.descriptor & 0x20) != 0;
+	for (uint32_t y = 0; y < header.height; y++)
+	{
+		const uint8_t* row = &pixels[static_cast<size_t>(topDown ? y : header.height - 1 - y) * header.width * bytesPerPixel];
+		for (uint32_t x = 0; x < header.width; x++, rgba += 4)
+		{
+			const uint8_t* texel = row + x * bytesPerPixel;
+			rgba[0] = bytesPerPixel == 1 ? texel[0] : texel[2];
+			rgba[1] = texel[bytesPerPixel == 1 ? 0 : 1];
+			rgba[2] = texel[0];
+			rgba[3] = bytesPerPixel == 4 ? texel[3] : 255;
+		}
+	}
+}
+
+//	FNV-1a, chained through hash.
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+//	Reads only the header and key/value data. False when the file is missing, unreadable or not a bake output.
+bool ReadKtx2BakeHash(const std::string& path, uint64_t& outHash)
+{
+	std::ifstream file(path, std::ios::binary);
+	Ktx2Header header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		return false;
+
+	std::vector<char> keyValues(header.kvdByteLength);
+	file.seekg(header.kvdByteOffset);
+	if (!file.read(keyValues.data(), keyValues.size()))
+		return false;
+
+	//	Each pair is its length, the NUL terminated key and the value, padded to 4 bytes.
+	for (size_t offset = 0; offset + 4 <= keyValues.size();)
+	{
+		uint32_t length;
+		memcpy(&length, keyValues.data() + offset, 4);
+		if (offset + 4 + length > keyValues.size())
+			return false;
+
+		const char* pair = keyValues.data() + offset + 4;
+		size_t keyLength = strnlen(pair, length);
+		if (keyLength + 1 < length && strcmp(pair, TEXTURE_BAKE_HASH_KEY) == 0)
+		{
+			outHash = strtoull(std::string(pair + keyLength + 1, length - keyLength - 1).c_str(), nullptr, 16);
+			return true;
+		}
+		offset += (4 + length + 3) & ~static_cast<size_t>(3);
+	}
+	return false;
+}
+
+//	Levels are stored smallest first as KTX2 requires, each aligned to the format's block size.
+void WriteKtx2Texture(const std::string& path, const TextureData& texture, uint64_t bakeHash)
+{
+	uint32_t levelCount = static_cast<uint32_t>(texture.mipOffsets.size());
+	uint32_t blockSize = GetBlockSize(texture.format);
+
+	//	Basic data format descriptor, one sample per 64 bit block half BC5 stores and one for the others.
+	uint32_t sampleCount = texture.format == VK_FORMAT_BC5_UNORM_BLOCK ? 2 : 1;
+	std::vector<uint8_t> descriptor(4 + 24 + 16 * sampleCount, 0);
+	uint32_t descriptorSize = static_cast<uint32_t>(descriptor.size()), blockHeader = 2 | ((24 + 16 * sampleCount) << 16);
+	memcpy(&descriptor[0], &descriptorSize, 4);
+	memcpy(&descriptor[8], &blockHeader, 4);
+	descriptor[12] = texture.format == VK_FORMAT_BC5_UNORM_BLOCK ? 132 : blockSize == 8 ? 128 : 134;
+	descriptor[13] = 1;
+	descriptor[14] = texture.format == VK_FORMAT_BC5_UNORM_BLOCK || texture.format == VK_FORMAT_BC1_RGB_UNORM_BLOCK || texture.format == VK_FORMAT_BC7_UNORM_BLOCK ? 1 : KHR_DF_TRANSFER_SRGB;
+	descriptor[16] = descriptor[17] = 3;
+	descriptor[20] = static_cast<uint8_t>(blockSize);
+	for (uint32_t sample = 0; sample < sampleCount; sample++)
+	{
+		uint8_t* data = &descriptor[28 + sample * 16];
+		uint16_t bitOffset = static_cast<uint16_t>(sample * 64);
+		uint32_t upper = UINT32_MAX;
+		memcpy(data, &bitOffset, 2);
+		data[2] = static_cast<uint8_t>(blockSize * 8 / sampleCount - 1);
+		data[3] = static_cast<uint8_t>(sample);
+		memcpy(data + 12, &upper, 4);
+	}
+
+	//	Keys are sorted by code point.
+	std::vector<char> keyValues;
+	char hashText[17];
+	snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(bakeHash));
+	for (const auto& pair : { std::make_pair(TEXTURE_BAKE_HASH_KEY, static_cast<const char*>(hashText)), std::make_pair("KTXwriter", TEXTURE_BAKE_WRITER) })
+	{
+		uint32_t length = static_cast<uint32_t>(strlen(pair.first) + strlen(pair.second) + 2);
+		size_t offset = keyValues.size();
+		keyValues.resize(offset + ((4 + length + 3) & ~3u), 0);
+		memcpy(&keyValues[offset], &length, 4);
+		memcpy(&keyValues[offset + 4], pair.first, strlen(pair.first) + 1);
+		memcpy(&keyValues[offset + 4 + strlen(pair.first) + 1], pair.second, strlen(pair.second) + 1);
+	}
+
+	Ktx2Header header{};
+	memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	header.vkFormat = texture.format;
+	header.typeSize = 1;
+	header.pixelWidth = texture.extent.width;
+	header.pixelHeight = texture.extent.height;
+	header.faceCount = 1;
+	header.levelCount = levelCount;
+	header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + levelCount * sizeof(Ktx2LevelIndex));
+	header.dfdByteLength = descriptorSize;
+	header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+	header.kvdByteLength = static_cast<uint32_t>(keyValues.size());
+
+	std::vector<Ktx2LevelIndex> levels(levelCount);
+	uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+	for (uint32_t level = levelCount; level-- > 0;)
+	{
+		offset = (offset + blockSize - 1) / blockSize * blockSize;
+		levels[level] = { offset, texture.mipSizes[level], texture.mipSizes[level] };
+		offset += texture.mipSizes[level];
+	}
+
+	std::vector<char> file(static_cast<size_t>(offset), 0);
+	memcpy(file.data(), &header, sizeof(header));
+	memcpy(file.data() + sizeof(header), levels.data(), levels.size() * sizeof(Ktx2LevelIndex));
+	memcpy(file.data() + header.dfdByteOffset, descriptor.data(), descriptor.size());
+	memcpy(file.data() + header.kvdByteOffset, keyValues.data(), keyValues.size());
+	for (uint32_t level = 0; level < levelCount; level++)
+		memcpy(file.data() + levels[level].byteOffset, texture.data.data() + texture.mipOffsets[level], static_cast<size_t>(texture.mipSizes[level]));
+
+	//	Written next to the output and renamed over it, an interrupted bake never leaves a truncated texture.
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream output(tempPath, std::ios::binary | std::ios::trunc);
+		if (!output.write(file.data(), file.size()))
+			throw std::runtime_error("Texture: failed to write " + tempPath + "!");
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	if (error)
+		throw std::runtime_error("Texture: failed to replace " + path + "!");
+}
+
+//	Returns false when the output is up to date.
+bool BakeTexture(const std::filesystem::path& sourcePath, const std::filesystem::path& outputPath, TextureQuality quality)
+{
+	std::vector<char> source = ReadFile(sourcePath.string());
+
+	uint64_t hash = HashBytes(source.data(), source.size());
+	hash = HashBytes(&TEXTURE_BAKE_VERSION, sizeof(TEXTURE_BAKE_VERSION), hash);
+	hash = HashBytes(&quality, sizeof(quality), hash);
+
+	uint64_t bakedHash;
+	if (ReadKtx2BakeHash(outputPath.string(), bakedHash) && bakedHash == hash)
+		return false;
+
+	std::string stem = sourcePath.stem().string();
+	bool normalMap = (stem.size() > 2 && stem.compare(stem.size() - 2, 2, "_n") == 0) || (stem.size() > 7 && stem.compare(stem.size() - 7, 7, "_normal") == 0);
+
+	TextureData texture;
+	LoadTgaTextureData(sourcePath.string(), texture);
+
+	bool alpha = false;
+	for (size_t i = 3; i < texture.data.size() && !alpha; i += 4)
+		alpha = static_cast<uint8_t>(texture.data[i]) != 255;
+
+	VkFormat format = normalMap ? VK_FORMAT_BC5_UNORM_BLOCK : alpha ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	if (normalMap)
+		texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+
+	auto start = std::chrono::steady_clock::now();
+	GenerateTextureMips(texture, MIP_FILTER_KAISER);
+
+	TextureData compressed;
+	CompressTextureData(texture, format, quality, compressed);
+	WriteKtx2Texture(outputPath.string(), compressed, hash);
+
+	float milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	Print("Texture Baker: %s -> %s, %ix%i format %i, %i mip(s), %i -> %i bytes in %.1f ms", sourcePath.string().c_str(), outputPath.string().c_str(),
+		static_cast<int>(texture.extent.width), static_cast<int>(texture.extent.height), static_cast<int>(format), static_cast<int>(compressed.mipOffsets.size()),
+		static_cast<int>(texture.data.size()), static_cast<int>(compressed.data.size()), milliseconds);
+	return true;
+}
+
+//	AVulkan --bake-textures <source directory> <output directory> [fast|normal|high]
+//	Every .tga in the source directory becomes a .ktx2 of the same name in the output directory.
+int BakeTextures(int argc, char* args[])
+{
+	if (argc < 4)
+	{
+		Print("Usage: AVulkan --bake-textures <source directory> <output directory> [fast|normal|high]");
+		return 1;
+	}
+
+	std::filesystem::path sourceDir = args[2], outputDir = args[3];
+	std::string preset = argc > 4 ? args[4] : "normal";
+	TextureQuality quality = preset == "fast" ? TEXTURE_QUALITY_FAST : preset == "high" ? TEXTURE_QUALITY_HIGH : TEXTURE_QUALITY_NORMAL;
+
+	std::error_code error;
+	if (!std::filesystem::is_directory(sourceDir, error))
+	{
+		Print("Texture Baker: no source directory %s, nothing to bake", sourceDir.string().c_str());
+		return 0;
+	}
+	std::filesystem::create_directories(outputDir, error);
+
+	int baked = 0, upToDate = 0, failed = 0;
+	for (const auto& entry : std::filesystem::directory_iterator(sourceDir, error))
+	{
+		if (!entry.is_regular_file() || entry.path().extension() != ".tga")
+			continue;
+
+		std::filesystem::path outputPath = outputDir / entry.path().stem();
+		outputPath += ".ktx2";
+		try
+		{
+			if (BakeTexture(entry.path(), outputPath, quality))
+				baked++;
+			else
+				upToDate++;
+		}
+		catch (const std::exception& e)
+		{
+			Print("Texture Baker: %s failed: %s", entry.path().string().c_str(), e.what());
+			failed++;
+		}
+	}
+
+	Print("Texture Baker: %i baked, %i up to date, %i failed (%s)", baked, upToDate, failed, preset.c_str());
+	return failed ? 1 : 0;
+}
+
+// Per-Frame Ring Buffer
+//	Host visible memory split into one region per swapchain image. Command buffers are recorded once per image and
+//	reference fixed offsets, so the CPU rewrites a region only after that image's previous submission completed.
+struct FrameRingBuffer
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	char* mapped = nullptr;
+	VkDeviceSize regionSize = 0;
+	uint32_t regionCount = 0;
+};
+
+const VkDeviceSize FRAME_RING_REGION_ALIGNMENT = 256;
+
+//	Reserves the same range in every region, call before CreateFrameRingBuffer.
+VkDeviceSize ReserveFrameRingBuffer(FrameRingBuffer& ring, VkDeviceSize size, VkDeviceSize alignment)
+{
+	if (ring.buffer != VK_NULL_HANDLE)
+		throw std::runtime_error("Frame Ring Buffer: Reservations must be made before creation");
+
+	VkDeviceSize offset = (ring.regionSize + alignment - 1) / alignment * alignment;
+	ring.regionSize = offset + size;
+	return offset;
+}
+
+void CreateFrameRingBuffer(const VkPhysicalDevice& physicalDevice, const VkDevice& device, uint32_t regionCount, VkBufferUsageFlags usage, FrameRingBuffer& ring)
+{
+	ring.regionSize = std::max<VkDeviceSize>(FRAME_RING_REGION_ALIGNMENT, (ring.regionSize + FRAME_RING_REGION_ALIGNMENT - 1) & ~(FRAME_RING_REGION_ALIGNMENT - 1));
+	ring.regionCount = regionCount;
+
+	CreateVulkanBuffer(physicalDevice, device, ring.regionSize * regionCount, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ring.buffer, ring.memory);
+
+	void* mapped;
+	if (vkMapMemory(device, ring.memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+		throw std::runtime_error("failed to map frame ring buffer!");
+	ring.mapped = static_cast<char*>(mapped);
+
+	Print("Frame Ring Buffer: %i regions of %i bytes", static_cast<int>(regionCount), static_cast<int>(ring.regionSize));
+}
+
+VkDeviceSize GetFrameRingBufferOffset(const FrameRingBuffer& ring, uint32_t region, VkDeviceSize offset)
+{
+	return ring.regionSize * region + offset;
+}
+
+void* GetFrameRingBufferData(const FrameRingBuffer& ring, uint32_t region, VkDeviceSize offset)
+{
+	return ring.mapped + GetFrameRingBufferOffset(ring, region, offset);
+}
+
+void DestroyFrameRingBuffer(const VkDevice& device, FrameRingBuffer& ring)
+{
+	if (ring.mapped)
+		vkUnmapMemory(device, ring.memory);
+	vkDestroyBuffer(device, ring.buffer, nullptr);
+	vkFreeMemory(device, ring.memory, nullptr);
+	ring = FrameRingBuffer();
+}
+
+// Instancing
+//	Draws of the same mesh and material collapse into one batch. Every frame the visible instances are written to
+//	the ring and each batch becomes a single indirect draw whose instance count the CPU fills in, so the recorded
+//	commands do not depend on what is visible.
+struct InstanceBatch
+{
+	const Mesh* mesh = nullptr;
+	uint32_t material = 0;
+	uint32_t firstInstance = 0;
+	uint32_t maxInstances = 0;
+	uint32_t instanceCount = 0;
+};
+
+struct InstanceBatcher
+{
+	std::vector<InstanceBatch> batches;
+	std::map<std::pair<const Mesh*, uint32_t>, uint32_t> batchLookup;
+	uint32_t instanceCapacity = 0;
+
+	FrameRingBuffer* ring = nullptr;
+	VkDeviceSize instancesOffset = 0;
+	VkDeviceSize commandsOffset = 0;
+
+	//	Valid between BeginInstanceBatches and EndInstanceBatches.
+	uint32_t region = 0;
+	InstanceData* instances = nullptr;
+};
+
+//	Returns the batch for the mesh and material, growing it by maxInstances when it already exists.
+uint32_t AddInstanceBatch(InstanceBatcher& batcher, const Mesh& mesh, uint32_t material, uint32_t maxInstances)
+{
+	if (batcher.ring != nullptr)
+		throw std::runtime_error("Instancing: Batches must be added before the batcher is created");
+
+	auto [it, inserted] = batcher.batchLookup.emplace(std::make_pair(&mesh, material), static_cast<uint32_t>(batcher.batches.size()));
+	if (inserted)
+	{
+		batcher.batches.emplace_back();
+		batcher.batches.back().mesh = &mesh;
+		batcher.batches.back().material = material;
+	}
+
+	batcher.batches[it->second].maxInstances += maxInstances;
+	return it->second;
+}
+
+//	Lays out the batches' instance ranges and reserves their instances and indirect commands in the ring.
+void CreateInstanceBatcher(FrameRingBuffer& ring, InstanceBatcher& batcher)
+{
+	batcher.instanceCapacity = 0;
+	for (auto& batch : batcher.batches)
+	{
+		batch.firstInstance = batcher.instanceCapacity;
+		batcher.instanceCapacity += batch.maxInstances;
+	}
+
+	batcher.ring = &ring;
+	batcher.instancesOffset = ReserveFrameRingBuffer(ring, std::max(1u, batcher.instanceCapacity) * sizeof(InstanceData), sizeof(InstanceData));
+	batcher.commandsOffset = ReserveFrameRingBuffer(ring, std::max<size_t>(1, batcher.batches.size()) * sizeof(VkDrawIndexedIndirectCommand), sizeof(uint32_t));
+}
+
+void BeginInstanceBatches(InstanceBatcher& batcher, uint32_t region)
+{
+	batcher.region = region;
+	batcher.instances = static_cast<InstanceData*>(GetFrameRingBufferData(*batcher.ring, region, batcher.instancesOffset));
+	for (auto& batch : batcher.batches)
+		batch.instanceCount = 0;
+}
+
+void AddInstance(InstanceBatcher& batcher, uint32_t batchIndex, const InstanceData& instance)
+{
+	auto& batch = batcher.batches[batchIndex];
+	if (batch.instanceCount == batch.maxInstances)
+		throw std::runtime_error("Instancing: Batch instance capacity exceeded");
+
+	batcher.instances[batch.firstInstance + batch.instanceCount++] = instance;
+}
+
+//	Writes the indirect commands, empty batches become draws of zero instances. A batch holds a single mesh and its
+//	packet binds that mesh's buffers, so every draw starts at the first index and vertex.
+void EndInstanceBatches(InstanceBatcher& batcher)
+{
+	auto* commands = static_cast<VkDrawIndexedIndirectCommand*>(GetFrameRingBufferData(*batcher.ring, batcher.region, batcher.commandsOffset));
+	for (size_t i = 0; i < batcher.batches.size(); i++)
+	{
+		const auto& batch = batcher.batches[i];
+		commands[i] = { batch.mesh->indexCount, batch.instanceCount, 0, 0, batch.firstInstance };
+	}
+
+	batcher.instances = nullptr;
+}
+
+// Push Constants
+//	Small per draw payloads such as object and material indices are pushed instead of written to a descriptor or
+//	the ring. The builder mirrors the shader's block as T, remembers which bytes changed since the last flush and
+//	pushes only that span.
+const uint32_t MAX_PUSH_CONSTANT_SIZE = 128;	//	The minimum maxPushConstantsSize the spec guarantees.
+
+template<typename T>
+struct PushConstantBuilder
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Push constant blocks are copied byte wise");
+	static_assert(sizeof(T) <= MAX_PUSH_CONSTANT_SIZE, "Push constant block exceeds the guaranteed size");
+
+	T values{};
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkShaderStageFlags stageFlags = 0;
+	uint32_t dirtyBegin = sizeof(T);	//	Nothing is dirty while dirtyBegin >= dirtyEnd.
+	uint32_t dirtyEnd = 0;
+
+	template<typename Field>
+	PushConstantBuilder& Set(Field T::* member, const Field& value)
+	{
+		Field& field = values.*member;
+		if (memcmp(&field, &value, sizeof(Field)) == 0)
+			return *this;
+
+		memcpy(&field, &value, sizeof(Field));
+		uint32_t offset = static_cast<uint32_t>(reinterpret_cast<const char*>(&field) - reinterpret_cast<const char*>(&values));
+		dirtyBegin = std::min(dirtyBegin, offset);
+		dirtyEnd = std::max(dirtyEnd, offset + static_cast<uint32_t>(sizeof(Field)));
+		return *this;
+	}
+};
+
+//	range is the layout's reflected push constant range, it has to cover exactly T. A different layout may have
+//	disturbed the pushed values, so switching layouts pushes the whole block on the next flush.
+template<typename T>
+void BindPushConstants(PushConstantBuilder<T>& builder, VkPipelineLayout layout, const VkPushConstantRange& range)
+{
+	if (range.offset + range.size != sizeof(T))
+		throw std::runtime_error("Push constants: block does not match the shader's push constant range!");
+
+	if (layout == builder.layout)
+		return;
+
+	builder.layout = layout;
+	builder.stageFlags = range.stageFlags;
+	builder.dirtyBegin = range.offset;
+	builder.dirtyEnd = sizeof(T);
+}
+
+template<typename T>
+void FlushPushConstants(const VkCommandBuffer& cmdBuffer, PushConstantBuilder<T>& builder)
+{
+	if (builder.dirtyBegin >= builder.dirtyEnd)
+		return;
+
+	//	Offset and size have to be multiples of four.
+	uint32_t begin = builder.dirtyBegin & ~3u;
+	uint32_t end = std::min<uint32_t>((builder.dirtyEnd + 3) & ~3u, sizeof(T));
+	vkCmdPushConstants(cmdBuffer, builder.layout, builder.stageFlags, begin, end - begin, reinterpret_cast<const char*>(&builder.values) + begin);
+
+	builder.dirtyBegin = sizeof(T);
+	builder.dirtyEnd = 0;
+}
+
+// Draw Packets
+//	Draws are queued with a sort key and recorded in key order, so draws sharing state end up adjacent and the
+//	recorder only binds what changed since the previous draw.
+struct DrawPacket
+{
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;	//	Bound to set 0 when set.
+	const Mesh* mesh = nullptr;
+	VkBuffer instanceBuffer = VK_NULL_HANDLE;
+	VkDeviceSize instanceOffset = 0;
+	VkBuffer indirectBuffer = VK_NULL_HANDLE;		//	Draws one VkDrawIndexedIndirectCommand when set, the whole mesh otherwise.
+	VkDeviceSize indirectOffset = 0;
+	uint32_t instanceCount = 1;
+	uint32_t firstInstance = 0;
+	uint32_t material = 0;							//	Pushed per draw when recording with material constants.
+};
+
+struct DrawPacketQueue
+{
+	std::vector<DrawPacket> packets;
+	std::vector<RadixSortEntry> order;
+	std::vector<RadixSortEntry> scratch;
+
+	//	Handles are mapped to small ids in first use order, ids stay stable for the queue's lifetime.
+	std::map<VkPipeline, uint32_t> pipelineIds;
+};
+
+//	Most significant first: pass (8) | pipeline (16) | material (16) | depth (24). Depth is normalized to [0, 1],
+//	front to back within equal state.
+uint64_t MakeDrawSortKey(uint32_t pass, uint32_t pipelineId, uint32_t materialId, float depth)
+{
+	uint64_t quantizedDepth = static_cast<uint64_t>(std::min(std::max(depth, 0.0f), 1.0f) * 0xFFFFFF);
+	return (static_cast<uint64_t>(pass & 0xFF) << 56) | (static_cast<uint64_t>(pipelineId & 0xFFFF) << 40) | (static_cast<uint64_t>(materialId & 0xFFFF) << 24) | quantizedDepth;
+}
+
+void BeginDrawPackets(DrawPacketQueue& queue)
+{
+	queue.packets.clear();
+	queue.order.clear();
+}
+
+void QueueDrawPacket(DrawPacketQueue& queue, const DrawPacket& packet, uint32_t pass, uint32_t material, float depth)
+{
+	auto it = queue.pipelineIds.emplace(packet.pipeline, static_cast<uint32_t>(queue.pipelineIds.size())).first;
+
+	queue.order.push_back({ MakeDrawSortKey(pass, it->second, material, depth), static_cast<uint32_t>(queue.packets.size()) });
+	queue.packets.push_back(packet);
+}
+
+//	The replacement takes over the previous pipeline's id, so no stale handle stays behind as a key.
+void ReplaceDrawPacketPipeline(DrawPacketQueue& queue, VkPipeline previous, VkPipeline current)
+{
+	auto it = queue.pipelineIds.find(previous);
+	if (it == queue.pipelineIds.end())
+		return;
+
+	uint32_t id = it->second;
+	queue.pipelineIds.erase(it);
+	queue.pipelineIds[current] = id;
+}
+
+void SortDrawPackets(DrawPacketQueue& queue)
+{
+	RadixSort(queue.order, queue.scratch);
+}
+
+//	AVulkan --test-radix-sort
+//	Sorts random draw keys with RadixSort and std::stable_sort and fails on any difference in order. Values are the
+//	input positions, so equal keys also have to keep their order.
+int TestRadixSort()
+{
+	std::mt19937_64 random(1234);
+	auto makeDrawKeys = [&](size_t count, uint32_t pipelines, uint32_t materials, uint32_t depths)
+	{
+		std::vector<RadixSortEntry> entries(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t pass = static_cast<uint32_t>(random() % 4);
+			uint32_t pipeline = static_cast<uint32_t>(random() % pipelines);
+			uint32_t material = static_cast<uint32_t>(random() % materials);
+			float depth = static_cast<float>(random() % depths) / depths;
+			entries[i] = { MakeDrawSortKey(pass, pipeline, material, depth), static_cast<uint32_t>(i) };
+		}
+		return entries;
+	};
+
+	struct TestCase
+	{
+		const char* name;
+		std::vector<RadixSortEntry> entries;
+	};
+
+	const size_t manyChunks = RADIX_SORT_GRAIN_SIZE * 5 + 123;
+	std::vector<TestCase> tests;
+	tests.push_back({ "empty", {} });
+	tests.push_back({ "single", makeDrawKeys(1, 1, 1, 1) });
+	tests.push_back({ "one chunk", makeDrawKeys(1000, 16, 64, 1 << 24) });
+	tests.push_back({ "many chunks", makeDrawKeys(manyChunks, 256, 4096, 1 << 24) });
+	tests.push_back({ "duplicate keys", makeDrawKeys(manyChunks, 3, 5, 7) });
+	tests.push_back({ "one key", makeDrawKeys(manyChunks, 1, 1, 1) });
+
+	std::vector<RadixSortEntry> fullKeys(manyChunks);
+	for (size_t i = 0; i < fullKeys.size(); i++)
+		fullKeys[i] = { random(), static_cast<uint32_t>(i) };
+	tests.push_back({ "64 bit keys", fullKeys });
+
+	int failed = 0;
+	std::vector<RadixSortEntry> scratch;
+	for (auto& test : tests)
+	{
+		std::vector<RadixSortEntry> expected = test.entries;
+		std::stable_sort(expected.begin(), expected.end(), [](const RadixSortEntry& a, const RadixSortEntry& b) { return a.key < b.key; });
+		RadixSort(test.entries, scratch);
+
+		bool match = std::equal(expected.begin(), expected.end(), test.entries.begin(), test.entries.end(),
+			[](const RadixSortEntry& a, const RadixSortEntry& b) { return a.key == b.key && a.value == b.value; });
+		failed += !match;
+		Print("Radix Sort Test: %-14s %7i entries %s", test.name, static_cast<int>(expected.size()), match ? "ok" : "FAILED");
+	}
+
+	return failed ? 1 : 0;
+}
+
+//	materialConstants, when given, must already be bound to the layout the packets share.
+template<typename Constants>
+void RecordDrawPackets(const VkCommandBuffer& cmdBuffer, const DrawPacketQueue& queue, PushConstantBuilder<Constants>* materialConstants)
+{
+	const DrawPacket* bound = nullptr;
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+	for (const auto& entry : queue.order)
+	{
+		const auto& packet = queue.packets[entry.value];
+
+		if (!bound || packet.pipeline != bound->pipeline)
+			vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, packet.pipeline);
+
+		//	A new pipeline layout may disturb set 0, so it is rebound on any layout change.
+		if (packet.descriptorSet != VK_NULL_HANDLE && (!bound || packet.descriptorSet != bound->descriptorSet || packet.layout != bound->layout))
+			vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, packet.layout, 0, 1, &packet.descriptorSet, 0, nullptr);
+
+		bool meshChanged = !bound || packet.mesh != bound->mesh;
+		if (meshChanged)
+			BindVulkanMesh(cmdBuffer, *packet.mesh);
+
+		//	The instance binding index follows the mesh's vertex bindings.
+		if (packet.instanceBuffer != VK_NULL_HANDLE && (meshChanged || packet.instanceBuffer != bound->instanceBuffer || packet.instanceOffset != bound->instanceOffset))
+			BindVulkanInstances(cmdBuffer, *packet.mesh, packet.instanceBuffer, packet.instanceOffset);
+
+		//	Packets are sorted by material, so this only pushes when the material changes.
+		if (materialConstants)
+		{
+			materialConstants->Set(&Constants::material, packet.material);
+			FlushPushConstants(cmdBuffer, *materialConstants);
+		}
+
+		if (packet.indirectBuffer != VK_NULL_HANDLE)
+			vkCmdDrawIndexedIndirect(cmdBuffer, packet.indirectBuffer, packet.indirectOffset, 1, stride);
+		else
+			vkCmdDrawIndexed(cmdBuffer, packet.mesh->indexCount, packet.instanceCount, 0, 0, packet.firstInstance);
+
+		bound = &packet;
+	}
+}
+
+//	Queues the batches of one material for a swapchain image. state supplies the pipeline and descriptor set.
+void QueueInstanceBatches(DrawPacketQueue& queue, const InstanceBatcher& batcher, uint32_t imageIndex, uint32_t material, const DrawPacket& state, uint32_t pass)
+{
+	const auto& ring = *batcher.ring;
+	for (size_t i = 0; i < batcher.batches.size(); i++)
+	{
+		const auto& batch = batcher.batches[i];
+		if (batch.material != material)
+			continue;
+
+		DrawPacket packet = state;
+		packet.mesh = batch.mesh;
+		packet.instanceBuffer = ring.buffer;
+		packet.instanceOffset = GetFrameRingBufferOffset(ring, imageIndex, batcher.instancesOffset);
+		packet.indirectBuffer = ring.buffer;
+		packet.indirectOffset = GetFrameRingBufferOffset(ring, imageIndex, batcher.commandsOffset) + i * sizeof(VkDrawIndexedIndirectCommand);
+		packet.material = material;
+		QueueDrawPacket(queue, packet, pass, material, 0.0f);
+	}
+}
+
+// SPIR-V Reflection
+const uint32_t SPIRV_MAGIC = 0x07230203;
+
+enum SpvOp : uint16_t
+{
+	SpvOpEntryPoint = 15,
+	SpvOpTypeVoid = 19,
+	SpvOpTypeBool = 20,
+	SpvOpTypeInt = 21,
+	SpvOpTypeFloat = 22,
+	SpvOpTypeVector = 23,
+	SpvOpTypeMatrix = 24,
+	SpvOpTypeImage = 25,
+	SpvOpTypeSampler = 26,
+	SpvOpTypeSampledImage = 27,
+	SpvOpTypeArray = 28,
+	SpvOpTypeRuntimeArray = 29,
+	SpvOpTypeStruct = 30,
+	SpvOpTypePointer = 32,
+	SpvOpConstant = 43,
+	SpvOpSpecConstantTrue = 48,
+	SpvOpSpecConstantFalse = 49,
+	SpvOpSpecConstant = 50,
+	SpvOpVariable = 59,
+	SpvOpDecorate = 71,
+	SpvOpMemberDecorate = 72,
+};
+
+enum SpvDecoration : uint32_t
+{
+	SpvDecorationSpecId = 1,
+	SpvDecorationBlock = 2,
+	SpvDecorationBufferBlock = 3,
+	SpvDecorationArrayStride = 6,
+	SpvDecorationMatrixStride = 7,
+	SpvDecorationBuiltIn = 11,
+	SpvDecorationLocation = 30,
+	SpvDecorationBinding = 33,
+	SpvDecorationDescriptorSet = 34,
+	SpvDecorationOffset = 35,
+};
+
+enum SpvStorageClass : uint32_t
+{
+	SpvStorageClassUniformConstant = 0,
+	SpvStorageClassInput = 1,
+	SpvStorageClassUniform = 2,
+	SpvStorageClassPushConstant = 9,
+	SpvStorageClassStorageBuffer = 12,
+};
+
+enum SpvDim : uint32_t
+{
+	SpvDimBuffer = 5,
+	SpvDimSubpassData = 6,
+};
+
+struct SpirvModule
+{
+	struct Instruction
+	{
+		uint16_t opcode = 0;
+		uint16_t wordCount = 0;
+		uint32_t offset = 0;
+	};
+
+	std::vector<uint32_t> words;
+	std::vector<Instruction> ids;
+	std::vector<std::map<uint32_t, uint32_t>> decorations;
+	std::map<std::pair<uint32_t, uint32_t>, std::map<uint32_t, uint32_t>> memberDecorations;
+	std::vector<uint32_t> variables;
+	std::vector<uint32_t> specConstants;
+	uint32_t executionModel = UINT32_MAX;
+
+	const uint32_t* Operands(uint32_t id) const { return &words[ids[id].offset + 1]; }
+
+	bool HasDecoration(uint32_t id, uint32_t decoration) const { return decorations[id].count(decoration) > 0; }
+
+	uint32_t Decoration(uint32_t id, uint32_t decoration, uint32_t fallback = 0) const
+	{
+		auto it = decorations[id].find(decoration);
+		return it != decorations[id].end() ? it->second : fallback;
+	}
+
+	uint32_t MemberDecoration(uint32_t id, uint32_t member, uint32_t decoration, uint32_t fallback = 0) const
+	{
+		auto members = memberDecorations.find({ id, member });
+		if (members == memberDecorations.end()) return fallback;
+		auto it = members->second.find(decoration);
+		return it != members->second.end() ? it->second : fallback;
+	}
+
+	uint32_t ConstantValue(uint32_t id) const { return Operands(id)[2]; }
+
+	uint32_t TypeSize(uint32_t id) const
+	{
+		const uint32_t* op = Operands(id);
+		switch (ids[id].opcode)
+		{
+		case SpvOpTypeBool: return 4;
+		case SpvOpTypeInt:
+		case SpvOpTypeFloat: return op[1] / 8;
+		case SpvOpTypeVector: return op[2] * TypeSize(op[1]);
+		case SpvOpTypeMatrix: return op[2] * TypeSize(op[1]);
+		case SpvOpTypeArray: return ConstantValue(op[2]) * (HasDecoration(id, SpvDecorationArrayStride) ? Decoration(id, SpvDecorationArrayStride) : TypeSize(op[1]));
+		case SpvOpTypeRuntimeArray: return 0;
+		case SpvOpTypeStruct:
+		{
+			uint32_t size = 0;
+			for (uint32_t member = 0; member + 2 < ids[id].wordCount; member++)
+			{
+				uint32_t memberType = op[member + 1];
+				uint32_t memberSize = TypeSize(memberType);
+				uint32_t matrixStride = MemberDecoration(id, member, SpvDecorationMatrixStride);
+				if (ids[memberType].opcode == SpvOpTypeMatrix && matrixStride)
+					memberSize = Operands(memberType)[2] * matrixStride;
+				size = std::max(size, MemberDecoration(id, member, SpvDecorationOffset) + memberSize);
+			}
+			return size;
+		}
+		default: return 0;
+		}
+	}
+};
+
+SpirvModule ParseSpirvModule(const std::vector<char>& code)
+{
+	if (code.size() < 20 || code.size() % sizeof(uint32_t) != 0)
+		throw std::runtime_error("SPIR-V: Invalid module size");
+
+	SpirvModule module;
+	module.words.resize(code.size() / sizeof(uint32_t));
+	memcpy(module.words.data(), code.data(), code.size());
+
+	if (module.words[0] != SPIRV_MAGIC)
+		throw std::runtime_error("SPIR-V: Invalid magic number");
+
+	uint32_t bound = module.words[3];
+	module.ids.resize(bound);
+	module.decorations.resize(bound);
+
+	auto defineId = [&](uint32_t id, uint16_t opcode, uint16_t wordCount, uint32_t offset)
+	{
+		if (id >= bound)
+			throw std::runtime_error("SPIR-V: Result id out of bounds");
+		module.ids[id] = { opcode, wordCount, offset };
+	};
+
+	for (uint32_t offset = 5; offset < module.words.size();)
+	{
+		uint16_t opcode = module.words[offset] & 0xFFFF;
+		uint16_t wordCount = module.words[offset] >> 16;
+		if (wordCount == 0 || offset + wordCount > module.words.size())
+			throw std::runtime_error("SPIR-V: Truncated instruction stream");
+
+		const uint32_t* op = &module.words[offset + 1];
+		switch (opcode)
+		{
+		case SpvOpEntryPoint:
+			if (module.executionModel == UINT32_MAX)
+				module.executionModel = op[0];
+			break;
+		case SpvOpDecorate:
+			if (op[0] < bound)
+				module.decorations[op[0]][op[1]] = wordCount > 3 ? op[2] : 1;
+			break;
+		case SpvOpMemberDecorate:
+			module.memberDecorations[{ op[0], op[1] }][op[2]] = wordCount > 4 ? op[3] : 1;
+			break;
+		case SpvOpTypeVoid: case SpvOpTypeBool: case SpvOpTypeInt: case SpvOpTypeFloat:
+		case SpvOpTypeVector: case SpvOpTypeMatrix: case SpvOpTypeImage: case SpvOpTypeSampler:
+		case SpvOpTypeSampledImage: case SpvOpTypeArray: case SpvOpTypeRuntimeArray:
+		case SpvOpTypeStruct: case SpvOpTypePointer:
+			defineId(op[0], opcode, wordCount, offset);
+			break;
+		case SpvOpConstant:
+			defineId(op[1], opcode, wordCount, offset);
+			break;
+		case SpvOpSpecConstantTrue: case SpvOpSpecConstantFalse: case SpvOpSpecConstant:
+			defineId(op[1], opcode, wordCount, offset);
+			module.specConstants.push_back(op[1]);
+			break;
+		case SpvOpVariable:
+			defineId(op[1], opcode, wordCount, offset);
+			module.variables.push_back(op[1]);
+			break;
+		default: break;
+		}
+
+		offset += wordCount;
+	}
+
+	return module;
+}
+
+struct ShaderReflection
+{
+	VkShaderStageFlags stageFlags = 0;
+	std::map<uint32_t, std::map<uint32_t, VkDescriptorSetLayoutBinding>> descriptorSets;
+	std::vector<VkPushConstantRange> pushConstantRanges;
+	std::vector<VkVertexInputAttributeDescription> vertexInputs;
+	std::set<uint32_t> specializationConstants;
+};
+
+VkShaderStageFlagBits GetSpirvShaderStage(uint32_t executionModel)
+{
+	switch (executionModel)
+	{
+	case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+	case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+	case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+	case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+	case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+	case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+	default: throw std::runtime_error("SPIR-V: Unsupported execution model");
+	}
+}
+
+VkFormat GetSpirvVertexFormat(const SpirvModule& module, uint32_t typeId)
+{
+	uint32_t componentCount = 1;
+	if (module.ids[typeId].opcode == SpvOpTypeVector)
+	{
+		componentCount = module.Operands(typeId)[2];
+		typeId = module.Operands(typeId)[1];
+	}
+
+	const uint32_t* op = module.Operands(typeId);
+	if (op[1] != 32 || componentCount < 1 || componentCount > 4)
+		throw std::runtime_error("SPIR-V: Unsupported vertex input type");
+
+	const VkFormat floatFormats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+	const VkFormat intFormats[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+	const VkFormat uintFormats[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+
+	if (module.ids[typeId].opcode == SpvOpTypeFloat) return floatFormats[componentCount - 1];
+	return op[2] ? intFormats[componentCount - 1] : uintFormats[componentCount - 1];
+}
+
+VkDescriptorType GetSpirvDescriptorType(const SpirvModule& module, uint32_t typeId, uint32_t storageClass)
+{
+	const uint32_t* op = module.Operands(typeId);
+	switch (storageClass)
+	{
+	case SpvStorageClassStorageBuffer: return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	case SpvStorageClassUniform:
+		return module.HasDecoration(typeId, SpvDecorationBufferBlock) ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	case SpvStorageClassUniformConstant:
+		switch (module.ids[typeId].opcode)
+		{
+		case SpvOpTypeSampler: return VK_DESCRIPTOR_TYPE_SAMPLER;
+		case SpvOpTypeSampledImage:
+			return module.Operands(op[1])[2] == SpvDimBuffer ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		case SpvOpTypeImage:
+			if (op[2] == SpvDimSubpassData) return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			if (op[2] == SpvDimBuffer) return op[6] == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+			return op[6] == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		default: break;
+		}
+		throw std::runtime_error("SPIR-V: Unsupported uniform constant type");
+	default: throw std::runtime_error("SPIR-V: Unsupported descriptor type");
+	}
+}
+
+ShaderReflection ReflectVulkanShaderModule(const std::vector<char>& code)
+{
+	SpirvModule module = ParseSpirvModule(code);
+
+	ShaderReflection reflection;
+	VkShaderStageFlagBits stage = GetSpirvShaderStage(module.executionModel);
+	reflection.stageFlags = stage;
+
+	for (uint32_t variable : module.variables)
+	{
+		const uint32_t* op = module.Operands(variable);
+		uint32_t storageClass = op[2];
+		uint32_t typeId = module.Operands(op[0])[2];
+
+		switch (storageClass)
+		{
+		case SpvStorageClassInput:
+		{
+			if (stage != VK_SHADER_STAGE_VERTEX_BIT || module.HasDecoration(variable, SpvDecorationBuiltIn) || !module.HasDecoration(variable, SpvDecorationLocation))
+				break;
+
+			VkVertexInputAttributeDescription attribute{};
+			attribute.location = module.Decoration(variable, SpvDecorationLocation);
+			attribute.format = GetSpirvVertexFormat(module, typeId);
+			reflection.vertexInputs.push_back(attribute);
+			break;
+		}
+		case SpvStorageClassPushConstant:
+		{
+			uint32_t memberCount = module.ids[typeId].wordCount - 2;
+			uint32_t offset = UINT32_MAX;
+			for (uint32_t member = 0; member < memberCount; member++)
+				offset = std::min(offset, module.MemberDecoration(typeId, member, SpvDecorationOffset));
+
+			VkPushConstantRange range{};
+			range.stageFlags = stage;
+			range.offset = memberCount ? offset : 0;
+			range.size = module.TypeSize(typeId) - range.offset;
+			reflection.pushConstantRanges.push_back(range);
+			break;
+		}
+		case SpvStorageClassUniformConstant:
+		case SpvStorageClassUniform:
+		case SpvStorageClassStorageBuffer:
+		{
+			VkDescriptorSetLayoutBinding binding{};
+			binding.binding = module.Decoration(variable, SpvDecorationBinding);
+			binding.descriptorCount = 1;
+			binding.stageFlags = stage;
+
+			//	Unwrap descriptor arrays, runtime sized arrays are left with a count of zero.
+			while (module.ids[typeId].opcode == SpvOpTypeArray || module.ids[typeId].opcode == SpvOpTypeRuntimeArray)
+			{
+				const uint32_t* arrayOp = module.Operands(typeId);
+				binding.descriptorCount = module.ids[typeId].opcode == SpvOpTypeArray ? binding.descriptorCount * module.ConstantValue(arrayOp[2]) : 0;
+				typeId = arrayOp[1];
+			}
+
+			binding.descriptorType = GetSpirvDescriptorType(module, typeId, storageClass);
+			reflection.descriptorSets[module.Decoration(variable, SpvDecorationDescriptorSet)][binding.binding] = binding;
+			break;
+		}
+		default: break;
+		}
+	}
+
+	for (uint32_t specConstant : module.specConstants)
+		if (module.HasDecoration(specConstant, SpvDecorationSpecId))
+			reflection.specializationConstants.insert(module.Decoration(specConstant, SpvDecorationSpecId));
+
+	std::sort(reflection.vertexInputs.begin(), reflection.vertexInputs.end(),
+		[](const VkVertexInputAttributeDescription& a, const VkVertexInputAttributeDescription& b) { return a.location < b.location; });
+
+	return reflection;
+}
+
+void MergeShaderReflection(ShaderReflection& merged, const ShaderReflection& stage)
+{
+	merged.stageFlags |= stage.stageFlags;
+
+	for (const auto& [set, bindings] : stage.descriptorSets)
+	{
+		for (const auto& [index, binding] : bindings)
+		{
+			auto& mergedSet = merged.descriptorSets[set];
+			auto it = mergedSet.find(index);
+			if (it == mergedSet.end())
+			{
+				mergedSet[index] = binding;
+				continue;
+			}
+
+			if (it->second.descriptorType != binding.descriptorType || it->second.descriptorCount != binding.descriptorCount)
+				throw std::runtime_error("SPIR-V: Conflicting descriptor binding between shader stages");
+
+			it->second.stageFlags |= binding.stageFlags;
+		}
+	}
+
+	//	Fold every stage into a single range so a push only has to name one set of stage flags.
+	for (const auto& range : stage.pushConstantRanges)
+	{
+		if (merged.pushConstantRanges.empty())
+		{
+			merged.pushConstantRanges.push_back(range);
+			continue;
+		}
+
+		auto& mergedRange = merged.pushConstantRanges[0];
+		uint32_t end = std::max(mergedRange.offset + mergedRange.size, range.offset + range.size);
+		mergedRange.offset = std::min(mergedRange.offset, range.offset);
+		mergedRange.size = end - mergedRange.offset;
+		mergedRange.stageFlags |= range.stageFlags;
+	}
+
+	if (!stage.vertexInputs.empty())
+		merged.vertexInputs = stage.vertexInputs;
+
+	merged.specializationConstants.insert(stage.specializationConstants.begin(), stage.specializationConstants.end());
+}
+
+// Descriptor Set & Pipeline Layout Cache
+//	Shaders that declare this set get the bindless heap's layout instead of one built from their reflection.
+const uint32_t BINDLESS_DESCRIPTOR_SET = 1;
+
+struct PipelineLayoutCache
+{
+	std::map<std::vector<uint32_t>, VkDescriptorSetLayout> setLayouts;
+	std::map<std::vector<uint64_t>, VkPipelineLayout> pipelineLayouts;
+	std::map<VkPipelineLayout, VkPushConstantRange> pushConstantRanges;	//	The merged range of every layout that has one.
+	VkDescriptorSetLayout bindlessSetLayout = VK_NULL_HANDLE;	//	Owned by the bindless heap.
+	std::mutex mutex;
+};
+
+VkDescriptorSetLayout GetCachedDescriptorSetLayout(const VkDevice& device, PipelineLayoutCache& cache, const std::map<uint32_t, VkDescriptorSetLayoutBinding>& bindings)
+{
+	std::vector<uint32_t> key;
+	std::vector<VkDescriptorSetLayoutBinding> layoutBindings;
+	for (const auto& [index, binding] : bindings)
+	{
+		key.insert(key.end(), { binding.binding, static_cast<uint32_t>(binding.descriptorType), binding.descriptorCount, binding.stageFlags });
+		layoutBindings.push_back(binding);
+	}
+
+	auto it = cache.setLayouts.find(key);
+	if (it != cache.setLayouts.end())
+		return it->second;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	layoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+	layoutInfo.pBindings = layoutBindings.data();
+
+	VkDescriptorSetLayout setLayout;
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create descriptor set layout!");
+
+	cache.setLayouts[key] = setLayout;
+	return setLayout;
+}
+
+VkPipelineLayout GetCachedPipelineLayout(const VkDevice& device, PipelineLayoutCache& cache, const ShaderReflection& reflection)
+{
+	std::lock_guard<std::mutex> lock(cache.mutex);
+
+	//	Sets must be contiguous in the pipeline layout, gaps are filled with empty set layouts.
+	std::vector<VkDescriptorSetLayout> setLayouts;
+	uint32_t setCount = reflection.descriptorSets.empty() ? 0 : reflection.descriptorSets.rbegin()->first + 1;
+	for (uint32_t set = 0; set < setCount; set++)
+	{
+		auto it = reflection.descriptorSets.find(set);
+		if (set == BINDLESS_DESCRIPTOR_SET && it != reflection.descriptorSets.end())
+		{
+			if (cache.bindlessSetLayout == VK_NULL_HANDLE)
+				throw std::runtime_error("Bindless: shader declares the bindless set but no heap was created!");
+			setLayouts.push_back(cache.bindlessSetLayout);
+			continue;
+		}
+
+		setLayouts.push_back(GetCachedDescriptorSetLayout(device, cache, it != reflection.descriptorSets.end() ? it->second : std::map<uint32_t, VkDescriptorSetLayoutBinding>{}));
+	}
+
+	std::vector<uint64_t> key;
+	for (const auto& setLayout : setLayouts)
+		key.push_back(reinterpret_cast<uint64_t>(setLayout));
+	for (const auto& range : reflection.pushConstantRanges)
+		key.insert(key.end(), { range.stageFlags, range.offset, range.size });
+
+	auto it = cache.pipelineLayouts.find(key);
+	if (it != cache.pipelineLayouts.end())
+		return it->second;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(reflection.pushConstantRanges.size());
+	pipelineLayoutInfo.pPushConstantRanges = reflection.pushConstantRanges.data();
+
+	VkPipelineLayout pipelineLayout;
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create pipeline layout!");
+
+	Print("Vulkan: Created pipeline layout with %i set(s) and %i push constant range(s)", static_cast<int>(setLayouts.size()), static_cast<int>(reflection.pushConstantRanges.size()));
+
+	cache.pipelineLayouts[key] = pipelineLayout;
+	if (!reflection.pushConstantRanges.empty())
+		cache.pushConstantRanges[pipelineLayout] = reflection.pushConstantRanges[0];
+	return pipelineLayout;
+}
+
+//	An empty range when the layout has no push constants.
+VkPushConstantRange GetCachedPushConstantRange(PipelineLayoutCache& cache, VkPipelineLayout layout)
+{
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	auto it = cache.pushConstantRanges.find(layout);
+	return it != cache.pushConstantRanges.end() ? it->second : VkPushConstantRange{};
+}
+
+void DestroyPipelineLayoutCache(const VkDevice& device, PipelineLayoutCache& cache)
+{
+	for (const auto& [key, pipelineLayout] : cache.pipelineLayouts)
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	for (const auto& [key, setLayout] : cache.setLayouts)
+		vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+
+	cache.pipelineLayouts.clear();
+	cache.pushConstantRanges.clear();
+	cache.setLayouts.clear();
+}
+
+// Descriptor Allocator
+//	Sets come from pools owned by a frame slot. Exhausted pools are retired to the slot's list and replaced, and
+//	once no submitted work uses the slot's sets any more every pool it used is reset in one call and returned to a
+//	shared free list. Sets are never freed individually. What a slot stands for is up to the owner: the descriptor
+//	set cache keeps one per generation parity rather than one per frame in flight, see below.
+struct DescriptorAllocator
+{
+	std::vector<std::vector<VkDescriptorPool>> framePools;	//	The last pool of a frame is the one allocated from.
+	std::vector<VkDescriptorPool> freePools;
+	uint32_t setsPerPool = 64;
+};
+
+const uint32_t DESCRIPTOR_POOL_MAX_SETS = 4096;
+
+//	Descriptors per set, scaled by the pool's set count.
+const std::pair<VkDescriptorType, float> DESCRIPTOR_POOL_RATIOS[] = {
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.0f },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 2.0f },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+	{ VK_DESCRIPTOR_TYPE_SAMPLER, 1.0f },
+};
+
+void CreateDescriptorAllocator(uint32_t frameCount, DescriptorAllocator& outAllocator)
+{
+	outAllocator.framePools.resize(frameCount);
+}
+
+//	Takes a pool from the free list, or creates one twice the size of the last.
+VkDescriptorPool AcquireDescriptorPool(const VkDevice& device, DescriptorAllocator& allocator)
+{
+	if (!allocator.freePools.empty())
+	{
+		VkDescriptorPool pool = allocator.freePools.back();
+		allocator.freePools.pop_back();
+		return pool;
+	}
+
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	for (const auto& [type, ratio] : DESCRIPTOR_POOL_RATIOS)
+		poolSizes.push_back({ type, static_cast<uint32_t>(ratio * allocator.setsPerPool) });
+
+	VkDescriptorPoolCreateInfo poolInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolInfo.maxSets = allocator.setsPerPool;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create descriptor pool!");
+
+	Print("Vulkan: Created descriptor pool for %i sets", static_cast<int>(allocator.setsPerPool));
+	allocator.setsPerPool = std::min(allocator.setsPerPool * 2, DESCRIPTOR_POOL_MAX_SETS);
+	return pool;
+}
+
+void AllocateDescriptorSet(const VkDevice& device, DescriptorAllocator& allocator, uint32_t frame, VkDescriptorSetLayout layout, VkDescriptorSet& outSet)
+{
+	auto& pools = allocator.framePools[frame];
+	if (pools.empty())
+		pools.push_back(AcquireDescriptorPool(device, allocator));
+
+	VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = pools.back();
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &outSet);
+	if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+	{
+		pools.push_back(AcquireDescriptorPool(device, allocator));
+		allocInfo.descriptorPool = pools.back();
+		result = vkAllocateDescriptorSets(device, &allocInfo, &outSet);
+	}
+
+	if (result != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate descriptor set!");
+}
+
+//	Call once the frame's fence has signaled, every set allocated for the frame becomes invalid.
+void ResetDescriptorAllocator(const VkDevice& device, DescriptorAllocator& allocator, uint32_t frame)
+{
+	for (VkDescriptorPool pool : allocator.framePools[frame])
+	{
+		vkResetDescriptorPool(device, pool, 0);
+		allocator.freePools.push_back(pool);
+	}
+	allocator.framePools[frame].clear();
+}
+
+void DestroyDescriptorAllocator(const VkDevice& device, DescriptorAllocator& allocator)
+{
+	for (auto& pools : allocator.framePools)
+		for (VkDescriptorPool pool : pools)
+			vkDestroyDescriptorPool(device, pool, nullptr);
+	for (VkDescriptorPool pool : allocator.freePools)
+		vkDestroyDescriptorPool(device, pool, nullptr);
+
+	allocator = DescriptorAllocator();
+}
+
+// Descriptor Set Cache
+//	Sets are looked up by layout and contents, so binding the same resources every frame costs a map lookup instead
+//	of an allocation and a vkUpdateDescriptorSets. Sets belong to a generation of generationFrames frames and hits on
+//	the previous generation are rebuilt into the current one. When a generation starts, the pools of the one before
+//	the previous are reset, which evicts every set that went unused for a whole generation.
+//	This replaces resetting pools per frame in flight: every set the renderer binds repeats from frame to frame, so a
+//	per-frame reset would rewrite all of them each frame. A generation is at least MAX_FRAMES_IN_FLIGHT frames long,
+//	so its reset still only happens once the frames that used the pools have retired.
+struct DescriptorBinding
+{
+	uint32_t binding = 0;
+	VkDescriptorType type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	VkDescriptorBufferInfo buffer = {};
+	VkDescriptorImageInfo image = {};
+};
+
+DescriptorBinding MakeBufferBinding(uint32_t binding, VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE)
+{
+	DescriptorBinding descriptor;
+	descriptor.binding = binding;
+	descriptor.type = type;
+	descriptor.buffer = { buffer, offset, range };
+	return descriptor;
+}
+
+DescriptorBinding MakeImageBinding(uint32_t binding, VkDescriptorType type, VkImageView view, VkImageLayout layout, VkSampler sampler = VK_NULL_HANDLE)
+{
+	DescriptorBinding descriptor;
+	descriptor.binding = binding;
+	descriptor.type = type;
+	descriptor.image = { sampler, view, layout };
+	return descriptor;
+}
+
+bool IsVulkanImageDescriptor(VkDescriptorType type)
+{
+	return type == VK_DESCRIPTOR_TYPE_SAMPLER || type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
+		type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE || type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+}
+
+struct DescriptorSetCache
+{
+	struct Entry
+	{
+		VkDescriptorSet set;
+		uint64_t generation;
+	};
+
+	std::map<std::vector<uint64_t>, Entry> entries;
+	DescriptorAllocator allocator;	//	One allocator frame per generation parity.
+	uint32_t generationFrames = 0;
+	uint32_t frame = 0;
+	uint64_t generation = 0;
+	uint32_t updates = 0;			//	Sets written in the current generation.
+};
+
+const uint32_t DESCRIPTOR_SET_CACHE_GENERATION_FRAMES = 60;
+
+void CreateDescriptorSetCache(uint32_t generationFrames, DescriptorSetCache& outCache)
+{
+	//	A generation's pools are reset two generations later, by then every frame that used them has retired.
+	outCache.generationFrames = std::max<uint32_t>(generationFrames, MAX_FRAMES_IN_FLIGHT);
+	CreateDescriptorAllocator(2, outCache.allocator);
+}
+
+VkDescriptorSet GetCachedDescriptorSet(const VkDevice& device, DescriptorSetCache& cache, VkDescriptorSetLayout layout, const std::vector<DescriptorBinding>& bindings)
+{
+	std::vector<uint64_t> key = { reinterpret_cast<uint64_t>(layout) };
+	for (const auto& descriptor : bindings)
+	{
+		key.insert(key.end(), { descriptor.binding, static_cast<uint64_t>(descriptor.type),
+			reinterpret_cast<uint64_t>(descriptor.buffer.buffer), descriptor.buffer.offset, descriptor.buffer.range,
+			reinterpret_cast<uint64_t>(descriptor.image.imageView), static_cast<uint64_t>(descriptor.image.imageLayout), reinterpret_cast<uint64_t>(descriptor.image.sampler) });
+	}
+
+	auto it = cache.entries.find(key);
+	if (it != cache.entries.end() && it->second.generation == cache.generation)
+		return it->second.set;
+
+	VkDescriptorSet set;
+	AllocateDescriptorSet(device, cache.allocator, static_cast<uint32_t>(cache.generation % 2), layout, set);
+
+	std::vector<VkWriteDescriptorSet> writes;
+	for (const auto& descriptor : bindings)
+	{
+		VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		write.dstSet = set;
+		write.dstBinding = descriptor.binding;
+		write.descriptorCount = 1;
+		write.descriptorType = descriptor.type;
+		if (IsVulkanImageDescriptor(descriptor.type))
+			write.pImageInfo = &descriptor.image;
+		else
+			write.pBufferInfo = &descriptor.buffer;
+		writes.push_back(write);
+	}
+
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+	cache.entries[key] = { set, cache.generation };
+	cache.updates++;
+	return set;
+}
+
+//	Call once per frame, after the frame's fence has signaled and before any lookups for it.
+void AdvanceDescriptorSetCache(const VkDevice& device, DescriptorSetCache& cache)
+{
+	if (++cache.frame < cache.generationFrames)
+		return;
+
+	cache.frame = 0;
+	cache.generation++;
+	ResetDescriptorAllocator(device, cache.allocator, static_cast<uint32_t>(cache.generation % 2));
+
+	size_t evicted = 0;
+	for (auto it = cache.entries.begin(); it != cache.entries.end();)
+	{
+		if (it->second.generation + 1 < cache.generation)
+		{
+			it = cache.entries.erase(it);
+			evicted++;
+		}
+		else
+			++it;
+	}
+
+	if (evicted > 0 || cache.updates > 0)
+		Print("Vulkan: Descriptor set cache wrote %i set(s) and evicted %i in the last generation", static_cast<int>(cache.updates), static_cast<int>(evicted));
+	cache.updates = 0;
+}
+
+void DestroyDescriptorSetCache(const VkDevice& device, DescriptorSetCache& cache)
+{
+	DestroyDescriptorAllocator(device, cache.allocator);
+	cache = DescriptorSetCache();
+}
+
+// Bindless Resources
+//	One update-after-bind set holds every sampled image, sampler and storage buffer the renderer knows about.
+//	Resources are registered once and referred to by a stable index, shaders pick them through push constants so
+//	draws never bind descriptors besides the heap itself. Released indices are recycled once the frames that may
+//	still read them have retired.
+enum BindlessResourceType : uint32_t
+{
+	BINDLESS_SAMPLED_IMAGE = 0,		//	binding 0, texture2D textures[]
+	BINDLESS_SAMPLER,				//	binding 1, sampler samplers[]
+	BINDLESS_STORAGE_BUFFER,		//	binding 2, buffer blocks[]
+	BINDLESS_RESOURCE_TYPE_COUNT
+};
+
+const uint32_t BINDLESS_INVALID_HANDLE = UINT32_MAX;
+const uint32_t BINDLESS_CAPACITIES[BINDLESS_RESOURCE_TYPE_COUNT] = { 16384, 256, 16384 };
+const VkDescriptorType BINDLESS_DESCRIPTOR_TYPES[BINDLESS_RESOURCE_TYPE_COUNT] = { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER };
+
+struct BindlessHeap
+{
+	struct Retired
+	{
+		BindlessResourceType type;
+		uint32_t handle;
+		uint64_t frame;
+	};
+
+	VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	uint32_t capacity[BINDLESS_RESOURCE_TYPE_COUNT] = {};
+	uint32_t next[BINDLESS_RESOURCE_TYPE_COUNT] = {};		//	Indices below next have been handed out at least once.
+	std::vector<uint32_t> freeHandles[BINDLESS_RESOURCE_TYPE_COUNT];
+	std::deque<Retired> retired;
+	uint64_t frame = 0;
+};
+
+//	Also registers the heap's layout with the layout cache, so it must outlive every pipeline layout built after it.
+void CreateBindlessHeap(const VkPhysicalDevice& physicalDevice, const VkDevice& device, PipelineLayoutCache& layoutCache, BindlessHeap& outHeap)
+{
+	if (!descriptorIndexingEnabled)
+		throw std::runtime_error("Bindless: descriptor indexing is not enabled!");
+
+	VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES };
+	VkPhysicalDeviceProperties2 properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+	properties.pNext = &indexingProperties;
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+	const uint32_t limits[BINDLESS_RESOURCE_TYPE_COUNT] = {
+		std::min(indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages, indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages),
+		std::min(indexingProperties.maxDescriptorSetUpdateAfterBindSamplers, indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers),
+		std::min(indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers, indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers),
+	};
+
+	VkDescriptorSetLayoutBinding bindings[BINDLESS_RESOURCE_TYPE_COUNT] = {};
+	VkDescriptorBindingFlags bindingFlags[BINDLESS_RESOURCE_TYPE_COUNT] = {};
+	VkDescriptorPoolSize poolSizes[BINDLESS_RESOURCE_TYPE_COUNT] = {};
+	for (uint32_t type = 0; type < BINDLESS_RESOURCE_TYPE_COUNT; type++)
+	{
+		outHeap.capacity[type] = std::min(BINDLESS_CAPACITIES[type], limits[type]);
+
+		bindings[type].binding = type;
+		bindings[type].descriptorType = BINDLESS_DESCRIPTOR_TYPES[type];
+		bindings[type].descriptorCount = outHeap.capacity[type];
+		bindings[type].stageFlags = VK_SHADER_STAGE_ALL;
+		bindingFlags[type] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+		poolSizes[type] = { BINDLESS_DESCRIPTOR_TYPES[type], outHeap.capacity[type] };
+	}
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+	bindingFlagsInfo.bindingCount = BINDLESS_RESOURCE_TYPE_COUNT;
+	bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	layoutInfo.pNext = &bindingFlagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = BINDLESS_RESOURCE_TYPE_COUNT;
+	layoutInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &outHeap.layout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create bindless descriptor set layout!");
+
+	VkDescriptorPoolCreateInfo poolInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = BINDLESS_RESOURCE_TYPE_COUNT;
+	poolInfo.pPoolSizes = poolSizes;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &outHeap.pool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create bindless descriptor pool!");
+
+	VkDescriptorSetAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.descriptorPool = outHeap.pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &outHeap.layout;
+
+	if (vkAllocateDescriptorSets(device, &allocInfo, &outHeap.set) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate bindless descriptor set!");
+
+	std::lock_guard<std::mutex> lock(layoutCache.mutex);
+	layoutCache.bindlessSetLayout = outHeap.layout;
+
+	Print("Vulkan: Bindless heap with %i image(s), %i sampler(s) and %i buffer(s)", static_cast<int>(outHeap.capacity[BINDLESS_SAMPLED_IMAGE]),
+		static_cast<int>(outHeap.capacity[BINDLESS_SAMPLER]), static_cast<int>(outHeap.capacity[BINDLESS_STORAGE_BUFFER]));
+}
+
+uint32_t AllocateBindlessHandle(BindlessHeap& heap, BindlessResourceType type)
+{
+	auto& freeHandles = heap.freeHandles[type];
+	if (!freeHandles.empty())
+	{
+		uint32_t handle = freeHandles.back();
+		freeHandles.pop_back();
+		return handle;
+	}
+
+	if (heap.next[type] == heap.capacity[type])
+		throw std::runtime_error("Bindless: heap is full!");
+	return heap.next[type]++;
+}
+
+//	Writes are update-after-bind, so registering while earlier frames are still executing is fine.
+void WriteBindlessDescriptor(const VkDevice& device, const BindlessHeap& heap, BindlessResourceType type, uint32_t handle, const VkDescriptorImageInfo* imageInfo, const VkDescriptorBufferInfo* bufferInfo)
+{
+	VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	write.dstSet = heap.set;
+	write.dstBinding = type;
+	write.dstArrayElement = handle;
+	write.descriptorCount = 1;
+	write.descriptorType = BINDLESS_DESCRIPTOR_TYPES[type];
+	write.pImageInfo = imageInfo;
+	write.pBufferInfo = bufferInfo;
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+uint32_t RegisterBindlessImage(const VkDevice& device, BindlessHeap& heap, VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+{
+	uint32_t handle = AllocateBindlessHandle(heap, BINDLESS_SAMPLED_IMAGE);
+	VkDescriptorImageInfo imageInfo = { VK_NULL_HANDLE, view, layout };
+	WriteBindlessDescriptor(device, heap, BINDLESS_SAMPLED_IMAGE, handle, &imageInfo, nullptr);
+	return handle;
+}
+
+uint32_t RegisterBindlessSampler(const VkDevice& device, BindlessHeap& heap, VkSampler sampler)
+{
+	uint32_t handle = AllocateBindlessHandle(heap, BINDLESS_SAMPLER);
+	VkDescriptorImageInfo imageInfo = { sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED };
+	WriteBindlessDescriptor(device, heap, BINDLESS_SAMPLER, handle, &imageInfo, nullptr);
+	return handle;
+}
+
+uint32_t RegisterBindlessBuffer(const VkDevice& device, BindlessHeap& heap, VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE)
+{
+	uint32_t handle = AllocateBindlessHandle(heap, BINDLESS_STORAGE_BUFFER);
+	VkDescriptorBufferInfo bufferInfo = { buffer, offset, range };
+	WriteBindlessDescriptor(device, heap, BINDLESS_STORAGE_BUFFER, handle, nullptr, &bufferInfo);
+	return handle;
+}
+
+//	The descriptor stays valid until the handle is reused, the resource itself may only be destroyed once the frames
+//	in flight have retired.
+void ReleaseBindlessHandle(BindlessHeap& heap, BindlessResourceType type, uint32_t handle)
+{
+	if (handle != BINDLESS_INVALID_HANDLE)
+		heap.retired.push_back({ type, handle, heap.frame });
+}
+
+//	Call once per frame after the frame's fence has signaled.
+void AdvanceBindlessHeap(BindlessHeap& heap)
+{
+	heap.frame++;
+	while (!heap.retired.empty() && heap.retired.front().frame + MAX_FRAMES_IN_FLIGHT <= heap.frame)
+	{
+		const auto& retired = heap.retired.front();
+		heap.freeHandles[retired.type].push_back(retired.handle);
+		heap.retired.pop_front();
+	}
+}
+
+void BindBindlessHeap(const VkCommandBuffer& cmdBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, const BindlessHeap& heap)
+{
+	vkCmdBindDescriptorSets(cmdBuffer, bindPoint, layout, BINDLESS_DESCRIPTOR_SET, 1, &heap.set, 0, nullptr);
+}
+
+//	Must match Material in shader.frag, materials live in a storage buffer registered with the heap.
+struct BindlessMaterial
+{
+	float baseColor[4];
+};
+
+//	Must match Constants in shader.frag.
+struct BindlessDrawConstants
+{
+	uint32_t materialBuffer;	//	Heap handle of the material buffer.
+	uint32_t material;			//	Index into that buffer.
+	uint32_t virtualTexture;	//	Heap handle of a VirtualTextureInfo buffer, BINDLESS_INVALID_HANDLE for none.
+	uint32_t feedbackBuffer;	//	Heap handle of the frame's virtual texture feedback.
+	uint32_t feedbackWidth;		//	Feedback entries per row.
+	uint32_t feedbackJitter;	//	Pixel of each feedback square that reports, x in the low and y in the high half.
+	uint32_t baseColorTexture;	//	Heap handle of a streamed texture, BINDLESS_INVALID_HANDLE for none.
+	uint32_t baseColorSampler;	//	Heap handle of the streamer's sampler.
+};
+
+void DestroyBindlessHeap(const VkDevice& device, PipelineLayoutCache& layoutCache, BindlessHeap& heap)
+{
+	if (layoutCache.bindlessSetLayout == heap.layout)
+		layoutCache.bindlessSetLayout = VK_NULL_HANDLE;
+
+	vkDestroyDescriptorPool(device, heap.pool, nullptr);
+	vkDestroyDescriptorSetLayout(device, heap.layout, nullptr);
+	heap = BindlessHeap();
+}
+
+// Texture Streaming
+//	Streamed textures load with their mip tail resident and refine one level at a time toward the finest level
+//	asked for, from distance or from shader feedback. Levels are read from the KTX2 file on a worker thread and
+//	kept on the CPU. The texture's image is recreated for its new level range and registered under a new bindless
+//	handle, so look the handle up every frame, after UpdateTextureStreaming. Uploads are capped per frame. When streamed memory outgrows the
+//	budget, the least recently requested textures give up their finest level first. The budget follows
+//	VK_EXT_memory_budget when the device has it and textureStreamingBudget otherwise.
+const uint32_t TEXTURE_STREAMING_TAIL_SIZE = 64;			//	Levels this size and smaller load with the texture.
+const uint64_t TEXTURE_STREAMING_IDLE_FRAMES = 120;			//	Unrequested for this long, a texture falls back to its tail.
+const float TEXTURE_STREAMING_BUDGET_FRACTION = 0.8f;		//	Share of the device local heap's budget streaming may fill.
+const size_t TEXTURE_STREAMING_MAX_READS = 8;
+
+struct StreamedTexture
+{
+	std::string path;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkExtent2D extent = {};
+	std::vector<Ktx2LevelIndex> levels;
+	std::vector<std::vector<char>> levelData;	//	Filled from loadedMip to the last level.
+	uint32_t tailMip = 0;						//	Coarsest level of the range that never leaves.
+	uint32_t loadedMip = 0;						//	Finest level on the CPU.
+	uint32_t residentMip = 0;					//	Finest level of the image.
+	uint32_t requestedMip = UINT32_MAX;			//	Finest level asked for since the last update.
+	uint32_t desiredMip = 0;
+	uint64_t lastRequestFrame = 0;
+	bool readPending = false;
+	bool failed = false;						//	A read failed, the texture stays at what it has.
+	Texture texture;
+	uint32_t handle = BINDLESS_INVALID_HANDLE;
+	VkDeviceSize residentBytes = 0;
+};
+
+struct TextureStreamer
+{
+	struct Read
+	{
+		uint32_t texture;
+		uint32_t mip;
+		std::string path;
+		uint64_t offset;
+		uint64_t size;
+		std::vector<char> data;
+		bool failed;
+	};
+
+	struct Retired
+	{
+		Texture texture;
+		uint64_t frame;
+	};
+
+	std::vector<StreamedTexture> textures;
+	std::deque<Read> pendingReads;		//	pendingReads and completedReads are guarded by mutex.
+	std::vector<Read> completedReads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::atomic<bool> running{ false };
+	std::thread worker;
+	std::deque<Retired> retired;
+	VkSampler sampler = VK_NULL_HANDLE;
+	uint32_t samplerHandle = BINDLESS_INVALID_HANDLE;
+	uint64_t frame = 0;
+	uint32_t memoryHeap = 0;			//	The device local heap the budget is read for.
+	VkDeviceSize residentBytes = 0;
+	VkDeviceSize uploadedBytes = 0;		//	This frame.
+};
+
+void StreamTextureReads(TextureStreamer& streamer)
+{
+	while (true)
+	{
+		TextureStreamer::Read read;
+		{
+			std::unique_lock<std::mutex> lock(streamer.mutex);
+			streamer.wake.wait(lock, [&]() { return !streamer.running || !streamer.pendingReads.empty(); });
+			if (!streamer.running)
+				return;
+
+			read = std::move(streamer.pendingReads.front());
+			streamer.pendingReads.pop_front();
+		}
+
+		std::ifstream file(read.path, std::ios::binary);
+		read.data.resize(static_cast<size_t>(read.size));
+		file.seekg(read.offset);
+		read.failed = !file.read(read.data.data(), read.data.size());
+
+		std::lock_guard<std::mutex> lock(streamer.mutex);
+		streamer.completedReads.push_back(std::move(read));
+	}
+}
+
+void CreateTextureStreamer(const VkPhysicalDevice& physicalDevice, const VkDevice& device, BindlessHeap& heap, TextureStreamer& outStreamer)
+{
+	//	The image only holds the resident levels, so its mip 0 is whatever is resident and lod needs no clamp.
+	VkSamplerCreateInfo samplerInfo{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &outStreamer.sampler) != VK_SUCCESS)
+		throw std::runtime_error("failed to create texture streaming sampler!");
+	outStreamer.samplerHandle = RegisterBindlessSampler(device, heap, outStreamer.sampler);
+
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	VkDeviceSize largestHeap = 0;
+	for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++)
+	{
+		const auto& candidate = memoryProperties.memoryHeaps[heap];
+		if ((candidate.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && candidate.size > largestHeap)
+		{
+			outStreamer.memoryHeap = heap;
+			largestHeap = candidate.size;
+		}
+	}
+
+	outStreamer.running = true;
+	outStreamer.worker = std::thread(StreamTextureReads, std::ref(outStreamer));
+}
+
+//	What streamed textures may use. Memory the rest of the process or other processes allocate on the heap
+//	shrinks it, our own streamed images do not count against it.
+VkDeviceSize GetTextureStreamingBudget(const VkPhysicalDevice& physicalDevice, const TextureStreamer& streamer)
+{
+	if (!memoryBudgetEnabled)
+		return textureStreamingBudget;
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+	VkPhysicalDeviceMemoryProperties2 properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2 };
+	properties.pNext = &budgetProperties;
+	vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+
+	VkDeviceSize budget = static_cast<VkDeviceSize>(budgetProperties.heapBudget[streamer.memoryHeap] * TEXTURE_STREAMING_BUDGET_FRACTION);
+	VkDeviceSize otherUsage = budgetProperties.heapUsage[streamer.memoryHeap] - std::min(budgetProperties.heapUsage[streamer.memoryHeap], streamer.residentBytes);
+	return budget > otherUsage ? budget - otherUsage : 0;
+}
+
+//	Replaces the texture's image with one holding levels mip to the last. Levels finer than mip leave the CPU too.
+void RebuildStreamedTexture(const VkPhysicalDevice& physicalDevice, const VkDevice& device, UploadEngine& uploadEngine, BindlessHeap& heap, TextureStreamer& streamer, StreamedTexture& texture, uint32_t mip)
+{
+	TextureData data;
+	data.format = texture.format;
+	data.extent = { std::max(1u, texture.extent.width >> mip), std::max(1u, texture.extent.height >> mip) };
+	for (uint32_t level = mip; level < texture.levels.size(); level++)
+	{
+		VkDeviceSize offset = AddTextureMip(data, texture.levelData[level].size());
+		memcpy(data.data.data() + offset, texture.levelData[level].data(), texture.levelData[level].size());
+	}
+
+	Texture image;
+	CreateVulkanTexture(physicalDevice, device, uploadEngine, data, false, image);
+	streamer.uploadedBytes += data.data.size();
+
+	if (texture.texture.image != VK_NULL_HANDLE)
+		streamer.retired.push_back({ texture.texture, streamer.frame });
+	ReleaseBindlessHandle(heap, BINDLESS_SAMPLED_IMAGE, texture.handle);
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, image.image, &memRequirements);
+	streamer.residentBytes = streamer.residentBytes - texture.residentBytes + memRequirements.size;
+
+	texture.texture = image;
+	texture.handle = RegisterBindlessImage(device, heap, image.view);
+	texture.residentBytes = memRequirements.size;
+	texture.residentMip = mip;
+
+	for (uint32_t level = texture.loadedMip; level < mip; level++)
+		std::vector<char>().swap(texture.levelData[level]);
+	texture.loadedMip = std::max(texture.loadedMip, mip);
+}
+
+//	Only plain KTX2 files stream, supercompressed ones have to go through LoadKtx2TextureData. The mip tail is read
+//	and uploaded right away, so the texture can be drawn as soon as the uploads are flushed.
+uint32_t AddStreamedTexture(const VkPhysicalDevice& physicalDevice, const VkDevice& device, UploadEngine& uploadEngine, BindlessHeap& heap, TextureStreamer& streamer, const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	Ktx2Header header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		throw std::runtime_error("Texture Streaming: " + path + " is not a KTX2 file!");
+	if (header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1 || header.levelCount == 0)
+		throw std::runtime_error("Texture Streaming: only 2D KTX2 textures with mips can stream!");
+	if (header.supercompressionScheme != KTX2_SUPERCOMPRESSION_NONE || header.vkFormat == VK_FORMAT_UNDEFINED)
+		throw std::runtime_error("Texture Streaming: supercompressed KTX2 files cannot stream!");
+	if (!IsVulkanFormatSampled(physicalDevice, static_cast<VkFormat>(header.vkFormat)))
+		throw std::runtime_error("Texture Streaming: the device cannot sample the KTX2 file's format!");
+
+	StreamedTexture texture;
+	texture.path = path;
+	texture.format = static_cast<VkFormat>(header.vkFormat);
+	texture.extent = { header.pixelWidth, header.pixelHeight };
+	texture.levels.resize(header.levelCount);
+	texture.levelData.resize(header.levelCount);
+	if (!file.read(reinterpret_cast<char*>(texture.levels.data()), texture.levels.size() * sizeof(Ktx2LevelIndex)))
+		throw std::runtime_error("Texture Streaming: truncated KTX2 file!");
+
+	texture.tailMip = header.levelCount - 1;
+	while (texture.tailMip > 0 && std::max(texture.extent.width >> (texture.tailMip - 1), texture.extent.height >> (texture.tailMip - 1)) <= TEXTURE_STREAMING_TAIL_SIZE)
+		texture.tailMip--;
+
+	for (uint32_t level = texture.tailMip; level < header.levelCount; level++)
+	{
+		texture.levelData[level].resize(static_cast<size_t>(texture.levels[level].byteLength));
+		file.seekg(texture.levels[level].byteOffset);
+		if (!file.read(texture.levelData[level].data(), texture.levelData[level].size()))
+			throw std::runtime_error("Texture Streaming: truncated KTX2 level!");
+	}
+	texture.loadedMip = texture.tailMip;
+	texture.desiredMip = texture.tailMip;
+
+	RebuildStreamedTexture(physicalDevice, device, uploadEngine, heap, streamer, texture, texture.tailMip);
+	streamer.textures.push_back(std::move(texture));
+	return static_cast<uint32_t>(streamer.textures.size() - 1);
+}
+
+uint32_t GetStreamedTextureHandle(const TextureStreamer& streamer, uint32_t texture)
+{
+	return streamer.textures[texture].handle;
+}
+
+//	Feedback passes report the mip they sampled, the finest request since the last update wins.
+void RequestStreamedTextureMip(TextureStreamer& streamer, uint32_t texture, uint32_t mip)
+{
+	auto& streamed = streamer.textures[texture];
+	streamed.requestedMip = std::min(streamed.requestedMip, mip);
+	streamed.lastRequestFrame = streamer.frame;
+}
+
+//	Distance based requests, screenSize is how many pixels the texture's width or height covers on screen.
+void RequestStreamedTextureSize(TextureStreamer& streamer, uint32_t texture, float screenSize)
+{
+	const auto& streamed = streamer.textures[texture];
+	float texels = static_cast<float>(std::max(streamed.extent.width, streamed.extent.height));
+	float mip = screenSize > 0.0f ? std::floor(std::log2(texels / screenSize)) : FLT_MAX;
+	RequestStreamedTextureMip(streamer, texture, static_cast<uint32_t>(clamp(mip, 0.0f, static_cast<float>(streamed.tailMip))));
+}
+
+//	Requests what the largest visible instance needs. Instances are placed in clip space and the texture spans one
+//	unit of the mesh's xy plane, see fragTexCoord in shader.vert, so it covers half the instance's scale of the
+//	viewport. With nothing visible the texture is not requested and drops back to its tail once idle.
+void RequestStreamedTextureInstances(TextureStreamer& streamer, uint32_t texture, const std::vector<InstanceData>& instances, const std::vector<uint8_t>& visibility, VkExtent2D viewport)
+{
+	float viewportSize = static_cast<float>(std::max(viewport.width, viewport.height));
+	float screenSize = 0.0f;
+	for (size_t i = 0; i < instances.size(); i++)
+		if (visibility[i])
+			screenSize = std::max(screenSize, instances[i].scale * 0.5f * viewportSize);
+
+	if (screenSize > 0.0f)
+		RequestStreamedTextureSize(streamer, texture, screenSize);
+}
+
+//	Call once per frame after the frame's fence has signaled, then flush the upload engine.
+void UpdateTextureStreaming(const VkPhysicalDevice& physicalDevice, const VkDevice& device, UploadEngine& uploadEngine, BindlessHeap& heap, TextureStreamer& streamer)
+{
+	streamer.frame++;
+	streamer.uploadedBytes = 0;
+	while (!streamer.retired.empty() && streamer.retired.front().frame + MAX_FRAMES_IN_FLIGHT <= streamer.frame)
+	{
+		DestroyVulkanTexture(device, streamer.retired.front().texture);
+		streamer.retired.pop_front();
+	}
+
+	std::vector<TextureStreamer::Read> completedReads;
+	{
+		std::lock_guard<std::mutex> lock(streamer.mutex);
+		completedReads.swap(streamer.completedReads);
+	}
+	for (auto& read : completedReads)
+	{
+		auto& texture = streamer.textures[read.texture];
+		texture.readPending = false;
+		if (read.failed)
+		{
+			Print("Texture Streaming: failed to read mip %i of %s", static_cast<int>(read.mip), read.path.c_str());
+			texture.failed = true;
+			continue;
+		}
+
+		//	An eviction while the read was in flight may have dropped the level above it, the CPU levels have to
+		//	stay contiguous.
+		if (read.mip + 1 != texture.loadedMip)
+			continue;
+
+		texture.levelData[read.mip] = std::move(read.data);
+		texture.loadedMip = std::min(texture.loadedMip, read.mip);
+	}
+
+	//	A request since the last update replaces the desired level, a texture nobody asked for in a while only
+	//	needs its tail.
+	for (auto& texture : streamer.textures)
+	{
+		if (texture.requestedMip != UINT32_MAX)
+			texture.desiredMip = std::min(texture.requestedMip, texture.tailMip);
+		else if (texture.lastRequestFrame + TEXTURE_STREAMING_IDLE_FRAMES < streamer.frame)
+			texture.desiredMip = texture.tailMip;
+		texture.requestedMip = UINT32_MAX;
+	}
+
+	auto canUpload = [&](VkDeviceSize bytes) { return streamer.uploadedBytes == 0 || streamer.uploadedBytes + bytes <= textureUploadBudget; };
+	auto getUploadBytes = [](const StreamedTexture& texture, uint32_t mip)
+	{
+		VkDeviceSize bytes = 0;
+		for (uint32_t level = mip; level < texture.levels.size(); level++)
+			bytes += texture.levels[level].byteLength;
+		return bytes;
+	};
+
+	//	Textures that need less give their levels back right away, the budget is enforced on whatever is still requested.
+	VkDeviceSize budget = GetTextureStreamingBudget(physicalDevice, streamer);
+	std::vector<uint32_t> order(streamer.textures.size());
+	for (uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return streamer.textures[a].lastRequestFrame < streamer.textures[b].lastRequestFrame; });
+
+	for (uint32_t index : order)
+	{
+		auto& texture = streamer.textures[index];
+		bool unneeded = texture.desiredMip > texture.residentMip;
+		if (texture.residentMip < texture.tailMip && (unneeded || streamer.residentBytes > budget))
+		{
+			uint32_t mip = unneeded ? texture.desiredMip : texture.residentMip + 1;
+			if (!canUpload(getUploadBytes(texture, mip)))
+				break;
+
+			RebuildStreamedTexture(physicalDevice, device, uploadEngine, heap, streamer, texture, mip);
+			texture.desiredMip = std::max(texture.desiredMip, mip);
+		}
+	}
+
+	//	The most recently requested textures with the furthest to go refine first, one level per rebuild.
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+	{
+		const auto& first = streamer.textures[a];
+		const auto& second = streamer.textures[b];
+		if (first.lastRequestFrame != second.lastRequestFrame)
+			return first.lastRequestFrame > second.lastRequestFrame;
+		return static_cast<int64_t>(first.residentMip) - first.desiredMip > static_cast<int64_t>(second.residentMip) - second.desiredMip;
+	});
+
+	size_t pendingReads = std::count_if(streamer.textures.begin(), streamer.textures.end(), [](const StreamedTexture& texture) { return texture.readPending; });
+	bool queuedReads = false;
+	for (uint32_t index : order)
+	{
+		auto& texture = streamer.textures[index];
+		if (texture.desiredMip >= texture.residentMip || texture.failed)
+			continue;
+
+		uint32_t mip = texture.residentMip - 1;
+		if (texture.loadedMip <= mip)
+		{
+			VkDeviceSize growth = texture.levels[mip].byteLength;
+			if (streamer.residentBytes + growth <= budget && canUpload(getUploadBytes(texture, mip)))
+				RebuildStreamedTexture(physicalDevice, device, uploadEngine, heap, streamer, texture, mip);
+		}
+		else if (!texture.readPending && pendingReads < TEXTURE_STREAMING_MAX_READS && streamer.residentBytes + texture.levels[mip].byteLength <= budget)
+		{
+			std::lock_guard<std::mutex> lock(streamer.mutex);
+			streamer.pendingReads.push_back({ index, mip, texture.path, texture.levels[mip].byteOffset, texture.levels[mip].byteLength, {}, false });
+			texture.readPending = true;
+			pendingReads++;
+			queuedReads = true;
+		}
+	}
+
+	if (queuedReads)
+		streamer.wake.notify_one();
+}
+
+void DestroyTextureStreamer(const VkDevice& device, BindlessHeap& heap, TextureStreamer& streamer)
+{
+	{
+		std::lock_guard<std::mutex> lock(streamer.mutex);
+		streamer.running = false;
+	}
+	streamer.wake.notify_one();
+	if (streamer.worker.joinable())
+		streamer.worker.join();
+
+	for (auto& texture : streamer.textures)
+	{
+		ReleaseBindlessHandle(heap, BINDLESS_SAMPLED_IMAGE, texture.handle);
+		DestroyVulkanTexture(device, texture.texture);
+	}
+	for (auto& retired : streamer.retired)
+		DestroyVulkanTexture(device, retired.texture);
+
+	ReleaseBindlessHandle(heap, BINDLESS_SAMPLER, streamer.samplerHandle);
+	vkDestroySampler(device, streamer.sampler, nullptr);
+	streamer.sampler = VK_NULL_HANDLE;
+	streamer.samplerHandle = BINDLESS_INVALID_HANDLE;
+
+	streamer.textures.clear();
+	streamer.retired.clear();
+	streamer.pendingReads.clear();
+	streamer.completedReads.clear();
+	streamer.residentBytes = 0;
+}
+
+// Shader Permutations
+enum ShaderConstantId : uint32_t
+{
+	SHADER_CONSTANT_SHADING_MODE = 0,
+};
+
+enum ShadingMode : uint32_t
+{
+	SHADING_MODE_VERTEX_COLOR = 0,
+	SHADING_MODE_UNLIT_WHITE = 1,
+};
+
+//	Specialization constant values keyed by constant_id, every permutation shares the same SPIR-V binaries.
+struct ShaderPermutation
+{
+	std::map<uint32_t, uint32_t> constants;
+
+	std::string Key() const
+	{
+		std::string key;
+		for (const auto& [id, value] : constants)
+			key += std::to_string(id) + "=" + std::to_string(value) + ";";
+		return key;
+	}
+};
+
+struct SpecializationData
+{
+	std::vector<VkSpecializationMapEntry> entries;
+	std::vector<uint32_t> values;
+	VkSpecializationInfo info{};
+};
+
+//	Only the constants a stage actually declares are forwarded to it.
+void BuildVulkanSpecializationInfo(const ShaderPermutation& permutation, const ShaderReflection& reflection, SpecializationData& outData)
+{
+	outData.entries.clear();
+	outData.values.clear();
+
+	for (const auto& [id, value] : permutation.constants)
+	{
+		if (!reflection.specializationConstants.count(id))
+			continue;
+
+		outData.entries.push_back({ id, static_cast<uint32_t>(outData.values.size() * sizeof(uint32_t)), sizeof(uint32_t) });
+		outData.values.push_back(value);
+	}
+
+	outData.info.mapEntryCount = static_cast<uint32_t>(outData.entries.size());
+	outData.info.pMapEntries = outData.entries.data();
+	outData.info.dataSize = outData.values.size() * sizeof(uint32_t);
+	outData.info.pData = outData.values.data();
+}
+
+// Graphics Pipeline State
+enum DepthMode : uint8_t
+{
+	DEPTH_MODE_DISABLED = 0,
+	DEPTH_MODE_WRITE,	//	LESS test, writes depth.
+	DEPTH_MODE_EQUAL,	//	EQUAL test against the depth laid down by a prepass, no writes.
+};
+
+//	Everything besides the vertex format and permutation a graphics pipeline is built from.
+struct GraphicsPipelineState
+{
+	std::string vertexShader = "Shaders/SPIR-V/vert.spv";
+	std::string fragmentShader = "Shaders/SPIR-V/frag.spv";	//	Empty for depth only pipelines.
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	uint32_t subpass = 0;
+	DepthMode depthMode = DEPTH_MODE_DISABLED;
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+
+	std::string Key() const
+	{
+		return vertexShader + "|" + fragmentShader + "|" + std::to_string(reinterpret_cast<uint64_t>(renderPass)) + "|" + std::to_string(subpass) + "|" + std::to_string(depthMode) + "|" + std::to_string(samples);
+	}
+};
+
+void CreateVulkanGraphicsPipeline(const VkDevice& device, const VkExtent2D& swapchainExtent, const GraphicsPipelineState& state, PipelineLayoutCache& layoutCache, const VertexFormat& vertexFormat, const ShaderPermutation& permutation, const VkPipelineCache& pipelineCache, VkPipelineLayout& outPipelineLayout, VkPipeline& outGraphicsPipeline)
+{
+	bool depthOnly = state.fragmentShader.empty();
+
+	auto vertShaderCode = ReadFile(state.vertexShader);
+	auto fragShaderCode = depthOnly ? std::vector<char>() : ReadFile(state.fragmentShader);
+
+	ShaderReflection vertReflection = ReflectVulkanShaderModule(vertShaderCode);
+	ShaderReflection fragReflection = depthOnly ? ShaderReflection() : ReflectVulkanShaderModule(fragShaderCode);
+
+	ShaderReflection reflection = vertReflection;
+	if (!depthOnly)
+		MergeShaderReflection(reflection, fragReflection);
+
+	for (const auto& [id, value] : permutation.constants)
+		if (!reflection.specializationConstants.count(id))
+			Print("Vulkan: Shader permutation constant %i is not declared by any stage", static_cast<int>(id));
+
+	SpecializationData vertSpecialization, fragSpecialization;
+	BuildVulkanSpecializationInfo(permutation, vertReflection, vertSpecialization);
+	BuildVulkanSpecializationInfo(permutation, fragReflection, fragSpecialization);
+
+	auto vertShaderModule = CreateVulkanShaderModule(device, vertShaderCode);
+	auto fragShaderModule = depthOnly ? VK_NULL_HANDLE : CreateVulkanShaderModule(device, fragShaderCode);
+
+	VkPipelineShaderStageCreateInfo vertShaderStageInfo{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vertShaderStageInfo.module = vertShaderModule;
+	vertShaderStageInfo.pName = "main";
+	vertShaderStageInfo.pSpecializationInfo = vertSpecialization.entries.empty() ? nullptr : &vertSpecialization.info;
+
+	VkPipelineShaderStageCreateInfo fragShaderStageInfo{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	fragShaderStageInfo.module = fragShaderModule;
+	fragShaderStageInfo.pName = "main";
+	fragShaderStageInfo.pSpecializationInfo = fragSpecialization.entries.empty() ? nullptr : &fragSpecialization.info;
+
+	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+
+	//	Bindings follow the mesh's vertex format, attributes are limited to the inputs the vertex shader consumes.
+	std::vector<VkVertexInputBindingDescription> vertexBindings;
+	std::vector<VkVertexInputAttributeDescription> formatAttributes, vertexAttributes;
+	GetVulkanVertexInputDescriptions(vertexFormat, vertexBindings, formatAttributes);
+
+	for (const auto& input : reflection.vertexInputs)
+	{
+		auto it = std::find_if(formatAttributes.begin(), formatAttributes.end(), [&](const VkVertexInputAttributeDescription& attribute) { return attribute.location == input.location; });
+		if (it == formatAttributes.end() || it->format != input.format)
+			throw std::runtime_error("Vulkan: Vertex format does not provide input location " + std::to_string(input.location));
+		vertexAttributes.push_back(*it);
+	}
+
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexBindings.size());
+	vertexInputInfo.pVertexBindingDescriptions = vertexBindings.data();
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexAttributes.size());
+	vertexInputInfo.pVertexAttributeDescriptions = vertexAttributes.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	VkViewport viewport{};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)swapchainExtent.width;
+	viewport.height = (float)swapchainExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor{};
+	scissor.offset = { 0, 0 };
+	scissor.extent = swapchainExtent;
+
+	VkPipelineViewportStateCreateInfo viewportState{};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = &viewport;
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = &scissor;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer{};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.depthClampEnable = VK_FALSE;
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	rasterizer.depthBiasEnable = VK_FALSE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling{};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.sampleShadingEnable = VK_FALSE;
+	multisampling.rasterizationSamples = state.samples;
+
+	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachment.blendEnable = VK_FALSE;
+
+	VkPipelineColorBlendStateCreateInfo colorBlending{};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.logicOp = VK_LOGIC_OP_COPY;
+	colorBlending.attachmentCount = depthOnly ? 0 : 1;
+	colorBlending.pAttachments = &colorBlendAttachment;
+	colorBlending.blendConstants[0] = 0.0f;
+	colorBlending.blendConstants[1] = 0.0f;
+	colorBlending.blendConstants[2] = 0.0f;
+	colorBlending.blendConstants[3] = 0.0f;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencil{ VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+	depthStencil.depthTestEnable = state.depthMode != DEPTH_MODE_DISABLED;
+	depthStencil.depthWriteEnable = state.depthMode == DEPTH_MODE_WRITE;
+	depthStencil.depthCompareOp = state.depthMode == DEPTH_MODE_EQUAL ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+	depthStencil.depthBoundsTestEnable = VK_FALSE;
+	depthStencil.stencilTestEnable = VK_FALSE;
+
+	outPipelineLayout = GetCachedPipelineLayout(device, layoutCache, reflection);
+
+	VkGraphicsPipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = depthOnly ? 1 : 2;
+	pipelineInfo.pStages = shaderStages;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.layout = outPipelineLayout;
+	pipelineInfo.renderPass = state.renderPass;
+	pipelineInfo.subpass = state.subpass;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &outGraphicsPipeline) != VK_SUCCESS)
+		throw std::runtime_error("failed to create graphics pipeline!");
+
+	if (!depthOnly)
+		vkDestroyShaderModule(device, fragShaderModule, nullptr);
+	vkDestroyShaderModule(device, vertShaderModule, nullptr);
+}
+
+void CreateVulkanComputePipeline(const VkDevice& device, const std::string& shader, PipelineLayoutCache& layoutCache, const ShaderPermutation& permutation, const VkPipelineCache& pipelineCache, VkPipelineLayout& outPipelineLayout, VkPipeline& outComputePipeline)
+{
+	auto shaderCode = ReadFile(shader);
+	ShaderReflection reflection = ReflectVulkanShaderModule(shaderCode);
+
+	SpecializationData specialization;
+	BuildVulkanSpecializationInfo(permutation, reflection, specialization);
+
+	auto shaderModule = CreateVulkanShaderModule(device, shaderCode);
+
+	outPipelineLayout = GetCachedPipelineLayout(device, layoutCache, reflection);
+
+	VkComputePipelineCreateInfo pipelineInfo{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	pipelineInfo.stage = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.stage.pSpecializationInfo = specialization.entries.empty() ? nullptr : &specialization.info;
+	pipelineInfo.layout = outPipelineLayout;
+
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &outComputePipeline) != VK_SUCCESS)
+		throw std::runtime_error("failed to create compute pipeline!");
+
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+}
+
+// Graphics Pipeline Cache
+struct GraphicsPipelineCache
+{
+	struct Entry
+	{
+		VkPipelineLayout layout = VK_NULL_HANDLE;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+	};
+
+	VkPipelineCache vkPipelineCache = VK_NULL_HANDLE;
+	std::map<std::string, Entry> entries;
+	std::mutex mutex;
+};
+
+void CreateVulkanPipelineCache(const VkDevice& device, GraphicsPipelineCache& outCache)
+{
+	VkPipelineCacheCreateInfo cacheInfo{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &outCache.vkPipelineCache) != VK_SUCCESS)
+		throw std::runtime_error("failed to create pipeline cache!");
+}
+
+GraphicsPipelineCache::Entry& GetVulkanGraphicsPipelinePermutation(const VkDevice& device, const VkExtent2D& swapchainExtent, const GraphicsPipelineState& state, PipelineLayoutCache& layoutCache, GraphicsPipelineCache& pipelineCache, const VertexFormat& vertexFormat, const ShaderPermutation& permutation)
+{
+	std::string key = state.Key() + "|" + std::to_string(vertexFormat.Key()) + "|" + permutation.Key();
+
+	std::lock_guard<std::mutex> lock(pipelineCache.mutex);
+	auto it = pipelineCache.entries.find(key);
+	if (it != pipelineCache.entries.end())
+		return it->second;
+
+	GraphicsPipelineCache::Entry entry;
+	CreateVulkanGraphicsPipeline(device, swapchainExtent, state, layoutCache, vertexFormat, permutation, pipelineCache.vkPipelineCache, entry.layout, entry.pipeline);
+
+	Print("Vulkan: Created graphics pipeline permutation [%s]", permutation.Key().c_str());
+	return pipelineCache.entries[key] = entry;
+}
+
+GraphicsPipelineCache::Entry& GetVulkanComputePipelinePermutation(const VkDevice& device, const std::string& shader, PipelineLayoutCache& layoutCache, GraphicsPipelineCache& pipelineCache, const ShaderPermutation& permutation)
+{
+	std::string key = "compute|" + shader + "|" + permutation.Key();
+
+	std::lock_guard<std::mutex> lock(pipelineCache.mutex);
+	auto it = pipelineCache.entries.find(key);
+	if (it != pipelineCache.entries.end())
+		return it->second;
+
+	GraphicsPipelineCache::Entry entry;
+	CreateVulkanComputePipeline(device, shader, layoutCache, permutation, pipelineCache.vkPipelineCache, entry.layout, entry.pipeline);
+
+	Print("Vulkan: Created compute pipeline %s [%s]", shader.c_str(), permutation.Key().c_str());
+	return pipelineCache.entries[key] = entry;
+}
+
+//	Pipeline layouts are owned by the layout cache.
+void DestroyGraphicsPipelineCache(const VkDevice& device, GraphicsPipelineCache& cache)
+{
+	for (const auto& [key, entry] : cache.entries)
+		vkDestroyPipeline(device, entry.pipeline, nullptr);
+
+	cache.entries.clear();
+	vkDestroyPipelineCache(device, cache.vkPipelineCache, nullptr);
+	cache.vkPipelineCache = VK_NULL_HANDLE;
+}
+
+// Resource State Tracking
+//	Keeps the last known stage, access and layout of every image and buffer. Requesting a new state queues only the
+//	barrier that state needs, nothing if the resource is already usable that way, and FlushResourceBarriers records
+//	all queued barriers in one call. With synchronization2 every barrier keeps its own stage masks.
+const VkAccessFlags WRITE_ACCESS_MASK = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+	VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+struct ResourceState
+{
+	VkPipelineStageFlags writeStages = 0;
+	VkAccessFlags writeAccess = 0;
+	VkPipelineStageFlags readStages = 0;
+	VkAccessFlags readAccess = 0;
+	VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+//	Buffers have no image and are folded into a single global memory barrier.
+struct ResourceBarrier
+{
+	VkImage image;
+	VkImageAspectFlags aspectMask;
+	VkPipelineStageFlags srcStageMask;
+	VkPipelineStageFlags dstStageMask;
+	VkAccessFlags srcAccessMask;
+	VkAccessFlags dstAccessMask;
+	VkImageLayout oldLayout;
+	VkImageLayout newLayout;
+};
+
+struct ResourceStateTracker
+{
+	std::map<uint64_t, ResourceState> states;
+	std::vector<ResourceBarrier> pending;
+};
+
+uint64_t GetResourceKey(VkImage image) { return (uint64_t)image; }
+uint64_t GetResourceKey(VkBuffer buffer) { return (uint64_t)buffer; }
+
+void RequireResourceState(ResourceStateTracker& tracker, uint64_t key, VkImage image, VkImageAspectFlags aspectMask, VkPipelineStageFlags stageMask, VkAccessFlags accessMask, VkImageLayout layout)
+{
+	ResourceState& state = tracker.states[key];
+	bool write = (accessMask & WRITE_ACCESS_MASK) != 0;
+	bool transition = image != VK_NULL_HANDLE && layout != state.layout;
+	VkPipelineStageFlags srcStageMask = 0;
+	VkAccessFlags srcAccessMask = 0;
+
+	if (write || transition)
+	{
+		//	Write after read only needs an execution dependency, after a write the data must be made available too.
+		//	A layout transition counts as a write for everything that follows it.
+		srcStageMask = state.writeStages | state.readStages;
+		srcAccessMask = state.writeAccess;
+
+		state.writeStages = stageMask;
+		state.writeAccess = accessMask & WRITE_ACCESS_MASK;
+		state.readStages = write ? 0 : stageMask;
+		state.readAccess = write ? 0 : accessMask;
+	}
+	else
+	{
+		//	Reads of the same write only wait for it in stages and accesses it is not visible to yet.
+		if ((stageMask & ~state.readStages) || (accessMask & ~state.readAccess))
+		{
+			srcStageMask = state.writeStages;
+			srcAccessMask = state.writeAccess;
+		}
+
+		state.readStages |= stageMask;
+		state.readAccess |= accessMask;
+	}
+
+	if (srcStageMask == 0 && !transition)
+		return;
+
+	tracker.pending.push_back({ image, aspectMask, srcStageMask, stageMask, srcAccessMask, accessMask, state.layout, image != VK_NULL_HANDLE ? layout : state.layout });
+	state.layout = image != VK_NULL_HANDLE ? layout : state.layout;
+}
+
+void RequireImageState(ResourceStateTracker& tracker, VkImage image, VkImageAspectFlags aspectMask, VkPipelineStageFlags stageMask, VkAccessFlags accessMask, VkImageLayout layout)
+{
+	RequireResourceState(tracker, GetResourceKey(image), image, aspectMask, stageMask, accessMask, layout);
+}
+
+void RequireBufferState(ResourceStateTracker& tracker, VkBuffer buffer, VkPipelineStageFlags stageMask, VkAccessFlags accessMask)
+{
+	RequireResourceState(tracker, GetResourceKey(buffer), VK_NULL_HANDLE, 0, stageMask, accessMask, VK_IMAGE_LAYOUT_UNDEFINED);
+}
+
+void FlushResourceBarriers(ResourceStateTracker& tracker, const VkCommandBuffer& cmdBuffer)
+{
+	if (tracker.pending.empty())
+		return;
+
+#ifdef VK_KHR_synchronization2
+	if (_vkCmdPipelineBarrier2KHR != nullptr)
+	{
+		std::vector<VkImageMemoryBarrier2KHR> imageBarriers;
+		VkMemoryBarrier2KHR memoryBarrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR };
+
+		for (const auto& barrier : tracker.pending)
+		{
+			if (barrier.image == VK_NULL_HANDLE)
+			{
+				memoryBarrier.srcStageMask |= barrier.srcStageMask;
+				memoryBarrier.dstStageMask |= barrier.dstStageMask;
+				memoryBarrier.srcAccessMask |= barrier.srcAccessMask;
+				memoryBarrier.dstAccessMask |= barrier.dstAccessMask;
+				continue;
+			}
+
+			VkImageMemoryBarrier2KHR imageBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR };
+			imageBarrier.srcStageMask = barrier.srcStageMask;
+			imageBarrier.srcAccessMask = barrier.srcAccessMask;
+			imageBarrier.dstStageMask = barrier.dstStageMask;
+			imageBarrier.dstAccessMask = barrier.dstAccessMask;
+			imageBarrier.oldLayout = barrier.oldLayout;
+			imageBarrier.newLayout = barrier.newLayout;
+			imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.image = barrier.image;
+			imageBarrier.subresourceRange = { barrier.aspectMask, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+			imageBarriers.push_back(imageBarrier);
+		}
+
+		VkDependencyInfoKHR dependencyInfo{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR };
+		dependencyInfo.memoryBarrierCount = memoryBarrier.srcStageMask || memoryBarrier.dstStageMask ? 1 : 0;
+		dependencyInfo.pMemoryBarriers = &memoryBarrier;
+		dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+		dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+
+		_vkCmdPipelineBarrier2KHR(cmdBuffer, &dependencyInfo);
+		tracker.pending.clear();
+		return;
+	}
+#endif
+
+	//	Without synchronization2 the batch waits on the union of all source stages.
+	VkPipelineStageFlags srcStageMask = 0, dstStageMask = 0;
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	VkMemoryBarrier memoryBarrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	bool hasMemoryBarrier = false;
+
+	for (const auto& barrier : tracker.pending)
+	{
+		srcStageMask |= barrier.srcStageMask;
+		dstStageMask |= barrier.dstStageMask;
+
+		if (barrier.image == VK_NULL_HANDLE)
+		{
+			memoryBarrier.srcAccessMask |= barrier.srcAccessMask;
+			memoryBarrier.dstAccessMask |= barrier.dstAccessMask;
+			hasMemoryBarrier = true;
+			continue;
+		}
+
+		VkImageMemoryBarrier imageBarrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		imageBarrier.srcAccessMask = barrier.srcAccessMask;
+		imageBarrier.dstAccessMask = barrier.dstAccessMask;
+		imageBarrier.oldLayout = barrier.oldLayout;
+		imageBarrier.newLayout = barrier.newLayout;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = barrier.image;
+		imageBarrier.subresourceRange = { barrier.aspectMask, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+		imageBarriers.push_back(imageBarrier);
+	}
+
+	vkCmdPipelineBarrier(cmdBuffer, srcStageMask ? srcStageMask : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStageMask ? dstStageMask : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+		hasMemoryBarrier ? 1 : 0, &memoryBarrier, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+	tracker.pending.clear();
+}
+
+// Frame Graph
+//	Passes declare the resources they use in execution order. Compiling culls passes whose results are never
+//	consumed, places transient resources with disjoint lifetimes in shared memory, creates a render pass per
+//	raster pass and precomputes one batched barrier ahead of each pass.
+enum FrameGraphPassType : uint8_t
+{
+	FRAME_GRAPH_PASS_RASTER = 0,
+	FRAME_GRAPH_PASS_COMPUTE,
+	FRAME_GRAPH_PASS_TRANSFER
+};
+
+enum FrameGraphAccess : uint8_t
+{
+	FRAME_GRAPH_ACCESS_COLOR_ATTACHMENT = 0,
+	FRAME_GRAPH_ACCESS_DEPTH_ATTACHMENT,
+	FRAME_GRAPH_ACCESS_DEPTH_READ,
+	FRAME_GRAPH_ACCESS_RESOLVE,
+	FRAME_GRAPH_ACCESS_SAMPLED,
+	FRAME_GRAPH_ACCESS_STORAGE_READ,
+	FRAME_GRAPH_ACCESS_STORAGE_WRITE,
+	FRAME_GRAPH_ACCESS_TRANSFER_SRC,
+	FRAME_GRAPH_ACCESS_TRANSFER_DST,
+	FRAME_GRAPH_ACCESS_INDIRECT
+};
+
+struct FrameGraphAccessInfo
+{
+	VkPipelineStageFlags stageMask;
+	VkAccessFlags accessMask;
+	VkImageLayout layout;
+	VkImageUsageFlags imageUsage;
+	VkBufferUsageFlags bufferUsage;
+	bool write;
+};
+
+FrameGraphAccessInfo GetFrameGraphAccessInfo(FrameGraphAccess access, FrameGraphPassType passType)
+{
+	VkPipelineStageFlags shaderStages = passType == FRAME_GRAPH_PASS_COMPUTE ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	VkPipelineStageFlags depthStages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+	switch (access)
+	{
+	case FRAME_GRAPH_ACCESS_COLOR_ATTACHMENT:
+		return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, 0, true };
+	case FRAME_GRAPH_ACCESS_DEPTH_ATTACHMENT:
+		return { depthStages, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, 0, true };
+	case FRAME_GRAPH_ACCESS_DEPTH_READ:
+		return { depthStages, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, 0, false };
+	case FRAME_GRAPH_ACCESS_RESOLVE:
+		return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, 0, true };
+	case FRAME_GRAPH_ACCESS_SAMPLED:
+		return { shaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, false };
+	case FRAME_GRAPH_ACCESS_STORAGE_READ:
+		return { shaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, false };
+	case FRAME_GRAPH_ACCESS_STORAGE_WRITE:
+		return { shaderStages, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, true };
+	case FRAME_GRAPH_ACCESS_TRANSFER_SRC:
+		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, false };
+	case FRAME_GRAPH_ACCESS_TRANSFER_DST:
+		return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_BUFFER_USAGE_TRANSFER_DST_BIT, true };
+	case FRAME_GRAPH_ACCESS_INDIRECT:
+		return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, false };
+	}
+
+	throw std::runtime_error("Frame Graph: Unknown resource access");
+}
+
+bool IsVulkanDepthFormat(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_X8_D24_UNORM_PACK32:
+	case VK_FORMAT_D32_SFLOAT:
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+struct FrameGraphResource
+{
+	std::string name;
+	bool isImage = true;
+	bool imported = false;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkExtent2D extent = {};
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	uint32_t mipLevels = 1;
+	VkDeviceSize size = 0;
+
+	//	State of an imported resource when the graph starts and the layout it is left in.
+	VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkPipelineStageFlags initialStageMask = 0;
+	VkAccessFlags initialAccessMask = 0;
+	VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	//	Compiled
+	VkImageUsageFlags imageUsage = 0;
+	VkBufferUsageFlags bufferUsage = 0;
+	int32_t firstPass = -1;
+	int32_t lastPass = -1;
+	std::vector<VkImage> images;
+	std::vector<VkImageView> views;
+	std::vector<VkImageView> mipViews;
+	VkImageView depthView = VK_NULL_HANDLE;	//	Depth aspect only, for sampling a depth/stencil format.
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkMemoryRequirements memoryRequirements = {};
+	bool lazy = false;
+	uint32_t allocation = UINT32_MAX;
+	VkDeviceSize memoryOffset = 0;
+};
+
+struct FrameGraphPass
+{
+	struct Use
+	{
+		uint32_t resource;
+		FrameGraphAccess access;
+		bool readsContents;
+		bool clear;
+		VkClearValue clearValue;
+		uint32_t resolveSource = UINT32_MAX;
+	};
+
+	std::string name;
+	FrameGraphPassType type = FRAME_GRAPH_PASS_RASTER;
+	std::vector<Use> uses;
+	bool sideEffects = false;
+	std::function<void(const VkCommandBuffer&, uint32_t imageIndex)> execute;	//	Recorded once per swapchain image.
+
+	//	Compiled. Raster passes merged into an earlier pass's render pass share its handle, the framebuffers,
+	//	clear values and subpass list live on that first pass.
+	bool culled = false;
+	int32_t renderPassLeader = -1;
+	uint32_t subpass = 0;
+	std::vector<uint32_t> subpassPasses;
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	std::vector<VkFramebuffer> framebuffers;
+	std::vector<VkClearValue> clearValues;
+	VkExtent2D extent = {};
+
+	void Read(uint32_t resource, FrameGraphAccess access) { uses.push_back({ resource, access, true, false, {} }); }
+	//	Overwrites the whole resource, its previous contents are discarded.
+	void Write(uint32_t resource, FrameGraphAccess access) { uses.push_back({ resource, access, false, false, {} }); }
+	void Modify(uint32_t resource, FrameGraphAccess access) { uses.push_back({ resource, access, true, false, {} }); }
+	void Clear(uint32_t resource, FrameGraphAccess access, VkClearValue value) { uses.push_back({ resource, access, false, true, value }); }
+	//	Resolves a multisampled color attachment of this pass into a single sampled image at the end of the subpass.
+	void Resolve(uint32_t source, uint32_t destination) { uses.push_back({ destination, FRAME_GRAPH_ACCESS_RESOLVE, false, false, {}, source }); }
+};
+
+struct FrameGraph
+{
+	std::vector<FrameGraphResource> resources;
+	std::deque<FrameGraphPass> passes;
+	std::vector<VkDeviceMemory> allocations;
+	std::vector<ResourceState> initialStates;
+};
+
+//	Images with one handle per swapchain image are indexed by the image index when recording.
+uint32_t ImportFrameGraphImage(FrameGraph& graph, const std::string& name, const std::vector<VkImage>& images, const std::vector<VkImageView>& views, VkFormat format, VkExtent2D extent,
+	VkImageLayout initialLayout, VkPipelineStageFlags initialStageMask, VkImageLayout finalLayout)
+{
+	FrameGraphResource resource;
+	resource.name = name;
+	resource.imported = true;
+	resource.format = format;
+	resource.extent = extent;
+	resource.images = images;
+	resource.views = views;
+	resource.initialLayout = initialLayout;
+	resource.initialStageMask = initialStageMask;
+	resource.finalLayout = finalLayout;
+
+	graph.resources.push_back(resource);
+	return static_cast<uint32_t>(graph.resources.size() - 1);
+}
+
+//	Buffers that outlive a frame. Their contents carry over, so the first use waits on initialStageMask/initialAccessMask.
+uint32_t ImportFrameGraphBuffer(FrameGraph& graph, const std::string& name, VkBuffer buffer, VkDeviceSize size, VkPipelineStageFlags initialStageMask, VkAccessFlags initialAccessMask)
+{
+	FrameGraphResource resource;
+	resource.name = name;
+	resource.isImage = false;
+	resource.imported = true;
+	resource.size = size;
+	resource.buffer = buffer;
+	resource.initialStageMask = initialStageMask;
+	resource.initialAccessMask = initialAccessMask;
+
+	graph.resources.push_back(resource);
+	return static_cast<uint32_t>(graph.resources.size() - 1);
+}
+
+//	Images with more than one mip level also get a view per level, see GetFrameGraphMipView.
+uint32_t CreateFrameGraphImage(FrameGraph& graph, const std::string& name, VkFormat format, VkExtent2D extent, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT, uint32_t mipLevels = 1)
+{
+	FrameGraphResource resource;
+	resource.name = name;
+	resource.format = format;
+	resource.extent = extent;
+	resource.samples = samples;
+	resource.mipLevels = mipLevels;
+
+	graph.resources.push_back(resource);
+	return static_cast<uint32_t>(graph.resources.size() - 1);
+}
+
+uint32_t CreateFrameGraphBuffer(FrameGraph& graph, const std::string& name, VkDeviceSize size)
+{
+	FrameGraphResource resource;
+	resource.name = name;
+	resource.isImage = false;
+	resource.size = size;
+
+	graph.resources.push_back(resource);
+	return static_cast<uint32_t>(graph.resources.size() - 1);
+}
+
+FrameGraphPass& AddFrameGraphPass(FrameGraph& graph, const std::string& name, FrameGraphPassType type)
+{
+	graph.passes.emplace_back();
+	graph.passes.back().name = name;
+	graph.passes.back().type = type;
+	return graph.passes.back();
+}
+
+VkImageView GetFrameGraphImageView(const FrameGraph& graph, uint32_t resource, uint32_t imageIndex = 0)
+{
+	const auto& views = graph.resources[resource].views;
+	return views[imageIndex % views.size()];
+}
+
+//	Views of depth/stencil formats cover both aspects, sampled image descriptors need a single one.
+VkImageView GetFrameGraphSampledView(const FrameGraph& graph, uint32_t resource)
+{
+	const auto& graphResource = graph.resources[resource];
+	return graphResource.depthView != VK_NULL_HANDLE ? graphResource.depthView : graphResource.views[0];
+}
+
+VkImageView GetFrameGraphMipView(const FrameGraph& graph, uint32_t resource, uint32_t mipLevel)
+{
+	return graph.resources[resource].mipViews[mipLevel];
+}
+
+VkBuffer GetFrameGraphBuffer(const FrameGraph& graph, uint32_t resource)
+{
+	return graph.resources[resource].buffer;
+}
+
+VkImageAspectFlags GetFrameGraphAspectMask(const FrameGraphResource& resource)
+{
+	if (!IsVulkanDepthFormat(resource.format))
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+
+	bool stencil = resource.format == VK_FORMAT_D16_UNORM_S8_UINT || resource.format == VK_FORMAT_D24_UNORM_S8_UINT || resource.format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+	return VK_IMAGE_ASPECT_DEPTH_BIT | (stencil ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+}
+
+void RequireFrameGraphState(const FrameGraph& graph, ResourceStateTracker& tracker, uint32_t resourceIndex, uint32_t imageIndex, const FrameGraphAccessInfo& info)
+{
+	const auto& resource = graph.resources[resourceIndex];
+	if (resource.isImage)
+		RequireImageState(tracker, resource.images[imageIndex % resource.images.size()], GetFrameGraphAspectMask(resource), info.stageMask, info.accessMask, info.layout);
+	else
+		RequireBufferState(tracker, resource.buffer, info.stageMask, info.accessMask);
+}
+
+bool IsFirstFrameGraphSubpassUse(const FrameGraph& graph, const FrameGraphPass& pass, uint32_t resource)
+{
+	const auto& leader = graph.passes[pass.renderPassLeader];
+	for (uint32_t i = 0; i < pass.subpass; i++)
+	{
+		for (const auto& use : graph.passes[leader.subpassPasses[i]].uses)
+			if (use.resource == resource)
+				return false;
+	}
+
+	return true;
+}
+
+//	The first subpass of a render pass requires the first use of every resource in any of its subpasses, so all
+//	barriers are recorded before the render pass begins. Later subpasses only advance the tracked state, their
+//	transitions are done by the render pass itself.
+void RequireFrameGraphPassStates(const FrameGraph& graph, ResourceStateTracker& tracker, const FrameGraphPass& pass, uint32_t imageIndex)
+{
+	if (pass.renderPassLeader < 0)
+	{
+		for (const auto& use : pass.uses)
+			RequireFrameGraphState(graph, tracker, use.resource, imageIndex, GetFrameGraphAccessInfo(use.access, pass.type));
+		return;
+	}
+
+	if (pass.subpass == 0)
+	{
+		for (uint32_t member : pass.subpassPasses)
+		{
+			const auto& memberPass = graph.passes[member];
+			for (const auto& use : memberPass.uses)
+			{
+				if (IsFirstFrameGraphSubpassUse(graph, memberPass, use.resource))
+					RequireFrameGraphState(graph, tracker, use.resource, imageIndex, GetFrameGraphAccessInfo(use.access, memberPass.type));
+			}
+		}
+		return;
+	}
+
+	for (const auto& use : pass.uses)
+	{
+		if (!IsFirstFrameGraphSubpassUse(graph, pass, use.resource))
+			RequireFrameGraphState(graph, tracker, use.resource, imageIndex, GetFrameGraphAccessInfo(use.access, pass.type));
+	}
+	tracker.pending.clear();
+}
+
+//	Leaves imported images in the layout expected outside the graph.
+void RequireFrameGraphFinalStates(const FrameGraph& graph, ResourceStateTracker& tracker, uint32_t imageIndex)
+{
+	for (uint32_t i = 0; i < graph.resources.size(); i++)
+	{
+		const auto& resource = graph.resources[i];
+		if (resource.imported && resource.isImage && resource.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+			RequireFrameGraphState(graph, tracker, i, imageIndex, { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, resource.finalLayout, 0, 0, false });
+	}
+}
+
+uint64_t GetFrameGraphResourceKey(const FrameGraphResource& resource, uint32_t imageIndex)
+{
+	return resource.isImage ? GetResourceKey(resource.images[imageIndex % resource.images.size()]) : GetResourceKey(resource.buffer);
+}
+
+bool FrameGraphMemoryOverlaps(const FrameGraphResource& a, const FrameGraphResource& b)
+{
+	return a.allocation == b.allocation && a.allocation != UINT32_MAX &&
+		a.memoryOffset < b.memoryOffset + b.memoryRequirements.size && b.memoryOffset < a.memoryOffset + a.memoryRequirements.size;
+}
+
+//	Places every transient resource at the lowest offset not used by a resource alive at the same time.
+//	Buffers and images are kept in separate allocations so bufferImageGranularity never applies.
+void AllocateFrameGraphMemory(const VkPhysicalDevice& physicalDevice, const VkDevice& device, FrameGraph& graph)
+{
+	std::map<std::pair<uint32_t, bool>, std::vector<uint32_t>> groups;
+	for (uint32_t i = 0; i < graph.resources.size(); i++)
+	{
+		const auto& resource = graph.resources[i];
+		if (resource.imported || resource.firstPass < 0)
+			continue;
+
+		//	Lazily allocated memory is only committed if a tiler actually has to spill the attachment.
+		uint32_t memoryType;
+		if (!resource.lazy || !TryFindVulkanMemoryType(physicalDevice, resource.memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, memoryType))
+			memoryType = FindVulkanMemoryType(physicalDevice, resource.memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		groups[{ memoryType, resource.isImage }].push_back(i);
+	}
+
+	VkDeviceSize totalSize = 0, unaliasedSize = 0;
+	for (auto& group : groups)
+	{
+		auto& members = group.second;
+		std::sort(members.begin(), members.end(), [&](uint32_t a, uint32_t b) { return graph.resources[a].memoryRequirements.size > graph.resources[b].memoryRequirements.size; });
+
+		uint32_t allocation = static_cast<uint32_t>(graph.allocations.size());
+		VkDeviceSize allocationSize = 0;
+		std::vector<uint32_t> placed;
+
+		for (uint32_t index : members)
+		{
+			auto& resource = graph.resources[index];
+			resource.allocation = allocation;
+			resource.memoryOffset = 0;
+
+			bool moved = true;
+			while (moved)
+			{
+				moved = false;
+				for (uint32_t other : placed)
+				{
+					const auto& otherResource = graph.resources[other];
+					bool alive = resource.firstPass <= otherResource.lastPass && otherResource.firstPass <= resource.lastPass;
+					if (alive && FrameGraphMemoryOverlaps(resource, otherResource))
+					{
+						VkDeviceSize alignment = resource.memoryRequirements.alignment;
+						resource.memoryOffset = (otherResource.memoryOffset + otherResource.memoryRequirements.size + alignment - 1) / alignment * alignment;
+						moved = true;
+					}
+				}
+			}
+
+			placed.push_back(index);
+			allocationSize = std::max(allocationSize, resource.memoryOffset + resource.memoryRequirements.size);
+			unaliasedSize += resource.memoryRequirements.size;
+		}
+
+		VkMemoryAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+		allocInfo.allocationSize = allocationSize;
+		allocInfo.memoryTypeIndex = group.first.first;
+
+		VkDeviceMemory memory;
+		if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate frame graph memory!");
+
+		graph.allocations.push_back(memory);
+		totalSize += allocationSize;
+
+		for (uint32_t index : members)
+		{
+			auto& resource = graph.resources[index];
+			if (resource.isImage)
+				vkBindImageMemory(device, resource.images[0], memory, resource.memoryOffset);
+			else
+				vkBindBufferMemory(device, resource.buffer, memory, resource.memoryOffset);
+		}
+	}
+
+	Print("Frame Graph: %i bytes of transient memory (%i bytes without aliasing)", static_cast<int>(totalSize), static_cast<int>(unaliasedSize));
+}
+
+bool IsFrameGraphAttachment(FrameGraphAccess access)
+{
+	return access == FRAME_GRAPH_ACCESS_COLOR_ATTACHMENT || access == FRAME_GRAPH_ACCESS_DEPTH_ATTACHMENT || access == FRAME_GRAPH_ACCESS_DEPTH_READ || access == FRAME_GRAPH_ACCESS_RESOLVE;
+}
+
+VkExtent2D GetFrameGraphPassExtent(const FrameGraph& graph, const FrameGraphPass& pass)
+{
+	for (const auto& use : pass.uses)
+	{
+		if (IsFrameGraphAttachment(use.access))
+			return graph.resources[use.resource].extent;
+	}
+
+	throw std::runtime_error("Frame Graph: Raster pass '" + pass.name + "' has no attachments");
+}
+
+//	A raster pass can become the next subpass of the current render pass when it draws to the same extent and only
+//	shares attachments with the earlier subpasses. Anything else would need a barrier inside the render pass.
+bool CanMergeFrameGraphPass(const FrameGraph& graph, const FrameGraphPass& leader, const FrameGraphPass& pass)
+{
+	VkExtent2D extent = GetFrameGraphPassExtent(graph, leader), passExtent = GetFrameGraphPassExtent(graph, pass);
+	if (extent.width != passExtent.width || extent.height != passExtent.height)
+		return false;
+
+	for (const auto& use : pass.uses)
+	{
+		FrameGraphAccessInfo info = GetFrameGraphAccessInfo(use.access, pass.type);
+		for (uint32_t member : leader.subpassPasses)
+		{
+			const auto& memberPass = graph.passes[member];
+			for (const auto& memberUse : memberPass.uses)
+			{
+				if (memberUse.resource != use.resource)
+					continue;
+
+				//	Attachments can only be cleared by the load op of their first subpass.
+				if (use.clear || IsFrameGraphAttachment(use.access) != IsFrameGraphAttachment(memberUse.access))
+					return false;
+				if (!IsFrameGraphAttachment(use.access) && (info.write || GetFrameGraphAccessInfo(memberUse.access, memberPass.type).write))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+//	Builds one render pass for a pass and the passes merged into it as subpasses. Layout changes between subpasses
+//	happen inside the render pass, ordered by subpass dependencies instead of pipeline barriers.
+void CreateFrameGraphRenderPass(const VkDevice& device, FrameGraph& graph, int32_t leaderIndex)
+{
+	struct SubpassAttachments
+	{
+		std::vector<VkAttachmentReference> colors;
+		std::vector<uint32_t> colorResources;
+		std::vector<VkAttachmentReference> resolves;
+		std::vector<std::pair<uint32_t, VkAttachmentReference>> resolveSources;
+		VkAttachmentReference depth{ VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+		std::vector<uint32_t> preserve;
+	};
+
+	FrameGraphPass& leader = graph.passes[leaderIndex];
+	int32_t lastPassIndex = static_cast<int32_t>(leader.subpassPasses.back());
+
+	std::vector<VkAttachmentDescription> attachments;
+	std::vector<uint32_t> attachmentResources;
+	std::vector<uint32_t> lastSubpass;
+	std::vector<FrameGraphAccessInfo> lastInfo;
+	std::vector<SubpassAttachments> subpassAttachments(leader.subpassPasses.size());
+	std::map<std::pair<uint32_t, uint32_t>, VkSubpassDependency> dependencies;
+
+	for (uint32_t subpass = 0; subpass < leader.subpassPasses.size(); subpass++)
+	{
+		const auto& pass = graph.passes[leader.subpassPasses[subpass]];
+		for (const auto& use : pass.uses)
+		{
+			if (!IsFrameGraphAttachment(use.access))
+				continue;
+
+			const auto& resource = graph.resources[use.resource];
+			FrameGraphAccessInfo info = GetFrameGraphAccessInfo(use.access, pass.type);
+
+			auto it = std::find(attachmentResources.begin(), attachmentResources.end(), use.resource);
+			uint32_t attachmentIndex = static_cast<uint32_t>(it - attachmentResources.begin());
+
+			if (it == attachmentResources.end())
+			{
+				//	Contents nobody reads after this render pass are never written back to memory.
+				VkAttachmentDescription attachment{};
+				attachment.format = resource.format;
+				attachment.samples = resource.samples;
+				attachment.loadOp = use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : use.readsContents ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				attachment.storeOp = resource.imported || resource.lastPass > lastPassIndex ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+				attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+				attachment.initialLayout = info.layout;
+				attachment.finalLayout = info.layout;
+
+				attachments.push_back(attachment);
+				attachmentResources.push_back(use.resource);
+				lastSubpass.push_back(subpass);
+				lastInfo.push_back(info);
+				leader.clearValues.push_back(use.clearValue);
+			}
+			else
+			{
+				uint32_t previous = lastSubpass[attachmentIndex];
+				if (previous != subpass)
+				{
+					auto& dependency = dependencies[{ previous, subpass }];
+					dependency.srcSubpass = previous;
+					dependency.dstSubpass = subpass;
+					dependency.srcStageMask |= lastInfo[attachmentIndex].stageMask;
+					dependency.srcAccessMask |= lastInfo[attachmentIndex].accessMask & WRITE_ACCESS_MASK;
+					dependency.dstStageMask |= info.stageMask;
+					dependency.dstAccessMask |= info.accessMask;
+					dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+					for (uint32_t skipped = previous + 1; skipped < subpass; skipped++)
+						subpassAttachments[skipped].preserve.push_back(attachmentIndex);
+				}
+
+				attachments[attachmentIndex].finalLayout = info.layout;
+				lastSubpass[attachmentIndex] = subpass;
+				lastInfo[attachmentIndex] = info;
+			}
+
+			VkAttachmentReference ref{ attachmentIndex, info.layout };
+			if (use.access == FRAME_GRAPH_ACCESS_COLOR_ATTACHMENT)
+			{
+				subpassAttachments[subpass].colors.push_back(ref);
+				subpassAttachments[subpass].colorResources.push_back(use.resource);
+			}
+			else if (use.access == FRAME_GRAPH_ACCESS_RESOLVE)
+				subpassAttachments[subpass].resolveSources.push_back({ use.resolveSource, ref });
+			else
+				subpassAttachments[subpass].depth = ref;
+		}
+	}
+
+	leader.extent = GetFrameGraphPassExtent(graph, leader);
+
+	//	Resolve references line up with the color references of their multisampled sources.
+	for (auto& refs : subpassAttachments)
+	{
+		if (refs.resolveSources.empty())
+			continue;
+
+		refs.resolves.assign(refs.colors.size(), { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED });
+		for (const auto& [source, ref] : refs.resolveSources)
+		{
+			auto it = std::find(refs.colorResources.begin(), refs.colorResources.end(), source);
+			if (it == refs.colorResources.end())
+				throw std::runtime_error("Frame Graph: Resolve source '" + graph.resources[source].name + "' is not a color attachment of its pass");
+			refs.resolves[it - refs.colorResources.begin()] = ref;
+		}
+	}
+
+	std::vector<VkSubpassDescription> subpasses;
+	for (const auto& refs : subpassAttachments)
+	{
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = static_cast<uint32_t>(refs.colors.size());
+		subpass.pColorAttachments = refs.colors.data();
+		subpass.pResolveAttachments = refs.resolves.empty() ? nullptr : refs.resolves.data();
+		subpass.pDepthStencilAttachment = refs.depth.attachment != VK_ATTACHMENT_UNUSED ? &refs.depth : nullptr;
+		subpass.preserveAttachmentCount = static_cast<uint32_t>(refs.preserve.size());
+		subpass.pPreserveAttachments = refs.preserve.data();
+		subpasses.push_back(subpass);
+	}
+
+	std::vector<VkSubpassDependency> subpassDependencies;
+	for (const auto& [subpassPair, dependency] : dependencies)
+		subpassDependencies.push_back(dependency);
+
+	VkRenderPassCreateInfo renderPassInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+	renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+	renderPassInfo.pAttachments = attachments.data();
+	renderPassInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+	renderPassInfo.pSubpasses = subpasses.data();
+	renderPassInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
+	renderPassInfo.pDependencies = subpassDependencies.data();
+
+	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &leader.renderPass) != VK_SUCCESS)
+		throw std::runtime_error("failed to create render pass!");
+
+	for (uint32_t member : leader.subpassPasses)
+		graph.passes[member].renderPass = leader.renderPass;
+
+	size_t framebufferCount = 1;
+	for (uint32_t resource : attachmentResources)
+		framebufferCount = std::max(framebufferCount, graph.resources[resource].views.size());
+
+	leader.framebuffers.resize(framebufferCount);
+	for (size_t i = 0; i < framebufferCount; i++)
+	{
+		std::vector<VkImageView> views;
+		for (uint32_t resource : attachmentResources)
+			views.push_back(GetFrameGraphImageView(graph, resource, static_cast<uint32_t>(i)));
+
+		VkFramebufferCreateInfo framebufferInfo{ VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+		framebufferInfo.renderPass = leader.renderPass;
+		framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+		framebufferInfo.pAttachments = views.data();
+		framebufferInfo.width = leader.extent.width;
+		framebufferInfo.height = leader.extent.height;
+		framebufferInfo.layers = 1;
+
+		if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &leader.framebuffers[i]) != VK_SUCCESS)
+			throw std::runtime_error("failed to create framebuffer!");
+	}
+}
+
+void CompileFrameGraph(const VkPhysicalDevice& physicalDevice, const VkDevice& device, FrameGraph& graph)
+{
+	//	Cull backwards from the imported resources, which are consumed outside the graph.
+	std::vector<bool> needed(graph.resources.size());
+	for (size_t i = 0; i < graph.resources.size(); i++)
+		needed[i] = graph.resources[i].imported;
+
+	for (size_t i = graph.passes.size(); i-- > 0;)
+	{
+		auto& pass = graph.passes[i];
+
+		bool live = pass.sideEffects;
+		for (const auto& use : pass.uses)
+			live |= GetFrameGraphAccessInfo(use.access, pass.type).write && needed[use.resource];
+
+		pass.culled = !live;
+		if (!live)
+		{
+			Print("Frame Graph: Culled pass '%s'", pass.name.c_str());
+			continue;
+		}
+
+		for (const auto& use : pass.uses)
+		{
+			if (!use.readsContents && GetFrameGraphAccessInfo(use.access, pass.type).write)
+				needed[use.resource] = false;
+		}
+		for (const auto& use : pass.uses)
+		{
+			if (use.readsContents)
+				needed[use.resource] = true;
+		}
+	}
+
+	//	Consecutive raster passes merge into one render pass where possible.
+	int32_t leaderIndex = -1;
+	for (int32_t i = 0; i < static_cast<int32_t>(graph.passes.size()); i++)
+	{
+		auto& pass = graph.passes[i];
+		if (pass.culled)
+			continue;
+
+		if (pass.type != FRAME_GRAPH_PASS_RASTER)
+		{
+			leaderIndex = -1;
+			continue;
+		}
+
+		if (leaderIndex >= 0 && CanMergeFrameGraphPass(graph, graph.passes[leaderIndex], pass))
+		{
+			auto& leader = graph.passes[leaderIndex];
+			pass.renderPassLeader = leaderIndex;
+			pass.subpass = static_cast<uint32_t>(leader.subpassPasses.size());
+			leader.subpassPasses.push_back(i);
+			continue;
+		}
+
+		leaderIndex = i;
+		pass.renderPassLeader = i;
+		pass.subpass = 0;
+		pass.subpassPasses = { static_cast<uint32_t>(i) };
+	}
+
+	//	Lifetimes and usage
+	for (int32_t i = 0; i < static_cast<int32_t>(graph.passes.size()); i++)
+	{
+		const auto& pass = graph.passes[i];
+		if (pass.culled)
+			continue;
+
+		for (const auto& use : pass.uses)
+		{
+			auto& resource = graph.resources[use.resource];
+			FrameGraphAccessInfo info = GetFrameGraphAccessInfo(use.access, pass.type);
+
+			if (resource.firstPass < 0 && use.readsContents && !resource.imported)
+				Print("Frame Graph: '%s' is read by '%s' before it is written", resource.name.c_str(), pass.name.c_str());
+
+			if (resource.firstPass < 0)
+				resource.firstPass = i;
+			resource.lastPass = i;
+			resource.imageUsage |= info.imageUsage;
+			resource.bufferUsage |= info.bufferUsage;
+		}
+	}
+
+	//	Images that live and die inside one render pass never need backing memory on tile based GPUs.
+	const VkImageUsageFlags attachmentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+	for (uint32_t i = 0; i < graph.resources.size(); i++)
+	{
+		auto& resource = graph.resources[i];
+		if (resource.imported || resource.firstPass < 0 || !resource.isImage || (resource.imageUsage & ~attachmentUsage))
+			continue;
+
+		const auto& firstPass = graph.passes[resource.firstPass];
+		bool loaded = std::any_of(firstPass.uses.begin(), firstPass.uses.end(), [i](const FrameGraphPass::Use& use) { return use.resource == i && use.readsContents; });
+		if (!loaded && firstPass.renderPassLeader >= 0 && firstPass.renderPassLeader == graph.passes[resource.lastPass].renderPassLeader)
+		{
+			resource.lazy = true;
+			resource.imageUsage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		}
+	}
+
+	//	Transient resources
+	for (auto& resource : graph.resources)
+	{
+		if (resource.imported || resource.firstPass < 0)
+			continue;
+
+		if (resource.isImage)
+		{
+			VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = resource.format;
+			imageInfo.extent = { resource.extent.width, resource.extent.height, 1 };
+			imageInfo.mipLevels = resource.mipLevels;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = resource.samples;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = resource.imageUsage;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			resource.images.resize(1);
+			if (vkCreateImage(device, &imageInfo, nullptr, &resource.images[0]) != VK_SUCCESS)
+				throw std::runtime_error("failed to create frame graph image!");
+
+			vkGetImageMemoryRequirements(device, resource.images[0], &resource.memoryRequirements);
+		}
+		else
+		{
+			VkBufferCreateInfo bufferInfo{ VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+			bufferInfo.size = resource.size;
+			bufferInfo.usage = resource.bufferUsage;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+			if (vkCreateBuffer(device, &bufferInfo, nullptr, &resource.buffer) != VK_SUCCESS)
+				throw std::runtime_error("failed to create frame graph buffer!");
+
+			vkGetBufferMemoryRequirements(device, resource.buffer, &resource.memoryRequirements);
+		}
+	}
+
+	AllocateFrameGraphMemory(physicalDevice, device, graph);
+
+	for (auto& resource : graph.resources)
+	{
+		if (resource.imported || resource.firstPass < 0 || !resource.isImage)
+			continue;
+
+		VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+		viewInfo.image = resource.images[0];
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = resource.format;
+		viewInfo.subresourceRange = { GetFrameGraphAspectMask(resource), 0, resource.mipLevels, 0, 1 };
+
+		resource.views.resize(1);
+		if (vkCreateImageView(device, &viewInfo, nullptr, &resource.views[0]) != VK_SUCCESS)
+			throw std::runtime_error("failed to create frame graph image view!");
+
+		if ((resource.imageUsage & VK_IMAGE_USAGE_SAMPLED_BIT) && (GetFrameGraphAspectMask(resource) & VK_IMAGE_ASPECT_STENCIL_BIT))
+		{
+			viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+			if (vkCreateImageView(device, &viewInfo, nullptr, &resource.depthView) != VK_SUCCESS)
+				throw std::runtime_error("failed to create frame graph image view!");
+		}
+
+		if (resource.mipLevels == 1)
+			continue;
+
+		resource.mipViews.resize(resource.mipLevels);
+		for (uint32_t mip = 0; mip < resource.mipLevels; mip++)
+		{
+			viewInfo.subresourceRange = { GetFrameGraphAspectMask(resource), mip, 1, 0, 1 };
+			if (vkCreateImageView(device, &viewInfo, nullptr, &resource.mipViews[mip]) != VK_SUCCESS)
+				throw std::runtime_error("failed to create frame graph image view!");
+		}
+	}
+
+	//	A dry run finds the state every resource ends the frame in. A transient resource starts the next frame
+	//	discarded, but must wait for the previous frame's uses of its memory, including those of resources aliasing it.
+	ResourceStateTracker dryRun;
+	for (const auto& pass : graph.passes)
+	{
+		if (!pass.culled)
+			RequireFrameGraphPassStates(graph, dryRun, pass, 0);
+	}
+	RequireFrameGraphFinalStates(graph, dryRun, 0);
+
+	graph.initialStates.assign(graph.resources.size(), {});
+	for (size_t i = 0; i < graph.resources.size(); i++)
+	{
+		const auto& resource = graph.resources[i];
+		auto& initialState = graph.initialStates[i];
+		if (resource.imported)
+		{
+			initialState.layout = resource.initialLayout;
+			initialState.writeStages = resource.initialStageMask;
+			initialState.writeAccess = resource.initialAccessMask;
+			continue;
+		}
+
+		for (size_t j = 0; j < graph.resources.size(); j++)
+		{
+			if (graph.resources[j].firstPass < 0 || (i != j && !FrameGraphMemoryOverlaps(resource, graph.resources[j])))
+				continue;
+
+			const auto& finalState = dryRun.states[GetFrameGraphResourceKey(graph.resources[j], 0)];
+			initialState.writeStages |= finalState.writeStages | finalState.readStages;
+			initialState.writeAccess |= finalState.writeAccess;
+		}
+	}
+
+	int32_t livePasses = 0;
+	for (int32_t i = 0; i < static_cast<int32_t>(graph.passes.size()); i++)
+	{
+		auto& pass = graph.passes[i];
+		if (pass.culled)
+			continue;
+
+		livePasses++;
+		if (pass.renderPassLeader == i)
+			CreateFrameGraphRenderPass(device, graph, i);
+	}
+
+	Print("Frame Graph: Compiled %i of %i passes", livePasses, static_cast<int>(graph.passes.size()));
+}
+
+void RecordFrameGraph(const FrameGraph& graph, const VkCommandBuffer& cmdBuffer, uint32_t imageIndex)
+{
+	ResourceStateTracker tracker;
+	for (size_t i = 0; i < graph.resources.size(); i++)
+	{
+		if (graph.resources[i].firstPass >= 0)
+			tracker.states[GetFrameGraphResourceKey(graph.resources[i], imageIndex)] = graph.initialStates[i];
+	}
+
+	for (const auto& pass : graph.passes)
+	{
+		if (pass.culled)
+			continue;
+
+		RequireFrameGraphPassStates(graph, tracker, pass, imageIndex);
+		FlushResourceBarriers(tracker, cmdBuffer);
+
+		const FrameGraphPass* leader = pass.renderPassLeader >= 0 ? &graph.passes[pass.renderPassLeader] : nullptr;
+		if (leader && pass.subpass > 0)
+			vkCmdNextSubpass(cmdBuffer, VK_SUBPASS_CONTENTS_INLINE);
+		else if (leader)
+		{
+			VkRenderPassBeginInfo renderPassInfo{ VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+			renderPassInfo.renderPass = pass.renderPass;
+			renderPassInfo.framebuffer = pass.framebuffers[imageIndex % pass.framebuffers.size()];
+			renderPassInfo.renderArea.offset = { 0, 0 };
+			renderPassInfo.renderArea.extent = pass.extent;
+			renderPassInfo.clearValueCount = static_cast<uint32_t>(pass.clearValues.size());
+			renderPassInfo.pClearValues = pass.clearValues.data();
+
+			vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		}
+
+		if (pass.execute)
+			pass.execute(cmdBuffer, imageIndex);
+
+		if (leader && pass.subpass + 1 == leader->subpassPasses.size())
+			vkCmdEndRenderPass(cmdBuffer);
+	}
+
+	RequireFrameGraphFinalStates(graph, tracker, imageIndex);
+	FlushResourceBarriers(tracker, cmdBuffer);
+}
+
+void DestroyFrameGraph(const VkDevice& device, FrameGraph& graph)
+{
+	for (auto& pass : graph.passes)
+	{
+		for (auto framebuffer : pass.framebuffers)
+			vkDestroyFramebuffer(device, framebuffer, nullptr);
+		if (pass.subpass == 0)
+			vkDestroyRenderPass(device, pass.renderPass, nullptr);
+	}
+
+	for (auto& resource : graph.resources)
+	{
+		if (resource.imported)
+			continue;
+
+		for (auto view : resource.views)
+			vkDestroyImageView(device, view, nullptr);
+		for (auto view : resource.mipViews)
+			vkDestroyImageView(device, view, nullptr);
+		vkDestroyImageView(device, resource.depthView, nullptr);
+		for (auto image : resource.images)
+			vkDestroyImage(device, image, nullptr);
+		vkDestroyBuffer(device, resource.buffer, nullptr);
+	}
+
+	for (auto memory : graph.allocations)
+		vkFreeMemory(device, memory, nullptr);
+
+	graph = {};
+}
+
+void CreateVulkanCommandPool(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const VkSurfaceKHR& surface, VkCommandPool& outCmdPool) {
+	QueueFamilyIndices queueFamilyIndices = GetVulkanQueueFamilies(physicalDevice, surface);
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &outCmdPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create command pool!");
+}
+
+void CreateVulkanCommandBuffers(const VkDevice& device, const VkCommandPool& cmdPool, size_t count, std::vector<VkCommandBuffer>& outCmdBuffers) {
+	outCmdBuffers.clear();
+	outCmdBuffers.resize(count);
+
+	VkCommandBufferAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	allocInfo.commandPool = cmdPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = (uint32_t)outCmdBuffers.size();
+
+	if (vkAllocateCommandBuffers(device, &allocInfo, outCmdBuffers.data()) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate command buffers!");
+}
+
+//	Recorded every frame so descriptor sets can come from the per frame cache, the buffer's previous submission
+//	must have retired.
+void RecordVulkanCommandBuffer(const VkCommandBuffer& cmdBuffer, const FrameGraph& frameGraph, uint32_t imageIndex) {
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(cmdBuffer, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("failed to begin recording command buffer!");
+
+	RecordFrameGraph(frameGraph, cmdBuffer, imageIndex);
+
+	if (vkEndCommandBuffer(cmdBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record command buffer!");
+}
+
+void CreateVulkanSyncObjects(const VkDevice& device, const std::vector<VkImage>& swapChainImages, std::vector<VkSemaphore>& outImageReadySemaphores, std::vector<VkSemaphore>& outRenderFinishedSemaphores, std::vector<VkFence>& outFlightFences, std::vector<VkFence>& outImagesInFlight) 
+{
+	outImageReadySemaphores.clear();
+	outRenderFinishedSemaphores.clear();
+	outFlightFences.clear();
+	outImagesInFlight.clear();
+
+	outImageReadySemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+	outRenderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+	outFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+	outImagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+
+	VkSemaphoreCreateInfo semaphoreInfo{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+
+	VkFenceCreateInfo fenceInfo{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &outImageReadySemaphores[i]) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &outRenderFinishedSemaphores[i]) != VK_SUCCESS ||
+			vkCreateFence(device, &fenceInfo, nullptr, &outFlightFences[i]) != VK_SUCCESS)
+			throw std::runtime_error("failed to create synchronization objects for a frame!");
+	}
+}
+
+// GPU Driven Rendering
+//	Mirrors DrawObject in cull.comp (std430).
+struct GpuDrawObject
+{
+	float center[4];
+	float extents[4];
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t bucket;
+	uint32_t firstCommand;
+	uint32_t padding[3];
+};
+
+//	Mirrors the push constants in cull.comp.
+struct GpuCullConstants
+{
+	float viewProjection[16];
+	uint32_t objectCount;
+	uint32_t commandOffset;
+	uint32_t countOffset;
+};
+
+//	Draws that share a pipeline and a mesh, whose buffers are bound once for the bucket's indirect draw. Each bucket
+//	owns a contiguous range of indirect commands and one count.
+struct GpuDrawBucket
+{
+	const Mesh* mesh = nullptr;
+	uint32_t firstCommand = 0;
+	uint32_t maxDraws = 0;
+};
+
+enum GpuDrawPhase : uint32_t
+{
+	GPU_DRAW_PHASE_EARLY = 0,	//	Everything without occlusion culling, last frame's visible set with it.
+	GPU_DRAW_PHASE_LATE,		//	Objects the Hi-Z test finds visible that the early phase did not draw.
+	GPU_DRAW_PHASE_COUNT
+};
+
+//	Commands and counts of one swapchain image when the cull runs on the async compute queue.
+struct GpuCullOutput
+{
+	VkBuffer commands = VK_NULL_HANDLE;
+	VkDeviceMemory commandsMemory = VK_NULL_HANDLE;
+	VkBuffer counts = VK_NULL_HANDLE;
+	VkDeviceMemory countsMemory = VK_NULL_HANDLE;
+	std::vector<DescriptorBinding> bindings;
+};
+
+//	Per object data lives in a storage buffer, cull.comp writes the surviving objects' indirect commands and
+//	per bucket counts, the raster passes then issue one indirect draw per bucket and phase. Each command's
+//	firstInstance is its object index, which selects the object's InstanceData from the instance buffer.
+struct GpuDrivenScene
+{
+	std::vector<GpuDrawObject> objects;
+	std::vector<InstanceData> instances;
+	std::vector<GpuDrawBucket> buckets;
+	float viewProjection[16] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+	bool occlusionCulling = false;
+
+	uint32_t commandCount = 0;
+	uint32_t phaseCount = 1;
+	VkBuffer objectBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory objectMemory = VK_NULL_HANDLE;
+	VkBuffer instanceBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory instanceMemory = VK_NULL_HANDLE;
+	uint32_t commandsResource = UINT32_MAX;
+	uint32_t countsResource = UINT32_MAX;
+	VkDescriptorSetLayout cullSetLayouts[GPU_DRAW_PHASE_COUNT] = {};
+	std::vector<DescriptorBinding> cullBindings[GPU_DRAW_PHASE_COUNT];
+	VkPushConstantRange cullConstantRanges[GPU_DRAW_PHASE_COUNT] = {};
+	GraphicsPipelineCache::Entry* cullPipelines[GPU_DRAW_PHASE_COUNT] = {};
+
+	//	Async cull, see SubmitGpuCullAsync. Replaces the frame graph's commands, counts and cull pass.
+	bool asyncCull = false;
+	std::vector<GpuCullOutput> asyncOutputs;
+
+	//	Occlusion culling
+	VkBuffer visibilityBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory visibilityMemory = VK_NULL_HANDLE;
+	uint32_t visibilityResource = UINT32_MAX;
+	uint32_t depthResource = UINT32_MAX;
+	uint32_t pyramidResource = UINT32_MAX;
+	VkSampler pyramidSampler = VK_NULL_HANDLE;
+	VkDescriptorSetLayout hiZSetLayout = VK_NULL_HANDLE;
+	VkDescriptorSetLayout hiZFirstSetLayout = VK_NULL_HANDLE;
+	std::vector<std::vector<DescriptorBinding>> hiZBindings;
+	GraphicsPipelineCache::Entry* hiZPipeline = nullptr;
+	GraphicsPipelineCache::Entry* hiZFirstPipeline = nullptr;
+};
+
+uint32_t AddGpuDrawBucket(GpuDrivenScene& scene, const Mesh& mesh)
+{
+	scene.buckets.emplace_back();
+	scene.buckets.back().mesh = &mesh;
+	return static_cast<uint32_t>(scene.buckets.size() - 1);
+}
+
+//	The bounds are the mesh's, the instance places them in the world. The mesh must be the bucket's.
+void AddGpuDrawObject(GpuDrivenScene& scene, uint32_t bucket, const Mesh& mesh, const float meshMin[3], const float meshMax[3], const InstanceData& instance)
+{
+	if (scene.buckets[bucket].mesh != &mesh)
+		throw std::runtime_error("GPU Driven: Objects of a bucket must share its mesh");
+
+	float boundsMin[3], boundsMax[3];
+	GetInstanceBounds(instance, meshMin, meshMax, boundsMin, boundsMax);
+
+	GpuDrawObject object{};
+	for (int axis = 0; axis < 3; axis++)
+	{
+		object.center[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+		object.extents[axis] = (boundsMax[axis] - boundsMin[axis]) * 0.5f;
+	}
+	//	The draw covers the whole of the bucket's mesh.
+	object.indexCount = mesh.indexCount;
+	object.firstIndex = 0;
+	object.vertexOffset = 0;
+	object.bucket = bucket;
+	scene.objects.push_back(object);
+	scene.instances.push_back(instance);
+	scene.buckets[bucket].maxDraws++;
+}
+
+void RecordGpuCull(const VkCommandBuffer& cmdBuffer, const VkDevice& device, DescriptorSetCache& descriptorCache, const GpuDrivenScene& scene, GpuDrawPhase phase, const std::vector<DescriptorBinding>& bindings)
+{
+	const auto& pipeline = *scene.cullPipelines[phase];
+
+	PushConstantBuilder<GpuCullConstants> constants;
+	BindPushConstants(constants, pipeline.layout, scene.cullConstantRanges[phase]);
+	constants.Set(&GpuCullConstants::viewProjection, scene.viewProjection)
+		.Set(&GpuCullConstants::objectCount, static_cast<uint32_t>(scene.objects.size()))
+		.Set(&GpuCullConstants::commandOffset, phase * scene.commandCount)
+		.Set(&GpuCullConstants::countOffset, phase * static_cast<uint32_t>(scene.buckets.size()));
+
+	VkDescriptorSet set = GetCachedDescriptorSet(device, descriptorCache, scene.cullSetLayouts[phase], bindings);
+	vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+	vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &set, 0, nullptr);
+	FlushPushConstants(cmdBuffer, constants);
+	vkCmdDispatch(cmdBuffer, (constants.values.objectCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+}
+
+void AddGpuCullPass(const VkDevice& device, FrameGraph& graph, DescriptorSetCache& descriptorCache, GpuDrivenScene& scene, GpuDrawPhase phase)
+{
+	bool drawIndirectCount = _vkCmdDrawIndexedIndirectCountKHR != nullptr;
+
+	auto& cullPass = AddFrameGraphPass(graph, phase == GPU_DRAW_PHASE_EARLY ? "GpuCull" : "GpuCullLate", FRAME_GRAPH_PASS_COMPUTE);
+	cullPass.Modify(scene.countsResource, FRAME_GRAPH_ACCESS_STORAGE_WRITE);
+	if (drawIndirectCount && phase == GPU_DRAW_PHASE_EARLY)
+		cullPass.Write(scene.commandsResource, FRAME_GRAPH_ACCESS_STORAGE_WRITE);
+	else
+		cullPass.Modify(scene.commandsResource, FRAME_GRAPH_ACCESS_STORAGE_WRITE);
+
+	if (scene.occlusionCulling && phase == GPU_DRAW_PHASE_EARLY)
+		cullPass.Read(scene.visibilityResource, FRAME_GRAPH_ACCESS_STORAGE_READ);
+	if (phase == GPU_DRAW_PHASE_LATE)
+	{
+		cullPass.Modify(scene.visibilityResource, FRAME_GRAPH_ACCESS_STORAGE_WRITE);
+		cullPass.Read(scene.pyramidResource, FRAME_GRAPH_ACCESS_SAMPLED);
+	}
+
+	cullPass.execute = [device, &descriptorCache, &scene, phase](const VkCommandBuffer& cmdBuffer, uint32_t)
+	{
+		RecordGpuCull(cmdBuffer, device, descriptorCache, scene, phase, scene.cullBindings[phase]);
+	};
+}
+
+//	Lays out the bucket command ranges, uploads the objects and adds the clear and cull passes to the frame graph.
+//	Must be called before the raster passes that draw the buckets are added.
+//	Without occlusion culling the cull reads nothing the graphics queue writes, so with a dedicated compute family
+//	it leaves the frame graph and runs on the async compute queue with commands and counts per swapchain image.
+void CreateGpuDrivenScene(const VkPhysicalDevice& physicalDevice, const VkDevice& device, UploadEngine& uploadEngine, const AsyncComputeContext& asyncCompute, uint32_t imageCount,
+	FrameGraph& graph, DescriptorSetCache& descriptorCache, GpuDrivenScene& scene)
+{
+	scene.asyncCull = asyncCompute.dedicated && !scene.occlusionCulling;
+
+	scene.commandCount = 0;
+	for (auto& bucket : scene.buckets)
+	{
+		bucket.firstCommand = scene.commandCount;
+		scene.commandCount += bucket.maxDraws;
+	}
+	for (auto& object : scene.objects)
+		object.firstCommand = scene.buckets[object.bucket].firstCommand;
+
+	VkDeviceSize objectSize = std::max<VkDeviceSize>(1, scene.objects.size()) * sizeof(GpuDrawObject);
+	if (scene.asyncCull)
+	{
+		//	The upload engine hands its buffers to the graphics family, the compute queue reads the objects from host
+		//	visible memory instead.
+		CreateVulkanBuffer(physicalDevice, device, objectSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, scene.objectBuffer, scene.objectMemory);
+		if (!scene.objects.empty())
+		{
+			void* mapped;
+			vkMapMemory(device, scene.objectMemory, 0, objectSize, 0, &mapped);
+			memcpy(mapped, scene.objects.data(), scene.objects.size() * sizeof(GpuDrawObject));
+			vkUnmapMemory(device, scene.objectMemory);
+		}
+	}
+	else
+	{
+		CreateVulkanBuffer(physicalDevice, device, objectSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, scene.objectBuffer, scene.objectMemory);
+		if (!scene.objects.empty())
+			QueueBufferUpload(uploadEngine, scene.objects.data(), scene.objects.size() * sizeof(GpuDrawObject), scene.objectBuffer, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+
+	VkDeviceSize instanceSize = std::max<VkDeviceSize>(1, scene.instances.size()) * sizeof(InstanceData);
+	CreateVulkanBuffer(physicalDevice, device, instanceSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, scene.instanceBuffer, scene.instanceMemory);
+	if (!scene.instances.empty())
+		QueueBufferUpload(uploadEngine, scene.instances.data(), scene.instances.size() * sizeof(InstanceData), scene.instanceBuffer, 0, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+	//	Visibility carries over between frames, it starts out empty so the first late phase draws everything.
+	scene.phaseCount = scene.occlusionCulling ? GPU_DRAW_PHASE_COUNT : 1;
+	if (scene.occlusionCulling)
+	{
+		std::vector<uint32_t> visibility(std::max<size_t>(1, scene.objects.size()), 0);
+		VkDeviceSize visibilitySize = visibility.size() * sizeof(uint32_t);
+		CreateVulkanBuffer(physicalDevice, device, visibilitySize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, scene.visibilityBuffer, scene.visibilityMemory);
+		QueueBufferUpload(uploadEngine, visibility.data(), visibilitySize, scene.visibilityBuffer, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+		scene.visibilityResource = ImportFrameGraphBuffer(graph, "Visibility", scene.visibilityBuffer, visibilitySize, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	VkDeviceSize commandsSize = std::max(1u, scene.phaseCount * scene.commandCount) * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize countsSize = std::max<size_t>(1, scene.phaseCount * scene.buckets.size()) * sizeof(uint32_t);
+
+	//	Written on the compute queue and read by the graphics queue's indirect draws.
+	if (scene.asyncCull)
+	{
+		VkSharingMode sharingMode;
+		std::vector<uint32_t> queueFamilies;
+		GetVulkanSharedQueueFamilies(asyncCompute, uploadEngine.graphicsFamily, sharingMode, queueFamilies);
+
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		scene.asyncOutputs.resize(imageCount);
+		for (auto& output : scene.asyncOutputs)
+		{
+			CreateVulkanBuffer(physicalDevice, device, commandsSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, output.commands, output.commandsMemory, sharingMode, queueFamilies);
+			CreateVulkanBuffer(physicalDevice, device, countsSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, output.counts, output.countsMemory, sharingMode, queueFamilies);
+		}
+		return;
+	}
+
+	scene.commandsResource = CreateFrameGraphBuffer(graph, "DrawCommands", commandsSize);
+	scene.countsResource = CreateFrameGraphBuffer(graph, "DrawCounts", countsSize);
+
+	//	Without the count extension every command slot is drawn, so stale slots are zeroed to empty draws.
+	bool drawIndirectCount = _vkCmdDrawIndexedIndirectCountKHR != nullptr;
+
+	auto& clearPass = AddFrameGraphPass(graph, "ClearDrawCounts", FRAME_GRAPH_PASS_TRANSFER);
+	clearPass.Write(scene.countsResource, FRAME_GRAPH_ACCESS_TRANSFER_DST);
+	if (!drawIndirectCount)
+		clearPass.Write(scene.commandsResource, FRAME_GRAPH_ACCESS_TRANSFER_DST);
+	clearPass.execute = [&graph, &scene, drawIndirectCount](const VkCommandBuffer& cmdBuffer, uint32_t)
+	{
+		vkCmdFillBuffer(cmdBuffer, GetFrameGraphBuffer(graph, scene.countsResource), 0, VK_WHOLE_SIZE, 0);
+		if (!drawIndirectCount)
+			vkCmdFillBuffer(cmdBuffer, GetFrameGraphBuffer(graph, scene.commandsResource), 0, VK_WHOLE_SIZE, 0);
+	};
+
+	AddGpuCullPass(device, graph, descriptorCache, scene, GPU_DRAW_PHASE_EARLY);
+}
+
+//	Adds the Hi-Z build from the early phase's depth and the late cull pass. Call between the early and late
+//	phase's raster passes.
+void AddGpuOcclusionPasses(const VkDevice& device, FrameGraph& graph, DescriptorSetCache& descriptorCache, GpuDrivenScene& scene, uint32_t depthResource)
+{
+	const auto& depth = graph.resources[depthResource];
+
+	//	Level 0 is half the depth resolution, each level halves again down to 1x1.
+	VkExtent2D pyramidExtent = { std::max(1u, depth.extent.width / 2), std::max(1u, depth.extent.height / 2) };
+	uint32_t mipLevels = 1;
+	while ((std::max(pyramidExtent.width, pyramidExtent.height) >> mipLevels) > 0)
+		mipLevels++;
+
+	scene.depthResource = depthResource;
+	scene.pyramidResource = CreateFrameGraphImage(graph, "DepthPyramid", VK_FORMAT_R32_SFLOAT, pyramidExtent, VK_SAMPLE_COUNT_1_BIT, mipLevels);
+
+	auto& hiZPass = AddFrameGraphPass(graph, "BuildHiZ", FRAME_GRAPH_PASS_COMPUTE);
+	hiZPass.Read(depthResource, FRAME_GRAPH_ACCESS_SAMPLED);
+	hiZPass.Write(scene.pyramidResource, FRAME_GRAPH_ACCESS_STORAGE_WRITE);
+	hiZPass.execute = [device, &descriptorCache, &scene, pyramidExtent](const VkCommandBuffer& cmdBuffer, uint32_t)
+	{
+		//	The pyramid stays in GENERAL for the whole chain, each level only waits for the one before it.
+		for (uint32_t mip = 0; mip < scene.hiZBindings.size(); mip++)
+		{
+			if (mip > 0)
+			{
+				VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+				barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+				vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			}
+
+			const auto& pipeline = mip == 0 ? *scene.hiZFirstPipeline : *scene.hiZPipeline;
+			uint32_t width = std::max(1u, pyramidExtent.width >> mip), height = std::max(1u, pyramidExtent.height >> mip);
+			VkDescriptorSet set = GetCachedDescriptorSet(device, descriptorCache, mip == 0 ? scene.hiZFirstSetLayout : scene.hiZSetLayout, scene.hiZBindings[mip]);
+
+			vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+			vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &set, 0, nullptr);
+			vkCmdDispatch(cmdBuffer, (width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+		}
+	};
+
+	AddGpuCullPass(device, graph, descriptorCache, scene, GPU_DRAW_PHASE_LATE);
+}
+
+//	The async cull's outputs are outside the graph, the graphics submit waits on them through the compute semaphore.
+void ReadGpuDrawCommands(FrameGraphPass& pass, const GpuDrivenScene& scene)
+{
+	if (scene.asyncCull)
+		return;
+
+	pass.Read(scene.commandsResource, FRAME_GRAPH_ACCESS_INDIRECT);
+	pass.Read(scene.countsResource, FRAME_GRAPH_ACCESS_INDIRECT);
+}
+
+VkDescriptorSetLayout GetGpuDrivenSetLayout(const VkDevice& device, PipelineLayoutCache& layoutCache, const std::string& shader)
+{
+	//	The set layout comes from the same reflection the pipeline layout was built from, so it is already cached.
+	ShaderReflection reflection = ReflectVulkanShaderModule(ReadFile(shader));
+
+	std::lock_guard<std::mutex> lock(layoutCache.mutex);
+	return GetCachedDescriptorSetLayout(device, layoutCache, reflection.descriptorSets[0]);
+}
+
+const std::string& GetGpuCullShader(const GpuDrivenScene& scene, uint32_t phase)
+{
+	if (phase == GPU_DRAW_PHASE_LATE)
+		return SHADER_ASSETS[SHADER_ASSET_CULL_LATE].binary;
+	return SHADER_ASSETS[scene.occlusionCulling ? SHADER_ASSET_CULL_EARLY : SHADER_ASSET_CULL].binary;
+}
+
+const std::string& GetGpuHiZFirstShader(const FrameGraph& graph, const GpuDrivenScene& scene)
+{
+	bool multisampled = graph.resources[scene.depthResource].samples > VK_SAMPLE_COUNT_1_BIT;
+	return SHADER_ASSETS[multisampled ? SHADER_ASSET_HIZ_MS : SHADER_ASSET_HIZ].binary;
+}
+
+//	Set layouts and push constant ranges are reflected from the current binaries and pipeline layouts, call again
+//	once a hot reload has swapped in a cull or Hi-Z pipeline.
+void UpdateGpuDrivenLayouts(const VkDevice& device, const FrameGraph& graph, PipelineLayoutCache& layoutCache, GpuDrivenScene& scene)
+{
+	for (uint32_t phase = 0; phase < scene.phaseCount; phase++)
+	{
+		scene.cullSetLayouts[phase] = GetGpuDrivenSetLayout(device, layoutCache, GetGpuCullShader(scene, phase));
+		scene.cullConstantRanges[phase] = GetCachedPushConstantRange(layoutCache, scene.cullPipelines[phase]->layout);
+	}
+
+	if (scene.occlusionCulling)
+	{
+		scene.hiZFirstSetLayout = GetGpuDrivenSetLayout(device, layoutCache, GetGpuHiZFirstShader(graph, scene));
+		scene.hiZSetLayout = GetGpuDrivenSetLayout(device, layoutCache, SHADER_ASSETS[SHADER_ASSET_HIZ].binary);
+	}
+}
+
+//	Creates the cull and Hi-Z pipelines and records which of the graph's resources each pass binds, call after the
+//	frame graph is compiled. The sets themselves come from the descriptor set cache while recording.
+void CreateGpuCullingPipeline(const VkDevice& device, const FrameGraph& graph, PipelineLayoutCache& layoutCache, GraphicsPipelineCache& pipelineCache, GpuDrivenScene& scene)
+{
+	uint32_t mipLevels = scene.occlusionCulling ? graph.resources[scene.pyramidResource].mipLevels : 0;
+
+	if (scene.occlusionCulling)
+	{
+		VkSamplerCreateInfo samplerInfo{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+		samplerInfo.magFilter = VK_FILTER_NEAREST;
+		samplerInfo.minFilter = VK_FILTER_NEAREST;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+		if (vkCreateSampler(device, &samplerInfo, nullptr, &scene.pyramidSampler) != VK_SUCCESS)
+			throw std::runtime_error("failed to create sampler!");
+	}
+
+	auto getCullBindings = [&](uint32_t phase, VkBuffer commands, VkBuffer counts)
+	{
+		VkBuffer buffers[] = { scene.objectBuffer, commands, counts, scene.visibilityBuffer };
+
+		std::vector<DescriptorBinding> bindings;
+		for (uint32_t binding = 0; binding < (scene.occlusionCulling ? 4u : 3u); binding++)
+			bindings.push_back(MakeBufferBinding(binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffers[binding]));
+
+		if (phase == GPU_DRAW_PHASE_LATE)
+			bindings.push_back(MakeImageBinding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, GetFrameGraphImageView(graph, scene.pyramidResource), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, scene.pyramidSampler));
+		return bindings;
+	};
+
+	for (uint32_t phase = 0; phase < scene.phaseCount; phase++)
+	{
+		scene.cullPipelines[phase] = &GetVulkanComputePipelinePermutation(device, GetGpuCullShader(scene, phase), layoutCache, pipelineCache, ShaderPermutation());
+
+		if (!scene.asyncCull)
+			scene.cullBindings[phase] = getCullBindings(phase, GetFrameGraphBuffer(graph, scene.commandsResource), GetFrameGraphBuffer(graph, scene.countsResource));
+	}
+
+	for (auto& output : scene.asyncOutputs)
+		output.bindings = getCullBindings(GPU_DRAW_PHASE_EARLY, output.commands, output.counts);
+
+	//	Level 0 reads the depth buffer, multisampled depth takes the farthest sample. Every other level reads the
+	//	previous one, which is still in GENERAL while the chain runs.
+	if (scene.occlusionCulling)
+	{
+		scene.hiZFirstPipeline = &GetVulkanComputePipelinePermutation(device, GetGpuHiZFirstShader(graph, scene), layoutCache, pipelineCache, ShaderPermutation());
+		scene.hiZPipeline = &GetVulkanComputePipelinePermutation(device, SHADER_ASSETS[SHADER_ASSET_HIZ].binary, layoutCache, pipelineCache, ShaderPermutation());
+
+		scene.hiZBindings.assign(mipLevels, {});
+		for (uint32_t mip = 0; mip < mipLevels; mip++)
+		{
+			if (mip == 0)
+				scene.hiZBindings[mip].push_back(MakeImageBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, GetFrameGraphSampledView(graph, scene.depthResource), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, scene.pyramidSampler));
+			else
+				scene.hiZBindings[mip].push_back(MakeImageBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, GetFrameGraphMipView(graph, scene.pyramidResource, mip - 1), VK_IMAGE_LAYOUT_GENERAL, scene.pyramidSampler));
+
+			scene.hiZBindings[mip].push_back(MakeImageBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, GetFrameGraphMipView(graph, scene.pyramidResource, mip), VK_IMAGE_LAYOUT_GENERAL));
+		}
+	}
+
+	UpdateGpuDrivenLayouts(device, graph, layoutCache, scene);
+}
+
+//	Records the frame's cull on the async compute queue. The graphics submit of the same frame picks up the wait
+//	through AddAsyncComputeWait, at DRAW_INDIRECT. Call once the image's previous submission has retired, its
+//	outputs are rewritten.
+void SubmitGpuCullAsync(const VkDevice& device, DescriptorSetCache& descriptorCache, AsyncComputeContext& context, const GpuDrivenScene& scene, size_t frame, uint32_t imageIndex)
+{
+	const auto& output = scene.asyncOutputs[imageIndex];
+	VkCommandBuffer cmdBuffer = BeginAsyncCompute(device, context, frame);
+
+	//	Without the count extension every command slot is drawn, so stale slots are zeroed to empty draws.
+	vkCmdFillBuffer(cmdBuffer, output.counts, 0, VK_WHOLE_SIZE, 0);
+	if (_vkCmdDrawIndexedIndirectCountKHR == nullptr)
+		vkCmdFillBuffer(cmdBuffer, output.commands, 0, VK_WHOLE_SIZE, 0);
+
+	VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	RecordGpuCull(cmdBuffer, device, descriptorCache, scene, GPU_DRAW_PHASE_EARLY, output.bindings);
+
+	SubmitAsyncCompute(device, context, frame, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+}
+
+void DrawGpuBucket(const VkCommandBuffer& cmdBuffer, const FrameGraph& graph, const GpuDrivenScene& scene, uint32_t imageIndex, uint32_t bucketIndex, GpuDrawPhase phase)
+{
+	const auto& bucket = scene.buckets[bucketIndex];
+	VkBuffer commands = scene.asyncCull ? scene.asyncOutputs[imageIndex].commands : GetFrameGraphBuffer(graph, scene.commandsResource);
+	VkBuffer counts = scene.asyncCull ? scene.asyncOutputs[imageIndex].counts : GetFrameGraphBuffer(graph, scene.countsResource);
+	VkDeviceSize offset = (phase * scene.commandCount + bucket.firstCommand) * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize countOffset = (phase * scene.buckets.size() + bucketIndex) * sizeof(uint32_t);
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+	if (_vkCmdDrawIndexedIndirectCountKHR != nullptr)
+		_vkCmdDrawIndexedIndirectCountKHR(cmdBuffer, commands, offset, counts, countOffset, bucket.maxDraws, stride);
+	else if (enabledDeviceFeatures.multiDrawIndirect)
+		vkCmdDrawIndexedIndirect(cmdBuffer, commands, offset, bucket.maxDraws, stride);
+	else
+	{
+		for (uint32_t draw = 0; draw < bucket.maxDraws; draw++)
+			vkCmdDrawIndexedIndirect(cmdBuffer, commands, offset + draw * stride, 1, stride);
+	}
+}
+
+void DestroyGpuDrivenScene(const VkDevice& device, GpuDrivenScene& scene)
+{
+	vkDestroySampler(device, scene.pyramidSampler, nullptr);
+	vkDestroyBuffer(device, scene.objectBuffer, nullptr);
+	vkFreeMemory(device, scene.objectMemory, nullptr);
+	vkDestroyBuffer(device, scene.instanceBuffer, nullptr);
+	vkFreeMemory(device, scene.instanceMemory, nullptr);
+	vkDestroyBuffer(device, scene.visibilityBuffer, nullptr);
+	vkFreeMemory(device, scene.visibilityMemory, nullptr);
+	for (const auto& output : scene.asyncOutputs)
+	{
+		vkDestroyBuffer(device, output.commands, nullptr);
+		vkFreeMemory(device, output.commandsMemory, nullptr);
+		vkDestroyBuffer(device, output.counts, nullptr);
+		vkFreeMemory(device, output.countsMemory, nullptr);
+	}
+	scene = GpuDrivenScene();
+}
+
+// Virtual Texturing
+//	Textures too large for whole residency are split into pages of VIRTUAL_TEXTURE_PAGE_PAYLOAD texels a side and
+//	only the pages recent frames sampled are kept, in slots of a physical cache that is an ordinary image. A page
+//	table image, one texel per page and one mip per level, maps pages to slots. Pages that are not resident map to
+//	their nearest resident ancestor and the coarsest level is a single page that never leaves, so every lookup hits
+//	and no sparse binding is needed.
+//	The forward shader writes the page it wanted for one pixel of every VIRTUAL_TEXTURE_FEEDBACK_SCALE square into
+//	a host visible feedback buffer, the reporting pixel moves every frame. A worker thread counts each feedback
+//	frame's requests and reads the pages from the KTX2 file, the most requested first. Each frame a transfer pass
+//	ahead of the forward pass copies a few read pages into the cache, evicting the least recently requested ones,
+//	and updates the page table levels that changed.
+const uint32_t VIRTUAL_TEXTURE_PAGE_PAYLOAD = 128;			//	Must match PAGE_PAYLOAD in shader.frag.
+const uint32_t VIRTUAL_TEXTURE_PAGE_BORDER = 4;				//	One block, so compressed pages copy as stored. Must match PAGE_BORDER in shader.frag.
+const uint32_t VIRTUAL_TEXTURE_PAGE_SIZE = VIRTUAL_TEXTURE_PAGE_PAYLOAD + 2 * VIRTUAL_TEXTURE_PAGE_BORDER;
+const uint32_t VIRTUAL_TEXTURE_MAX_PAGES = 4096;			//	Per side, feedback packs page coordinates into 12 bits.
+const uint32_t VIRTUAL_TEXTURE_FEEDBACK_SCALE = 8;			//	Must match FEEDBACK_SCALE in shader.frag.
+const uint32_t VIRTUAL_TEXTURE_EMPTY_FEEDBACK = UINT32_MAX;
+const uint32_t VIRTUAL_TEXTURE_MAX_UPLOADS = 16;			//	Pages copied into the cache per frame.
+const size_t VIRTUAL_TEXTURE_MAX_READS = 32;				//	Pages queued for the worker at once.
+
+//	Must match VirtualTextureInfo in shader.frag (std430).
+struct VirtualTextureInfo
+{
+	uint32_t pageTable;			//	Heap handles
+	uint32_t cache;
+	uint32_t sampler;
+	uint32_t maxMip;			//	The single page level.
+	float size[2];				//	Texels of level 0.
+	float cacheTexelSize[2];	//	One over the cache's extent.
+};
+
+struct VirtualPage
+{
+	uint32_t slot = UINT32_MAX;		//	Cache slot while resident.
+	uint64_t lastRequestFrame = 0;
+	bool readPending = false;
+};
+
+struct VirtualTexture
+{
+	struct Read
+	{
+		uint32_t page;
+		std::vector<char> data;
+		bool failed;
+	};
+
+	std::string path;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkExtent2D extent = {};
+	uint32_t blockDim = 1;						//	Texels per block side, 4 for block compressed formats.
+	uint32_t blockBytes = 0;
+	VkDeviceSize pageBytes = 0;
+	std::vector<Ktx2LevelIndex> levels;
+	std::vector<VkExtent2D> pageCounts;			//	Per page table level.
+	std::vector<uint32_t> pageOffsets;			//	First page of each level in pages and pageTable.
+	std::vector<VirtualPage> pages;
+	std::vector<uint32_t> pageTable;			//	RGBA8_UINT texels, slot x and y and the mip of the resident page.
+	uint32_t slotsPerRow = 0;
+	std::vector<uint32_t> slotPages;			//	Page in each slot, UINT32_MAX when free.
+	std::vector<uint32_t> freeSlots;
+
+	//	Shared with the worker, guarded by mutex.
+	std::vector<uint32_t> feedback;
+	bool feedbackPending = false;
+	std::vector<uint32_t> requests;				//	Pages of the last analyzed feedback, most requested first.
+	bool requestsReady = false;
+	std::deque<uint32_t> pendingReads;
+	std::vector<Read> completedReads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::atomic<bool> running{ false };
+	std::thread worker;
+
+	std::deque<Read> loadedPages;				//	Waiting for a slot.
+	uint64_t frame = 0;
+
+	Texture cache;
+	Texture pageTableImage;
+	VkSampler sampler = VK_NULL_HANDLE;
+	VkBuffer infoBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory infoMemory = VK_NULL_HANDLE;
+	uint32_t infoHandle = BINDLESS_INVALID_HANDLE;
+	uint32_t cacheHandle = BINDLESS_INVALID_HANDLE;
+	uint32_t pageTableHandle = BINDLESS_INVALID_HANDLE;
+	uint32_t samplerHandle = BINDLESS_INVALID_HANDLE;
+	FrameRingBuffer staging;					//	Pages first, then every page table level.
+	FrameRingBuffer feedbackRing;
+	std::vector<uint32_t> feedbackHandles;		//	One per ring region.
+	VkExtent2D feedbackExtent = {};
+	uint32_t cacheResource = UINT32_MAX;
+	uint32_t pageTableResource = UINT32_MAX;
+	std::vector<VkBufferImageCopy> cacheCopies;	//	Recorded by the upload pass, offsets are into the staging ring.
+	std::vector<VkBufferImageCopy> pageTableCopies;
+};
+
+bool IsVulkanFormatBlockCompressed(VkFormat format)
+{
+	return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+uint32_t GetVirtualPageIndex(const VirtualTexture& texture, uint32_t mip, uint32_t x, uint32_t y)
+{
+	return texture.pageOffsets[mip] + y * texture.pageCounts[mip].width + x;
+}
+
+void GetVirtualPageCoordinates(const VirtualTexture& texture, uint32_t page, uint32_t& outMip, uint32_t& outX, uint32_t& outY)
+{
+	outMip = 0;
+	while (outMip + 1 < texture.pageOffsets.size() && texture.pageOffsets[outMip + 1] <= page)
+		outMip++;
+
+	uint32_t local = page - texture.pageOffsets[outMip];
+	outX = local % texture.pageCounts[outMip].width;
+	outY = local / texture.pageCounts[outMip].width;
+}
+
+//	Blocks outside the level repeat its edge blocks, so edge pages have a border too.
+bool ReadVirtualPage(const VirtualTexture& texture, std::ifstream& file, uint32_t page, std::vector<char>& outData)
+{
+	uint32_t mip, x, y;
+	GetVirtualPageCoordinates(texture, page, mip, x, y);
+
+	uint32_t blocksX = (std::max(1u, texture.extent.width >> mip) + texture.blockDim - 1) / texture.blockDim;
+	uint32_t blocksY = (std::max(1u, texture.extent.height >> mip) + texture.blockDim - 1) / texture.blockDim;
+	uint32_t pageBlocks = VIRTUAL_TEXTURE_PAGE_SIZE / texture.blockDim;
+	int32_t originX = static_cast<int32_t>(x * VIRTUAL_TEXTURE_PAGE_PAYLOAD - VIRTUAL_TEXTURE_PAGE_BORDER) / static_cast<int32_t>(texture.blockDim);
+	int32_t originY = static_cast<int32_t>(y * VIRTUAL_TEXTURE_PAGE_PAYLOAD - VIRTUAL_TEXTURE_PAGE_BORDER) / static_cast<int32_t>(texture.blockDim);
+
+	int32_t lastX = static_cast<int32_t>(blocksX) - 1, lastY = static_cast<int32_t>(blocksY) - 1;
+	int32_t first = clamp(originX, 0, lastX);
+	int32_t last = clamp(originX + static_cast<int32_t>(pageBlocks) - 1, 0, lastX);
+	VkDeviceSize rowPitch = static_cast<VkDeviceSize>(blocksX) * texture.blockBytes;
+
+	std::vector<char> row(static_cast<size_t>(last - first + 1) * texture.blockBytes);
+	outData.resize(static_cast<size_t>(texture.pageBytes));
+	for (uint32_t blockY = 0; blockY < pageBlocks; blockY++)
+	{
+		int32_t sourceY = clamp(originY + static_cast<int32_t>(blockY), 0, lastY);
+		file.seekg(texture.levels[mip].byteOffset + sourceY * rowPitch + static_cast<VkDeviceSize>(first) * texture.blockBytes);
+		if (!file.read(row.data(), row.size()))
+			return false;
+
+		char* destination = outData.data() + static_cast<size_t>(blockY) * pageBlocks * texture.blockBytes;
+		for (uint32_t blockX = 0; blockX < pageBlocks; blockX++)
+		{
+			int32_t sourceX = clamp(originX + static_cast<int32_t>(blockX), 0, lastX);
+			memcpy(destination + static_cast<size_t>(blockX) * texture.blockBytes, row.data() + static_cast<size_t>(sourceX - first) * texture.blockBytes, texture.blockBytes);
+		}
+	}
+
+	return true;
+}
+
+//	A request counts for the page's ancestors too, so coarse pages, which are the fallback of everything below
+//	them, always come first. Ties go to the coarser page.
+void AnalyzeVirtualTextureFeedback(const VirtualTexture& texture, const std::vector<uint32_t>& feedback, std::vector<uint32_t>& outRequests)
+{
+	std::vector<uint32_t> counts(texture.pages.size(), 0);
+	uint32_t levelCount = static_cast<uint32_t>(texture.pageCounts.size());
+	for (uint32_t entry : feedback)
+	{
+		if (entry == VIRTUAL_TEXTURE_EMPTY_FEEDBACK)
+			continue;
+
+		uint32_t x = entry & 0xFFF, y = (entry >> 12) & 0xFFF, mip = entry >> 24;
+		if (mip < levelCount && x < texture.pageCounts[mip].width && y < texture.pageCounts[mip].height)
+			counts[GetVirtualPageIndex(texture, mip, x, y)]++;
+	}
+
+	for (uint32_t mip = 0; mip + 1 < levelCount; mip++)
+	{
+		for (uint32_t y = 0; y < texture.pageCounts[mip].height; y++)
+		{
+			for (uint32_t x = 0; x < texture.pageCounts[mip].width; x++)
+			{
+				uint32_t count = counts[GetVirtualPageIndex(texture, mip, x, y)];
+				if (count)
+					counts[GetVirtualPageIndex(texture, mip + 1, x >> 1, y >> 1)] += count;
+			}
+		}
+	}
+
+	outRequests.clear();
+	for (uint32_t page = 0; page < counts.size(); page++)
+		if (counts[page])
+			outRequests.push_back(page);
+
+	std::sort(outRequests.begin(), outRequests.end(), [&](uint32_t a, uint32_t b) { return counts[a] != counts[b] ? counts[a] > counts[b] : a > b; });
+}
+
+//	Only the latest feedback is analyzed, frames that arrive while the worker is busy replace the waiting one.
+void VirtualTextureWorker(VirtualTexture& texture)
+{
+	std::ifstream file(texture.path, std::ios::binary);
+	std::vector<uint32_t> feedback, requests;
+
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(texture.mutex);
+		texture.wake.wait(lock, [&]() { return !texture.running || texture.feedbackPending || !texture.pendingReads.empty(); });
+		if (!texture.running)
+			return;
+
+		if (texture.feedbackPending)
+		{
+			feedback.swap(texture.feedback);
+			texture.feedbackPending = false;
+			lock.unlock();
+
+			AnalyzeVirtualTextureFeedback(texture, feedback, requests);
+
+			lock.lock();
+			texture.requests.swap(requests);
+			texture.requestsReady = true;
+			continue;
+		}
+
+		VirtualTexture::Read read{ texture.pendingReads.front(), {}, false };
+		texture.pendingReads.pop_front();
+		lock.unlock();
+
+		read.failed = !ReadVirtualPage(texture, file, read.page, read.data);
+		file.clear();
+
+		lock.lock();
+		texture.completedReads.push_back(std::move(read));
+	}
+}
+
+void CreateVirtualTextureImage(const VkPhysicalDevice& physicalDevice, const VkDevice& device, VkFormat format, VkExtent2D extent, uint32_t mipLevels, Texture& outTexture)
+{
+	outTexture.format = format;
+	outTexture.extent = extent;
+	outTexture.mipLevels = mipLevels;
+
+	VkImageCreateInfo imageInfo{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent = { extent.width, extent.height, 1 };
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(device, &imageInfo, nullptr, &outTexture.image) != VK_SUCCESS)
+		throw std::runtime_error("failed to create virtual texture image!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, outTexture.image, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = FindVulkanMemoryType(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &outTexture.memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate virtual texture memory!");
+	vkBindImageMemory(device, outTexture.image, outTexture.memory, 0);
+
+	VkImageViewCreateInfo viewInfo{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+	viewInfo.image = outTexture.image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+
+	if (vkCreateImageView(device, &viewInfo, nullptr, &outTexture.view) != VK_SUCCESS)
+		throw std::runtime_error("failed to create virtual texture image view!");
+}
+
+//	Only plain KTX2 files with power of two sides and levels down to a single page work. regionCount is the
+//	swapchain image count, feedback and staging memory is split per image like the frame ring. The coarsest page
+//	is read right away and lands in the cache with the first update.
+void CreateVirtualTexture(const VkPhysicalDevice& physicalDevice, const VkDevice& device, const VkCommandPool& cmdPool, const VkQueue& graphicsQueue, UploadEngine& uploadEngine,
+	BindlessHeap& heap, const std::string& path, uint32_t regionCount, VkExtent2D renderExtent, VirtualTexture& outTexture)
+{
+	if (!enabledDeviceFeatures.fragmentStoresAndAtomics)
+		throw std::runtime_error("Virtual Texture: feedback needs fragmentStoresAndAtomics!");
+
+	std::ifstream file(path, std::ios::binary);
+	Ktx2Header header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		throw std::runtime_error("Virtual Texture: " + path + " is not a KTX2 file!");
+	if (header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1 || header.levelCount == 0)
+		throw std::runtime_error("Virtual Texture: only 2D KTX2 textures with mips are supported!");
+	if (header.supercompressionScheme != KTX2_SUPERCOMPRESSION_NONE || header.vkFormat == VK_FORMAT_UNDEFINED)
+		throw std::runtime_error("Virtual Texture: supercompressed KTX2 files cannot be paged!");
+	if ((header.pixelWidth & (header.pixelWidth - 1)) || (header.pixelHeight & (header.pixelHeight - 1)))
+		throw std::runtime_error("Virtual Texture: sides must be powers of two!");
+
+	outTexture.path = path;
+	outTexture.format = static_cast<VkFormat>(header.vkFormat);
+	outTexture.extent = { header.pixelWidth, header.pixelHeight };
+	if (!IsVulkanFormatSampled(physicalDevice, outTexture.format))
+		throw std::runtime_error("Virtual Texture: the device cannot sample the KTX2 file's format!");
+
+	bool compressed = IsVulkanFormatBlockCompressed(outTexture.format);
+	outTexture.blockDim = compressed ? 4 : 1;
+	outTexture.blockBytes = compressed ? GetBlockSize(outTexture.format) : GetVulkanFormatSize(outTexture.format);
+	uint32_t pageBlocks = VIRTUAL_TEXTURE_PAGE_SIZE / outTexture.blockDim;
+	outTexture.pageBytes = static_cast<VkDeviceSize>(pageBlocks) * pageBlocks * outTexture.blockBytes;
+
+	outTexture.levels.resize(header.levelCount);
+	if (!file.read(reinterpret_cast<char*>(outTexture.levels.data()), outTexture.levels.size() * sizeof(Ktx2LevelIndex)))
+		throw std::runtime_error("Virtual Texture: truncated KTX2 file!");
+
+	VkExtent2D pageExtent = { (outTexture.extent.width + VIRTUAL_TEXTURE_PAGE_PAYLOAD - 1) / VIRTUAL_TEXTURE_PAGE_PAYLOAD, (outTexture.extent.height + VIRTUAL_TEXTURE_PAGE_PAYLOAD - 1) / VIRTUAL_TEXTURE_PAGE_PAYLOAD };
+	if (pageExtent.width > VIRTUAL_TEXTURE_MAX_PAGES || pageExtent.height > VIRTUAL_TEXTURE_MAX_PAGES)
+		throw std::runtime_error("Virtual Texture: too many pages!");
+
+	uint32_t pageLevels = GetFullMipCount(pageExtent);
+	if (pageLevels > header.levelCount)
+		throw std::runtime_error("Virtual Texture: the mip chain must reach a single page!");
+
+	for (uint32_t mip = 0; mip < pageLevels; mip++)
+	{
+		outTexture.pageOffsets.push_back(static_cast<uint32_t>(outTexture.pages.size()));
+		outTexture.pageCounts.push_back({ std::max(1u, pageExtent.width >> mip), std::max(1u, pageExtent.height >> mip) });
+		outTexture.pages.resize(outTexture.pages.size() + outTexture.pageCounts.back().width * outTexture.pageCounts.back().height);
+	}
+	outTexture.pageTable.assign(outTexture.pages.size(), UINT32_MAX);
+
+	//	The cache is a square of slots, up to 256 a side since slot coordinates are stored as bytes.
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	uint32_t cacheSize = std::min(virtualTextureCacheSize, properties.limits.maxImageDimension2D);
+	outTexture.slotsPerRow = clamp(cacheSize / VIRTUAL_TEXTURE_PAGE_SIZE, 2u, 256u);
+	uint32_t slotCount = outTexture.slotsPerRow * outTexture.slotsPerRow;
+	outTexture.slotPages.assign(slotCount, UINT32_MAX);
+	for (uint32_t slot = slotCount; slot-- > 0;)
+		outTexture.freeSlots.push_back(slot);
+
+	uint32_t tailPage = static_cast<uint32_t>(outTexture.pages.size() - 1);
+	VirtualTexture::Read tail{ tailPage, {}, false };
+	if (!ReadVirtualPage(outTexture, file, tailPage, tail.data))
+		throw std::runtime_error("Virtual Texture: truncated KTX2 level!");
+	outTexture.pages[tailPage].readPending = true;
+	outTexture.loadedPages.push_back(std::move(tail));
+
+	VkExtent2D cacheExtent = { outTexture.slotsPerRow * VIRTUAL_TEXTURE_PAGE_SIZE, outTexture.slotsPerRow * VIRTUAL_TEXTURE_PAGE_SIZE };
+	CreateVirtualTextureImage(physicalDevice, device, outTexture.format, cacheExtent, 1, outTexture.cache);
+	CreateVirtualTextureImage(physicalDevice, device, VK_FORMAT_R8G8B8A8_UINT, pageExtent, pageLevels, outTexture.pageTableImage);
+
+	//	The frame graph expects both images ready to sample at the start of every frame.
+	VkCommandBuffer cmdBuffer = BeginVulkanSingleTimeCommands(device, cmdPool);
+	VkImageMemoryBarrier barriers[2] = {};
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[i].image = i == 0 ? outTexture.cache.image : outTexture.pageTableImage.image;
+		barriers[i].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 };
+	}
+	vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+	EndVulkanSingleTimeCommands(device, cmdPool, graphicsQueue, cmdBuffer);
+
+	//	Pages carry their own border, so the cache is sampled without mips and clamped only at its edge.
+	VkSamplerCreateInfo samplerInfo{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = 0.0f;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &outTexture.sampler) != VK_SUCCESS)
+		throw std::runtime_error("failed to create virtual texture sampler!");
+
+	outTexture.cacheHandle = RegisterBindlessImage(device, heap, outTexture.cache.view);
+	outTexture.pageTableHandle = RegisterBindlessImage(device, heap, outTexture.pageTableImage.view);
+	outTexture.samplerHandle = RegisterBindlessSampler(device, heap, outTexture.sampler);
+
+	VirtualTextureInfo info{};
+	info.pageTable = outTexture.pageTableHandle;
+	info.cache = outTexture.cacheHandle;
+	info.sampler = outTexture.samplerHandle;
+	info.maxMip = pageLevels - 1;
+	info.size[0] = static_cast<float>(outTexture.extent.width);
+	info.size[1] = static_cast<float>(outTexture.extent.height);
+	info.cacheTexelSize[0] = 1.0f / cacheExtent.width;
+	info.cacheTexelSize[1] = 1.0f / cacheExtent.height;
+
+	CreateVulkanBuffer(physicalDevice, device, sizeof(info), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, outTexture.infoBuffer, outTexture.infoMemory);
+	QueueBufferUpload(uploadEngine, &info, sizeof(info), outTexture.infoBuffer, 0, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	outTexture.infoHandle = RegisterBindlessBuffer(device, heap, outTexture.infoBuffer);
+
+	ReserveFrameRingBuffer(outTexture.staging, VIRTUAL_TEXTURE_MAX_UPLOADS * outTexture.pageBytes + outTexture.pageTable.size() * sizeof(uint32_t), 16);
+	CreateFrameRingBuffer(physicalDevice, device, regionCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, outTexture.staging);
+
+	outTexture.feedbackExtent = { (renderExtent.width + VIRTUAL_TEXTURE_FEEDBACK_SCALE - 1) / VIRTUAL_TEXTURE_FEEDBACK_SCALE, (renderExtent.height + VIRTUAL_TEXTURE_FEEDBACK_SCALE - 1) / VIRTUAL_TEXTURE_FEEDBACK_SCALE };
+	VkDeviceSize feedbackSize = static_cast<VkDeviceSize>(outTexture.feedbackExtent.width) * outTexture.feedbackExtent.height * sizeof(uint32_t);
+	ReserveFrameRingBuffer(outTexture.feedbackRing, feedbackSize, FRAME_RING_REGION_ALIGNMENT);
+	CreateFrameRingBuffer(physicalDevice, device, regionCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, outTexture.feedbackRing);
+	memset(outTexture.feedbackRing.mapped, 0xFF, static_cast<size_t>(outTexture.feedbackRing.regionSize * regionCount));
+	for (uint32_t region = 0; region < regionCount; region++)
+		outTexture.feedbackHandles.push_back(RegisterBindlessBuffer(device, heap, outTexture.feedbackRing.buffer, GetFrameRingBufferOffset(outTexture.feedbackRing, region, 0), feedbackSize));
+
+	outTexture.running = true;
+	outTexture.worker = std::thread(VirtualTextureWorker, std::ref(outTexture));
+
+	Print("Virtual Texture: %s, %ix%i in %i page(s) over %i level(s), %i cache slot(s)", path.c_str(), static_cast<int>(outTexture.extent.width), static_cast<int>(outTexture.extent.height),
+		static_cast<int>(outTexture.pages.size()), static_cast<int>(pageLevels), static_cast<int>(slotCount));
+}
+
+//	The upload pass goes ahead of every pass that samples the texture, ReadVirtualTexture declares those reads.
+void AddVirtualTextureUploadPass(FrameGraph& graph, VirtualTexture& texture)
+{
+	texture.cacheResource = ImportFrameGraphImage(graph, "VirtualTextureCache", { texture.cache.image }, { texture.cache.view }, texture.cache.format, texture.cache.extent,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	texture.pageTableResource = ImportFrameGraphImage(graph, "VirtualPageTable", { texture.pageTableImage.image }, { texture.pageTableImage.view }, texture.pageTableImage.format, texture.pageTableImage.extent,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	//	Slots are rewritten in place. The pass waits for earlier frames' fragment shaders, which is what keeps the
+	//	pages they still map from being overwritten under them.
+	auto& uploadPass = AddFrameGraphPass(graph, "VirtualTextureUpload", FRAME_GRAPH_PASS_TRANSFER);
+	uploadPass.Modify(texture.cacheResource, FRAME_GRAPH_ACCESS_TRANSFER_DST);
+	uploadPass.Modify(texture.pageTableResource, FRAME_GRAPH_ACCESS_TRANSFER_DST);
+	uploadPass.execute = [&texture](const VkCommandBuffer& cmdBuffer, uint32_t)
+	{
+		if (!texture.cacheCopies.empty())
+			vkCmdCopyBufferToImage(cmdBuffer, texture.staging.buffer, texture.cache.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(texture.cacheCopies.size()), texture.cacheCopies.data());
+		if (!texture.pageTableCopies.empty())
+			vkCmdCopyBufferToImage(cmdBuffer, texture.staging.buffer, texture.pageTableImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(texture.pageTableCopies.size()), texture.pageTableCopies.data());
+	};
+}
+
+void ReadVirtualTexture(FrameGraphPass& pass, const VirtualTexture& texture)
+{
+	pass.Read(texture.cacheResource, FRAME_GRAPH_ACCESS_SAMPLED);
+	pass.Read(texture.pageTableResource, FRAME_GRAPH_ACCESS_SAMPLED);
+}
+
+//	Goes after the last pass that writes feedback. The buffer is host visible and outside the graph, so the pass
+//	only makes the shader writes visible to the host reading them once the frame's fence has signaled.
+void AddVirtualTextureFeedbackPass(FrameGraph& graph)
+{
+	auto& feedbackPass = AddFrameGraphPass(graph, "VirtualTextureFeedback", FRAME_GRAPH_PASS_TRANSFER);
+	feedbackPass.sideEffects = true;
+	feedbackPass.execute = [](const VkCommandBuffer& cmdBuffer, uint32_t)
+	{
+		VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	};
+}
+
+//	Works without a virtual texture too, the shader then skips it.
+void SetVirtualTextureConstants(PushConstantBuilder<BindlessDrawConstants>& constants, const VirtualTexture& texture, uint32_t imageIndex)
+{
+	constants.Set(&BindlessDrawConstants::virtualTexture, texture.infoHandle);
+	if (texture.infoHandle == BINDLESS_INVALID_HANDLE)
+		return;
+
+	//	Every pixel of a feedback square reports once every VIRTUAL_TEXTURE_FEEDBACK_SCALE squared frames, each column
+	//	offset so consecutive frames sample different rows.
+	uint32_t step = static_cast<uint32_t>(texture.frame % (VIRTUAL_TEXTURE_FEEDBACK_SCALE * VIRTUAL_TEXTURE_FEEDBACK_SCALE));
+	uint32_t jitterX = step % VIRTUAL_TEXTURE_FEEDBACK_SCALE;
+	uint32_t jitterY = (step / VIRTUAL_TEXTURE_FEEDBACK_SCALE + jitterX * 3) % VIRTUAL_TEXTURE_FEEDBACK_SCALE;
+
+	constants.Set(&BindlessDrawConstants::feedbackBuffer, texture.feedbackHandles[imageIndex])
+		.Set(&BindlessDrawConstants::feedbackWidth, texture.feedbackExtent.width)
+		.Set(&BindlessDrawConstants::feedbackJitter, jitterX | jitterY << 16);
+}
+
+//	Takes the least recently requested slot when none is free. Pages requested as recently as the one that needs
+//	the slot are still in view and stay.
+uint32_t AllocateVirtualTextureSlot(VirtualTexture& texture, uint64_t requestFrame)
+{
+	if (!texture.freeSlots.empty())
+	{
+		uint32_t slot = texture.freeSlots.back();
+		texture.freeSlots.pop_back();
+		return slot;
+	}
+
+	uint32_t tailPage = static_cast<uint32_t>(texture.pages.size() - 1);
+	uint32_t victim = UINT32_MAX;
+	for (uint32_t slot = 0; slot < texture.slotPages.size(); slot++)
+	{
+		uint32_t page = texture.slotPages[slot];
+		if (page == tailPage || texture.pages[page].lastRequestFrame >= requestFrame)
+			continue;
+		if (victim == UINT32_MAX || texture.pages[page].lastRequestFrame < texture.pages[texture.slotPages[victim]].lastRequestFrame)
+			victim = slot;
+	}
+
+	if (victim != UINT32_MAX)
+		texture.pages[texture.slotPages[victim]].slot = UINT32_MAX;
+	return victim;
+}
+
+//	Coarse to fine, a page that is not resident takes its parent's entry. Returns whether any entry changed and
+//	flags the levels that did.
+bool RebuildVirtualPageTable(VirtualTexture& texture, std::vector<bool>& outChangedLevels)
+{
+	uint32_t levelCount = static_cast<uint32_t>(texture.pageCounts.size());
+	outChangedLevels.assign(levelCount, false);
+	bool changed = false;
+
+	for (uint32_t mip = levelCount; mip-- > 0;)
+	{
+		for (uint32_t y = 0; y < texture.pageCounts[mip].height; y++)
+		{
+			for (uint32_t x = 0; x < texture.pageCounts[mip].width; x++)
+			{
+				uint32_t page = GetVirtualPageIndex(texture, mip, x, y);
+				uint32_t slot = texture.pages[page].slot;
+				uint32_t entry = mip + 1 < levelCount ? texture.pageTable[GetVirtualPageIndex(texture, mip + 1, x >> 1, y >> 1)] : mip << 16;
+				if (slot != UINT32_MAX)
+					entry = (slot % texture.slotsPerRow) | (slot / texture.slotsPerRow) << 8 | mip << 16;
+
+				if (texture.pageTable[page] != entry)
+				{
+					texture.pageTable[page] = entry;
+					outChangedLevels[mip] = true;
+					changed = true;
+				}
+			}
+		}
+	}
+
+	return changed;
+}
+
+//	Call once per frame after the image's previous submission has completed and before recording it. Hands the
+//	feedback that submission wrote to the worker, queues reads for the latest requests and stages this frame's
+//	cache and page table copies.
+void UpdateVirtualTexture(VirtualTexture& texture, uint32_t imageIndex)
+{
+	texture.frame++;
+
+	uint32_t* feedback = static_cast<uint32_t*>(GetFrameRingBufferData(texture.feedbackRing, imageIndex, 0));
+	std::vector<uint32_t> entries(feedback, feedback + texture.feedbackExtent.width * texture.feedbackExtent.height);
+	std::fill(feedback, feedback + entries.size(), VIRTUAL_TEXTURE_EMPTY_FEEDBACK);
+
+	std::vector<uint32_t> requests;
+	bool requestsReady = false;
+	std::vector<VirtualTexture::Read> completedReads;
+	{
+		std::lock_guard<std::mutex> lock(texture.mutex);
+		texture.feedback.swap(entries);
+		texture.feedbackPending = true;
+
+		if (texture.requestsReady)
+		{
+			requests.swap(texture.requests);
+			texture.requestsReady = false;
+			requestsReady = true;
+		}
+		completedReads.swap(texture.completedReads);
+	}
+
+	for (auto& read : completedReads)
+	{
+		if (read.failed)
+		{
+			uint32_t mip, x, y;
+			GetVirtualPageCoordinates(texture, read.page, mip, x, y);
+			Print("Virtual Texture: failed to read page %i,%i of mip %i", static_cast<int>(x), static_cast<int>(y), static_cast<int>(mip));
+			texture.pages[read.page].readPending = false;
+			continue;
+		}
+		texture.loadedPages.push_back(std::move(read));
+	}
+
+	//	Reads the worker has not started yet are requeued in the new order.
+	if (requestsReady)
+	{
+		std::lock_guard<std::mutex> lock(texture.mutex);
+		for (uint32_t page : texture.pendingReads)
+			texture.pages[page].readPending = false;
+		texture.pendingReads.clear();
+
+		size_t inFlight = std::count_if(texture.pages.begin(), texture.pages.end(), [](const VirtualPage& page) { return page.readPending; });
+		for (uint32_t page : requests)
+		{
+			auto& virtualPage = texture.pages[page];
+			virtualPage.lastRequestFrame = texture.frame;
+			if (virtualPage.slot != UINT32_MAX || virtualPage.readPending || inFlight >= VIRTUAL_TEXTURE_MAX_READS)
+				continue;
+
+			texture.pendingReads.push_back(page);
+			virtualPage.readPending = true;
+			inFlight++;
+		}
+	}
+	texture.wake.notify_one();
+
+	texture.cacheCopies.clear();
+	texture.pageTableCopies.clear();
+
+	uint32_t uploads = 0;
+	while (uploads < VIRTUAL_TEXTURE_MAX_UPLOADS && !texture.loadedPages.empty())
+	{
+		VirtualTexture::Read read = std::move(texture.loadedPages.front());
+		texture.loadedPages.pop_front();
+
+		auto& page = texture.pages[read.page];
+		page.readPending = false;
+		uint32_t slot = AllocateVirtualTextureSlot(texture, page.lastRequestFrame);
+		if (slot == UINT32_MAX)
+		{
+			//	Everything in the cache is in view. The rest is dropped and requested again once something leaves.
+			for (const auto& dropped : texture.loadedPages)
+				texture.pages[dropped.page].readPending = false;
+			texture.loadedPages.clear();
+			break;
+		}
+
+		VkDeviceSize offset = uploads * texture.pageBytes;
+		memcpy(GetFrameRingBufferData(texture.staging, imageIndex, offset), read.data.data(), read.data.size());
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = GetFrameRingBufferOffset(texture.staging, imageIndex, offset);
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageOffset = { static_cast<int32_t>(slot % texture.slotsPerRow * VIRTUAL_TEXTURE_PAGE_SIZE), static_cast<int32_t>(slot / texture.slotsPerRow * VIRTUAL_TEXTURE_PAGE_SIZE), 0 };
+		region.imageExtent = { VIRTUAL_TEXTURE_PAGE_SIZE, VIRTUAL_TEXTURE_PAGE_SIZE, 1 };
+		texture.cacheCopies.push_back(region);
+
+		page.slot = slot;
+		texture.slotPages[slot] = read.page;
+		uploads++;
+	}
+
+	std::vector<bool> changedLevels;
+	if (!RebuildVirtualPageTable(texture, changedLevels))
+		return;
+
+	VkDeviceSize tableOffset = VIRTUAL_TEXTURE_MAX_UPLOADS * texture.pageBytes;
+	memcpy(GetFrameRingBufferData(texture.staging, imageIndex, tableOffset), texture.pageTable.data(), texture.pageTable.size() * sizeof(uint32_t));
+	for (uint32_t mip = 0; mip < changedLevels.size(); mip++)
+	{
+		if (!changedLevels[mip])
+			continue;
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = GetFrameRingBufferOffset(texture.staging, imageIndex, tableOffset + texture.pageOffsets[mip] * sizeof(uint32_t));
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1 };
+		region.imageExtent = { texture.pageCounts[mip].width, texture.pageCounts[mip].height, 1 };
+		texture.pageTableCopies.push_back(region);
+	}
+}
+
+void DestroyVirtualTexture(const VkDevice& device, BindlessHeap& heap, VirtualTexture& texture)
+{
+	{
+		std::lock_guard<std::mutex> lock(texture.mutex);
+		texture.running = false;
+	}
+	texture.wake.notify_one();
+	if (texture.worker.joinable())
+		texture.worker.join();
+
+	ReleaseBindlessHandle(heap, BINDLESS_STORAGE_BUFFER, texture.infoHandle);
+	ReleaseBindlessHandle(heap, BINDLESS_SAMPLED_IMAGE, texture.cacheHandle);
+	ReleaseBindlessHandle(heap, BINDLESS_SAMPLED_IMAGE, texture.pageTableHandle);
+	ReleaseBindlessHandle(heap, BINDLESS_SAMPLER, texture.samplerHandle);
+	for (uint32_t handle : texture.feedbackHandles)
+		ReleaseBindlessHandle(heap, BINDLESS_STORAGE_BUFFER, handle);
+
+	DestroyVulkanTexture(device, texture.cache);
+	DestroyVulkanTexture(device, texture.pageTableImage);
+	vkDestroySampler(device, texture.sampler, nullptr);
+	vkDestroyBuffer(device, texture.infoBuffer, nullptr);
+	vkFreeMemory(device, texture.infoMemory, nullptr);
+	DestroyFrameRingBuffer(device, texture.staging);
+	DestroyFrameRingBuffer(device, texture.feedbackRing);
+
+	texture.infoHandle = texture.cacheHandle = texture.pageTableHandle = texture.samplerHandle = BINDLESS_INVALID_HANDLE;
+	texture.sampler = VK_NULL_HANDLE;
+	texture.infoBuffer = VK_NULL_HANDLE;
+	texture.infoMemory = VK_NULL_HANDLE;
+	texture.feedbackHandles.clear();
+	texture.pendingReads.clear();
+	texture.completedReads.clear();
+	texture.loadedPages.clear();
+}
+
+// Shader Hot Reload
+struct ShaderHotReloader
+{
+	struct Target
+	{
+		std::set<std::string> binaries;	//	ShaderAsset::binary of every stage, variants of one source rebuild separately.
+		std::function<void(VkPipelineLayout&, VkPipeline&)> build;
+		VkPipelineLayout* layout;
+		VkPipeline* pipeline;
+		std::function<void(VkPipeline, VkPipeline)> swapped;	//	Optional, gets the previous and the new pipeline.
+	};
+
+	struct Swap
+	{
+		size_t target;
+		VkPipelineLayout layout;
+		VkPipeline pipeline;
+	};
+
+	struct Retired
+	{
+		VkPipeline pipeline;
+		uint64_t frame;
+	};
+
+	std::vector<Target> targets;
+	std::vector<Swap> pendingSwaps;
+	std::deque<Retired> retired;	//	Main thread only, like frame.
+	uint64_t frame = 0;
+	std::mutex mutex;
+	std::atomic<bool> running{ false };
+	std::thread worker;
+};
+
+std::string GetShaderToolPath(const char* tool)
+{
+	const char* sdk = std::getenv("VULKAN_SDK");
+#if defined(_WIN32)
+	if (sdk) return std::string(sdk) + "/Bin/" + tool + ".exe";
+#else
+	if (sdk) return std::string(sdk) + "/bin/" + tool;
+#endif
+	return tool;
+}
+
+bool RunShaderTool(const char* tool, const std::string& arguments)
+{
+	std::string command = "\"" + GetShaderToolPath(tool) + "\" " + arguments;
+#if defined(_WIN32)
+	command = "\"" + command + "\"";
+#endif
+	return std::system(command.c_str()) == 0;
+}
+
+//	Same steps as :BuildShader in GenerateAssets.bat, minus the Release strip.
+bool CompileShaderAsset(const ShaderAsset& asset)
+{
+	//	Build next to the live binary so a failed build never clobbers a working shader.
+	std::string unoptimizedBinary = asset.binary + ".unopt";
+	std::string tempBinary = asset.binary + ".tmp";
+
+	bool compiled = RunShaderTool("glslc", asset.defines + " \"" + asset.source + "\" -o \"" + unoptimizedBinary + "\"") &&
+		RunShaderTool("spirv-opt", "-O \"" + unoptimizedBinary + "\" -o \"" + tempBinary + "\"") &&
+		RunShaderTool("spirv-val", "--target-env vulkan1.0 \"" + tempBinary + "\"");
+
+	std::error_code error;
+	std::filesystem::remove(unoptimizedBinary, error);
+	if (!compiled)
+	{
+		Print("Shaders: Failed to build %s from %s", asset.binary.c_str(), asset.source.c_str());
+		std::filesystem::remove(tempBinary, error);
+		return false;
+	}
+
+	std::filesystem::rename(tempBinary, asset.binary, error);
+	if (error)
+	{
+		Print("Shaders: Failed to replace %s - %s", asset.binary.c_str(), error.message().c_str());
+		return false;
+	}
+
+	Print("Shaders: Built %s", asset.binary.c_str());
+	return true;
+}
+
+//	Brings every binary up to date with its source before the first pipeline is created. Without the SDK tools an
+//	existing binary is kept even when it is older than its source, only a missing one is fatal.
+void BuildShaderAssets()
+{
+	for (const auto& asset : SHADER_ASSETS)
+	{
+		//	A shipped binary without its source is used as is.
+		std::error_code binaryError, sourceError;
+		auto binaryWriteTime = std::filesystem::last_write_time(asset.binary, binaryError);
+		auto sourceWriteTime = std::filesystem::last_write_time(asset.source, sourceError);
+		if (!binaryError && (sourceError || binaryWriteTime >= sourceWriteTime))
+			continue;
+
+		std::error_code error;
+		std::filesystem::create_directories(std::filesystem::path(asset.binary).parent_path(), error);
+		if (CompileShaderAsset(asset))
+			continue;
+
+		if (binaryError)
+			throw std::runtime_error("Shaders: " + asset.binary + " is missing and could not be built, install the Vulkan SDK or run GenerateAssets.bat!");
+		Print("Shaders: Using %s, which is older than %s", asset.binary.c_str(), asset.source.c_str());
+	}
+}
+
+void WatchShaderSources(ShaderHotReloader& reloader)
+{
+#if defined(__linux__)
+	int notifyHandle = inotify_init1(IN_NONBLOCK);
+	if (notifyHandle < 0 || inotify_add_watch(notifyHandle, SHADER_SOURCE_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		Print("Shader Hot Reload: Unable to watch %s", SHADER_SOURCE_DIR);
+		if (notifyHandle >= 0) close(notifyHandle);
+		return;
+	}
+#else
+	std::map<std::string, std::filesystem::file_time_type> writeTimes;
+	for (const auto& asset : SHADER_ASSETS)
+	{
+		std::error_code error;
+		writeTimes[asset.source] = std::filesystem::last_write_time(asset.source, error);
+	}
+#endif
+
+	while (reloader.running)
+	{
+		std::set<std::string> changedSources;
+
+#if defined(__linux__)
+		pollfd pollHandle{ notifyHandle, POLLIN, 0 };
+		if (poll(&pollHandle, 1, 250) > 0)
+		{
+			alignas(inotify_event) char buffer[4096];
+			ssize_t length;
+			while ((length = read(notifyHandle, buffer, sizeof(buffer))) > 0)
+			{
+				for (char* it = buffer; it < buffer + length;)
+				{
+					const auto* event = reinterpret_cast<const inotify_event*>(it);
+					if (event->len > 0)
+						changedSources.insert(std::string(SHADER_SOURCE_DIR) + "/" + event->name);
+					it += sizeof(inotify_event) + event->len;
+				}
+			}
+		}
+#else
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+		for (auto& [source, writeTime] : writeTimes)
+		{
+			std::error_code error;
+			auto currentWriteTime = std::filesystem::last_write_time(source, error);
+			if (!error && currentWriteTime != writeTime)
+			{
+				writeTime = currentWriteTime;
+				changedSources.insert(source);
+			}
+		}
+#endif
+
+		if (changedSources.empty())
+			continue;
+
+		//	Editors commonly save in several writes, give them a moment to settle.
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		//	Keyed by output, a variant that fails to build keeps its old binary and its pipelines.
+		std::set<std::string> compiledBinaries;
+		for (const auto& asset : SHADER_ASSETS)
+			if (changedSources.count(asset.source) && CompileShaderAsset(asset))
+				compiledBinaries.insert(asset.binary);
+
+		for (size_t i = 0; i < reloader.targets.size(); i++)
+		{
+			const auto& target = reloader.targets[i];
+			if (std::none_of(target.binaries.begin(), target.binaries.end(), [&](const std::string& binary) { return compiledBinaries.count(binary) > 0; }))
+				continue;
+
+			try
+			{
+				ShaderHotReloader::Swap swap{ i, VK_NULL_HANDLE, VK_NULL_HANDLE };
+				target.build(swap.layout, swap.pipeline);
+
+				std::lock_guard<std::mutex> lock(reloader.mutex);
+				reloader.pendingSwaps.push_back(swap);
+			}
+			catch (const std::exception& e)
+			{
+				Print("Shader Hot Reload: Keeping previous pipeline - %s", e.what());
+			}
+		}
+	}
+
+#if defined(__linux__)
+	close(notifyHandle);
+#endif
+}
+
+void StartShaderHotReload(ShaderHotReloader& reloader)
+{
+	reloader.running = true;
+	reloader.worker = std::thread(WatchShaderSources, std::ref(reloader));
+	Print("Shader Hot Reload: Watching %s", SHADER_SOURCE_DIR);
+}
+
+void StopShaderHotReload(ShaderHotReloader& reloader, const VkDevice& device)
+{
+	reloader.running = false;
+	if (reloader.worker.joinable())
+		reloader.worker.join();
+
+	//	Pipeline layouts are owned by the layout cache. The device must be idle for the retired pipelines.
+	for (const auto& swap : reloader.pendingSwaps)
+		vkDestroyPipeline(device, swap.pipeline, nullptr);
+	for (const auto& retired : reloader.retired)
+		vkDestroyPipeline(device, retired.pipeline, nullptr);
+	reloader.pendingSwaps.clear();
+	reloader.retired.clear();
+}
+
+//	Call once per frame after the frame's fence has signaled. Replaced pipelines may still be referenced by frames
+//	in flight, they are destroyed once those have retired. Returns true when a pipeline was replaced.
+bool ApplyShaderHotReload(ShaderHotReloader& reloader, const VkDevice& device)
+{
+	reloader.frame++;
+	while (!reloader.retired.empty() && reloader.retired.front().frame + MAX_FRAMES_IN_FLIGHT <= reloader.frame)
+	{
+		vkDestroyPipeline(device, reloader.retired.front().pipeline, nullptr);
+		reloader.retired.pop_front();
+	}
+
+	std::vector<ShaderHotReloader::Swap> swaps;
+	{
+		std::lock_guard<std::mutex> lock(reloader.mutex);
+		swaps.swap(reloader.pendingSwaps);
+	}
+
+	if (swaps.empty())
+		return false;
+
+	for (const auto& swap : swaps)
+	{
+		auto& target = reloader.targets[swap.target];
+		VkPipeline previous = *target.pipeline;
+		reloader.retired.push_back({ previous, reloader.frame });
+		*target.pipeline = swap.pipeline;
+		*target.layout = swap.layout;
+
+		if (target.swapped)
+			target.swapped(previous, swap.pipeline);
+	}
+
+	Print("Shader Hot Reload: Swapped %i pipeline(s)", static_cast<int>(swaps.size()));
+	return true;
+}
+
+int main(int argc, char* args[])
+{
+	//	Local Variables
 	uint32_t apiVersion;
 	bool isRunning = true;
 	std::vector<const char*> extensions{};
@@ -813,32 +8429,59 @@ int main(int argc, char* args[])
 	VkSurfaceKHR surface = VK_NULL_HANDLE;
 	VkPhysicalDevice vkPhysicalDevice = VK_NULL_HANDLE;
 	VkDevice vkDevice = VK_NULL_HANDLE;
-	VkQueue vkGraphicsQueue, vkPresentQueue;
+	VkQueue vkGraphicsQueue, vkPresentQueue, vkTransferQueue, vkComputeQueue;
 	VkSwapchainKHR vkSwapchain = VK_NULL_HANDLE;
 	VkSurfaceFormatKHR vkSurfaceFormat;
 	VkExtent2D vkExtent;
-	VkRenderPass vkRenderPass = VK_NULL_HANDLE;
-	VkPipelineLayout vkPipelineLayout = VK_NULL_HANDLE;
-	VkPipeline vkPipeline = VK_NULL_HANDLE;
+	FrameGraph frameGraph;
+	PipelineLayoutCache pipelineLayoutCache;
+	GraphicsPipelineCache graphicsPipelineCache;
+	UploadEngine uploadEngine;
+	AsyncComputeContext asyncCompute;
+	Mesh triangleMesh;
+	std::vector<InstanceData> sceneInstances;
+	CullingBounds sceneBounds;
+	GpuDrivenScene gpuScene;
+	std::vector<uint8_t> sceneVisibility;
+	FrameRingBuffer frameRing;
+	DescriptorSetCache descriptorCache;
+	BindlessHeap bindlessHeap;
+	TextureStreamer textureStreamer;
+	uint32_t sceneTexture = UINT32_MAX;		//	The streamed texture the scene material samples.
+	VirtualTexture virtualTexture;
+	VkBuffer materialBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory materialMemory = VK_NULL_HANDLE;
+	InstanceBatcher instanceBatcher;
 	VkCommandPool vkCommandPool = VK_NULL_HANDLE;
 	std::vector<VkImage> vkChainImages;
 	std::vector<VkImageView> vkChainImageViews;
-	std::vector<VkFramebuffer> vkChainFramebuffers;
 	std::vector<VkCommandBuffer> vkCommandBuffers;
 	std::vector<VkSemaphore> vkImageAvailableSemaphores;
 	std::vector<VkSemaphore> vkRenderFinishedSemaphores;
 	std::vector<VkFence> vkInFlightFences;
 	std::vector<VkFence> vkImagesInFlight;
+	ShaderHotReloader shaderHotReloader;
 	size_t currentFrame = 0;
 
 
 	//	=============================================================
 
+	if (argc > 1 && strcmp(args[1], "--bake-textures") == 0)
+		return BakeTextures(argc, args);
+	if (argc > 1 && strcmp(args[1], "--benchmark-culling") == 0)
+		return BenchmarkCulling();
+	if (argc > 1 && strcmp(args[1], "--benchmark-mips") == 0)
+		return BenchmarkMips();
+	if (argc > 1 && strcmp(args[1], "--test-radix-sort") == 0)
+		return TestRadixSort();
+
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
 
 	auto* sdlWindow = SDL_CreateWindow("Hello Vulkan", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 800, 600, SDL_WINDOW_SHOWN | SDL_WINDOW_VULKAN);
 
 	try {
+		BuildShaderAssets();
+
 		GetAndCheckVulkanAPISupport(apiVersion);
 
 		GetVulkanExtensions(sdlWindow, extensions);
@@ -856,7 +8499,7 @@ int main(int argc, char* args[])
 
 		GetVulkanPhysicalDevice(vkInstance, surface, vkPhysicalDevice);
 
-		CreateVulkanLogicalDevice(vkPhysicalDevice, surface, layers, vkDevice, vkGraphicsQueue, vkPresentQueue);
+		CreateVulkanLogicalDevice(vkPhysicalDevice, surface, layers, vkDevice, vkGraphicsQueue, vkPresentQueue, vkTransferQueue, vkComputeQueue);
 
 		CreateVulkanSwapchain(surface, vkPhysicalDevice, vkDevice, vkSwapchain, vkSurfaceFormat, vkExtent);
 
@@ -864,18 +8507,319 @@ int main(int argc, char* args[])
 
 		CreateVulkanImageViews(vkDevice, vkSurfaceFormat, vkChainImages, vkChainImageViews);
 
-		CreateVulkanRenderPass(vkDevice, vkSurfaceFormat, vkRenderPass);
+		CreateVulkanCommandPool(vkPhysicalDevice, vkDevice, surface, vkCommandPool);
 
-		CreateVulkanGraphicsPipeline(vkDevice, vkExtent, vkRenderPass, vkPipelineLayout, vkPipeline);
+		CreateUploadEngine(vkPhysicalDevice, vkDevice, surface, vkTransferQueue, vkGraphicsQueue, uploadEngine);
 
-		CreateVulkanFramebuffers(vkDevice, vkExtent, vkRenderPass, vkChainImageViews, vkChainFramebuffers);
+		CreateAsyncComputeContext(vkPhysicalDevice, vkDevice, surface, vkComputeQueue, asyncCompute);
 
-		CreateVulkanCommandPool(vkPhysicalDevice, vkDevice, surface, vkCommandPool);
+		//	Separate streams let the depth prepass fetch positions only.
+		MeshData triangleData = CreateTriangleMeshData();
+		if (depthPrepass)
+			triangleData.format.layout = VERTEX_LAYOUT_SOA;
+
+		CreateVulkanMesh(vkPhysicalDevice, vkDevice, uploadEngine, triangleData, triangleMesh);
+
+		//	The triangle is specified in clip space, so its frustum is that of an identity view projection.
+		const float viewProjection[16] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+		FrustumPlanes frustum;
+		ExtractFrustumPlanes(viewProjection, frustum);
+
+		//	A grid of triangle instances covering the screen.
+		float meshMin[3], meshMax[3];
+		GetMeshDataBounds(triangleData, meshMin, meshMax);
+
+		for (uint32_t y = 0; y < instanceGridSize; y++)
+		{
+			for (uint32_t x = 0; x < instanceGridSize; x++)
+			{
+				float cellSize = 2.0f / instanceGridSize;
+				InstanceData instance = { { -1.0f + (x + 0.5f) * cellSize, -1.0f + (y + 0.5f) * cellSize, 0.0f }, cellSize * 0.9f };
+				sceneInstances.push_back(instance);
+
+				float boundsMin[3], boundsMax[3];
+				GetInstanceBounds(instance, meshMin, meshMax, boundsMin, boundsMax);
+				AddCullingAABB(sceneBounds, boundsMin, boundsMax);
+			}
+		}
+
+		VertexFormat sceneFormat = triangleMesh.format;
+		sceneFormat.instanced = true;
+
+		const uint32_t sceneMaterial = 0;
+		uint32_t sceneBucket = 0, sceneBatch = 0;
+		if (gpuDrivenRendering)
+		{
+			sceneBucket = AddGpuDrawBucket(gpuScene, triangleMesh);
+			for (const auto& instance : sceneInstances)
+				AddGpuDrawObject(gpuScene, sceneBucket, triangleMesh, meshMin, meshMax, instance);
+			memcpy(gpuScene.viewProjection, viewProjection, sizeof(viewProjection));
+			gpuScene.occlusionCulling = occlusionCulling;
+			CreateGpuDrivenScene(vkPhysicalDevice, vkDevice, uploadEngine, asyncCompute, static_cast<uint32_t>(vkChainImages.size()), frameGraph, descriptorCache, gpuScene);
+		}
+		else
+		{
+			sceneBatch = AddInstanceBatch(instanceBatcher, triangleMesh, sceneMaterial, static_cast<uint32_t>(sceneInstances.size()));
+			CreateInstanceBatcher(frameRing, instanceBatcher);
+		}
+
+		CreateFrameRingBuffer(vkPhysicalDevice, vkDevice, static_cast<uint32_t>(vkChainImages.size()), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, frameRing);
+
+		//	Without descriptor indexing the forward pass falls back to the plain vertex color shader.
+		bool bindless = bindlessResources && descriptorIndexingEnabled;
+		uint32_t materialHandle = BINDLESS_INVALID_HANDLE;
+		bool virtualTexturing = false;
+		if (bindless)
+		{
+			CreateBindlessHeap(vkPhysicalDevice, vkDevice, pipelineLayoutCache, bindlessHeap);
+
+			const BindlessMaterial materials[] = { { { 1.0f, 1.0f, 1.0f, 1.0f } } };
+			CreateVulkanBuffer(vkPhysicalDevice, vkDevice, sizeof(materials), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, materialBuffer, materialMemory);
+			QueueBufferUpload(uploadEngine, materials, sizeof(materials), materialBuffer, 0, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+			materialHandle = RegisterBindlessBuffer(vkDevice, bindlessHeap, materialBuffer);
+
+			//	The terrain is paged through a virtual texture, too large to stream whole.
+			if (std::filesystem::exists(virtualTexturePath))
+			{
+				try
+				{
+					CreateVirtualTexture(vkPhysicalDevice, vkDevice, vkCommandPool, vkGraphicsQueue, uploadEngine, bindlessHeap, virtualTexturePath, static_cast<uint32_t>(vkChainImages.size()), vkExtent, virtualTexture);
+					virtualTexturing = true;
+				}
+				catch (const std::exception& e)
+				{
+					Print("Virtual Texture: disabled - %s", e.what());
+					DestroyVirtualTexture(vkDevice, bindlessHeap, virtualTexture);
+				}
+			}
+
+			//	The scene material's base color streams in through the heap, from the first baked texture that can stream.
+			CreateTextureStreamer(vkPhysicalDevice, vkDevice, bindlessHeap, textureStreamer);
+			std::vector<std::filesystem::path> texturePaths;
+			std::error_code error;
+			for (const auto& entry : std::filesystem::directory_iterator(TEXTURE_DIR, error))
+				if (entry.path().extension() == ".ktx2" && entry.path() != virtualTexturePath)
+					texturePaths.push_back(entry.path());
+			std::sort(texturePaths.begin(), texturePaths.end());
+
+			for (const auto& path : texturePaths)
+			{
+				try
+				{
+					sceneTexture = AddStreamedTexture(vkPhysicalDevice, vkDevice, uploadEngine, bindlessHeap, textureStreamer, path.string());
+					break;
+				}
+				catch (const std::exception& e)
+				{
+					Print("Texture Streaming: skipping %s - %s", path.string().c_str(), e.what());
+				}
+			}
+		}
+
+		FlushUploads(vkPhysicalDevice, vkDevice, uploadEngine);
+
+		CreateVulkanPipelineCache(vkDevice, graphicsPipelineCache);
+
+		CreateDescriptorSetCache(DESCRIPTOR_SET_CACHE_GENERATION_FRAMES, descriptorCache);
+
+		ShaderPermutation forwardPermutation;
+		forwardPermutation.constants[SHADER_CONSTANT_SHADING_MODE] = SHADING_MODE_VERTEX_COLOR;
+
+		uint32_t backbuffer = ImportFrameGraphImage(frameGraph, "Backbuffer", vkChainImages, vkChainImageViews, vkSurfaceFormat.format, vkExtent,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+		//	The Hi-Z build samples the depth buffer.
+		bool sampledDepth = gpuDrivenRendering && occlusionCulling;
+
+		VkFormat depthFormat;
+		GetVulkanDepthFormat(vkPhysicalDevice, sampledDepth, depthFormat);
+
+		VkSampleCountFlagBits samples;
+		GetVulkanSampleCount(vkPhysicalDevice, msaaSamples, sampledDepth, samples);
+
+		//	Multisampled attachments are resolved inside the render pass, their samples never reach memory.
+		uint32_t depth = CreateFrameGraphImage(frameGraph, "Depth", depthFormat, vkExtent, samples);
+		uint32_t color = samples > VK_SAMPLE_COUNT_1_BIT ? CreateFrameGraphImage(frameGraph, "Color", vkSurfaceFormat.format, vkExtent, samples) : backbuffer;
+
+		VkClearValue depthClear{};
+		depthClear.depthStencil = { 1.0f, 0 };
+
+		//	With occlusion culling the scene is drawn twice, last frame's visible set first and then whatever the
+		//	Hi-Z test of the remaining objects lets through. Each phase is its own render pass.
+		struct ScenePhase
+		{
+			FrameGraphPass* prepass = nullptr;
+			FrameGraphPass* forwardPass = nullptr;
+			GraphicsPipelineState prepassState;
+			GraphicsPipelineState forwardState;
+			GraphicsPipelineCache::Entry* prepassPipeline = nullptr;
+			GraphicsPipelineCache::Entry* forwardPipeline = nullptr;
+		};
+
+		if (virtualTexturing)
+			AddVirtualTextureUploadPass(frameGraph, virtualTexture);
+
+		std::vector<ScenePhase> scenePhases(gpuDrivenRendering ? gpuScene.phaseCount : 1);
+		for (size_t phaseIndex = 0; phaseIndex < scenePhases.size(); phaseIndex++)
+		{
+			auto& phase = scenePhases[phaseIndex];
+			bool firstPhase = phaseIndex == 0;
+			bool lastPhase = phaseIndex + 1 == scenePhases.size();
+
+			if (!firstPhase)
+				AddGpuOcclusionPasses(vkDevice, frameGraph, descriptorCache, gpuScene, depth);
+
+			//	The prepass and the forward pass end up as two subpasses of one render pass, the depth buffer never leaves tile memory.
+			if (depthPrepass)
+			{
+				phase.prepass = &AddFrameGraphPass(frameGraph, firstPhase ? "DepthPrepass" : "DepthPrepassLate", FRAME_GRAPH_PASS_RASTER);
+				if (firstPhase)
+					phase.prepass->Clear(depth, FRAME_GRAPH_ACCESS_DEPTH_ATTACHMENT, depthClear);
+				else
+					phase.prepass->Modify(depth, FRAME_GRAPH_ACCESS_DEPTH_ATTACHMENT);
+				if (gpuDrivenRendering)
+					ReadGpuDrawCommands(*phase.prepass, gpuScene);
+			}
+
+			phase.forwardPass = &AddFrameGraphPass(frameGraph, firstPhase ? "Forward" : "ForwardLate", FRAME_GRAPH_PASS_RASTER);
+			if (firstPhase)
+				phase.forwardPass->Clear(color, FRAME_GRAPH_ACCESS_COLOR_ATTACHMENT, { 0.0f, 0.0f, 0.0f, 1.0f });
+			else
+				phase.forwardPass->Modify(color, FRAME_GRAPH_ACCESS_COLOR_ATTACHMENT);
+			if (color != backbuffer && lastPhase)
+				phase.forwardPass->Resolve(color, backbuffer);
+			if (depthPrepass)
+				phase.forwardPass->Read(depth, FRAME_GRAPH_ACCESS_DEPTH_READ);
+			else if (firstPhase)
+				phase.forwardPass->Clear(depth, FRAME_GRAPH_ACCESS_DEPTH_ATTACHMENT, depthClear);
+			else
+				phase.forwardPass->Modify(depth, FRAME_GRAPH_ACCESS_DEPTH_ATTACHMENT);
+			if (gpuDrivenRendering)
+				ReadGpuDrawCommands(*phase.forwardPass, gpuScene);
+			if (virtualTexturing)
+				ReadVirtualTexture(*phase.forwardPass, virtualTexture);
+		}
+
+		if (virtualTexturing)
+			AddVirtualTextureFeedbackPass(frameGraph);
+
+		CompileFrameGraph(vkPhysicalDevice, vkDevice, frameGraph);
+
+		if (gpuDrivenRendering)
+			CreateGpuCullingPipeline(vkDevice, frameGraph, pipelineLayoutCache, graphicsPipelineCache, gpuScene);
+
+		//	Both raster passes draw the same objects, from the GPU culled indirect commands or the CPU built instance batches.
+		DrawPacketQueue drawPackets;
+		auto drawScene = [&](const VkCommandBuffer& cmdBuffer, uint32_t imageIndex, const GraphicsPipelineCache::Entry& pipeline, GpuDrawPhase phase, bool shaded)
+		{
+			//	The heap stays bound across every draw of the pass, only the material index is pushed per draw.
+			bool pushMaterials = bindless && shaded;
+			PushConstantBuilder<BindlessDrawConstants> materialConstants;
+			if (pushMaterials)
+			{
+				BindBindlessHeap(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout, bindlessHeap);
+				BindPushConstants(materialConstants, pipeline.layout, GetCachedPushConstantRange(pipelineLayoutCache, pipeline.layout));
+				materialConstants.Set(&BindlessDrawConstants::materialBuffer, materialHandle).Set(&BindlessDrawConstants::material, sceneMaterial);
+				SetVirtualTextureConstants(materialConstants, virtualTexture, imageIndex);
+				materialConstants.Set(&BindlessDrawConstants::baseColorTexture, sceneTexture != UINT32_MAX ? GetStreamedTextureHandle(textureStreamer, sceneTexture) : BINDLESS_INVALID_HANDLE)
+					.Set(&BindlessDrawConstants::baseColorSampler, textureStreamer.samplerHandle);
+			}
+
+			if (gpuDrivenRendering)
+			{
+				vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.pipeline);
+				const Mesh& bucketMesh = *gpuScene.buckets[sceneBucket].mesh;
+				BindVulkanMesh(cmdBuffer, bucketMesh);
+				BindVulkanInstances(cmdBuffer, bucketMesh, gpuScene.instanceBuffer, 0);
+				FlushPushConstants(cmdBuffer, materialConstants);
+				DrawGpuBucket(cmdBuffer, frameGraph, gpuScene, imageIndex, sceneBucket, phase);
+				return;
+			}
+
+			DrawPacket state;
+			state.pipeline = pipeline.pipeline;
+			state.layout = pipeline.layout;
+
+			BeginDrawPackets(drawPackets);
+			QueueInstanceBatches(drawPackets, instanceBatcher, imageIndex, sceneMaterial, state, 0);
+			SortDrawPackets(drawPackets);
+			RecordDrawPackets(cmdBuffer, drawPackets, pushMaterials ? &materialConstants : nullptr);
+		};
 
-		CreateVulkanCommandBuffers(vkDevice, vkCommandPool, vkRenderPass, vkPipeline, vkExtent, vkChainFramebuffers, vkCommandBuffers);
+		for (size_t phaseIndex = 0; phaseIndex < scenePhases.size(); phaseIndex++)
+		{
+			auto& phase = scenePhases[phaseIndex];
+			GpuDrawPhase drawPhase = static_cast<GpuDrawPhase>(phaseIndex);
+
+			if (bindless)
+				phase.forwardState.fragmentShader = SHADER_ASSETS[SHADER_ASSET_FORWARD_FRAG_BINDLESS].binary;
+			phase.forwardState.renderPass = phase.forwardPass->renderPass;
+			phase.forwardState.subpass = phase.forwardPass->subpass;
+			phase.forwardState.depthMode = depthPrepass ? DEPTH_MODE_EQUAL : DEPTH_MODE_WRITE;
+			phase.forwardState.samples = samples;
+
+			phase.forwardPipeline = &GetVulkanGraphicsPipelinePermutation(vkDevice, vkExtent, phase.forwardState, pipelineLayoutCache, graphicsPipelineCache, sceneFormat, forwardPermutation);
+
+			phase.forwardPass->execute = [&, drawPhase, pipeline = phase.forwardPipeline](const VkCommandBuffer& cmdBuffer, uint32_t imageIndex) { drawScene(cmdBuffer, imageIndex, *pipeline, drawPhase, true); };
+
+			if (phase.prepass)
+			{
+				phase.prepassState.vertexShader = SHADER_ASSETS[SHADER_ASSET_DEPTH_VERT].binary;
+				phase.prepassState.fragmentShader.clear();
+				phase.prepassState.renderPass = phase.prepass->renderPass;
+				phase.prepassState.subpass = phase.prepass->subpass;
+				phase.prepassState.depthMode = DEPTH_MODE_WRITE;
+				phase.prepassState.samples = samples;
+
+				phase.prepassPipeline = &GetVulkanGraphicsPipelinePermutation(vkDevice, vkExtent, phase.prepassState, pipelineLayoutCache, graphicsPipelineCache, sceneFormat, ShaderPermutation());
+
+				phase.prepass->execute = [&, drawPhase, pipeline = phase.prepassPipeline](const VkCommandBuffer& cmdBuffer, uint32_t imageIndex) { drawScene(cmdBuffer, imageIndex, *pipeline, drawPhase, false); };
+			}
+		}
+
+		CreateVulkanCommandBuffers(vkDevice, vkCommandPool, MAX_FRAMES_IN_FLIGHT, vkCommandBuffers);
 
 		CreateVulkanSyncObjects(vkDevice, vkChainImages, vkImageAvailableSemaphores, vkRenderFinishedSemaphores, vkInFlightFences, vkImagesInFlight);
 
+		if (shaderHotReload)
+		{
+			auto replaceDrawPipeline = [&](VkPipeline previous, VkPipeline current) { ReplaceDrawPacketPipeline(drawPackets, previous, current); };
+			for (const auto& phase : scenePhases)
+			{
+				shaderHotReloader.targets.push_back({ { phase.forwardState.vertexShader, phase.forwardState.fragmentShader },
+					[&, forwardState = phase.forwardState, forwardPermutation, sceneFormat](VkPipelineLayout& layout, VkPipeline& pipeline) { CreateVulkanGraphicsPipeline(vkDevice, vkExtent, forwardState, pipelineLayoutCache, sceneFormat, forwardPermutation, graphicsPipelineCache.vkPipelineCache, layout, pipeline); },
+					&phase.forwardPipeline->layout, &phase.forwardPipeline->pipeline, replaceDrawPipeline });
+				if (phase.prepassPipeline)
+				{
+					shaderHotReloader.targets.push_back({ { phase.prepassState.vertexShader },
+						[&, prepassState = phase.prepassState, sceneFormat](VkPipelineLayout& layout, VkPipeline& pipeline) { CreateVulkanGraphicsPipeline(vkDevice, vkExtent, prepassState, pipelineLayoutCache, sceneFormat, ShaderPermutation(), graphicsPipelineCache.vkPipelineCache, layout, pipeline); },
+						&phase.prepassPipeline->layout, &phase.prepassPipeline->pipeline, replaceDrawPipeline });
+				}
+			}
+
+			auto addComputeTarget = [&](const ShaderAsset& asset, GraphicsPipelineCache::Entry* entry)
+			{
+				shaderHotReloader.targets.push_back({ { asset.binary },
+					[&, binary = asset.binary](VkPipelineLayout& layout, VkPipeline& pipeline) { CreateVulkanComputePipeline(vkDevice, binary, pipelineLayoutCache, ShaderPermutation(), graphicsPipelineCache.vkPipelineCache, layout, pipeline); },
+					&entry->layout, &entry->pipeline,
+					[&](VkPipeline, VkPipeline) { UpdateGpuDrivenLayouts(vkDevice, frameGraph, pipelineLayoutCache, gpuScene); } });
+			};
+
+			if (gpuDrivenRendering)
+			{
+				addComputeTarget(SHADER_ASSETS[occlusionCulling ? SHADER_ASSET_CULL_EARLY : SHADER_ASSET_CULL], gpuScene.cullPipelines[GPU_DRAW_PHASE_EARLY]);
+				if (occlusionCulling)
+				{
+					bool multisampled = samples > VK_SAMPLE_COUNT_1_BIT;
+					addComputeTarget(SHADER_ASSETS[SHADER_ASSET_CULL_LATE], gpuScene.cullPipelines[GPU_DRAW_PHASE_LATE]);
+					addComputeTarget(SHADER_ASSETS[SHADER_ASSET_HIZ], gpuScene.hiZPipeline);
+					if (multisampled)
+						addComputeTarget(SHADER_ASSETS[SHADER_ASSET_HIZ_MS], gpuScene.hiZFirstPipeline);
+				}
+			}
+			StartShaderHotReload(shaderHotReloader);
+		}
+
 		while (isRunning)
 		{
 			//	Handle Events
@@ -888,8 +8832,25 @@ int main(int argc, char* args[])
 			default: break;
 			}
 
+			CollectUploads(vkDevice, uploadEngine);
+
 			//	Drawing Code
 			vkWaitForFences(vkDevice, 1, &vkInFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+			ApplyShaderHotReload(shaderHotReloader, vkDevice);
+			AdvanceDescriptorSetCache(vkDevice, descriptorCache);
+
+			//	Also drives texture streaming with GPU driven rendering, whose own cull never reaches the CPU.
+			CullFrustum(frustum, sceneBounds, sceneVisibility);
+
+			if (bindless)
+			{
+				AdvanceBindlessHeap(bindlessHeap);
+
+				if (sceneTexture != UINT32_MAX)
+					RequestStreamedTextureInstances(textureStreamer, sceneTexture, sceneInstances, sceneVisibility, vkExtent);
+				UpdateTextureStreaming(vkPhysicalDevice, vkDevice, uploadEngine, bindlessHeap, textureStreamer);
+				FlushUploads(vkPhysicalDevice, vkDevice, uploadEngine);
+			}
 
 			uint32_t imageIndex;
 			vkAcquireNextImageKHR(vkDevice, vkSwapchain, UINT64_MAX, vkImageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
@@ -899,17 +8860,37 @@ int main(int argc, char* args[])
 			}
 			vkImagesInFlight[imageIndex] = vkInFlightFences[currentFrame];
 
+			//	The image's previous submission has completed, so its ring region is free to rewrite.
+			if (virtualTexturing)
+				UpdateVirtualTexture(virtualTexture, imageIndex);
+
+			if (gpuDrivenRendering && gpuScene.asyncCull)
+				SubmitGpuCullAsync(vkDevice, descriptorCache, asyncCompute, gpuScene, currentFrame, imageIndex);
+
+			if (!gpuDrivenRendering)
+			{
+				BeginInstanceBatches(instanceBatcher, imageIndex);
+				for (size_t i = 0; i < sceneInstances.size(); i++)
+					if (sceneVisibility[i])
+						AddInstance(instanceBatcher, sceneBatch, sceneInstances[i]);
+				EndInstanceBatches(instanceBatcher);
+			}
+
+			RecordVulkanCommandBuffer(vkCommandBuffers[currentFrame], frameGraph, imageIndex);
+
 			VkSubmitInfo submitInfo{};
 			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-			VkSemaphore waitSemaphores[] = { vkImageAvailableSemaphores[currentFrame] };
-			VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-			submitInfo.waitSemaphoreCount = 1;
-			submitInfo.pWaitSemaphores = waitSemaphores;
-			submitInfo.pWaitDstStageMask = waitStages;
+			std::vector<VkSemaphore> waitSemaphores = { vkImageAvailableSemaphores[currentFrame] };
+			std::vector<VkPipelineStageFlags> waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+			AddAsyncComputeWait(asyncCompute, currentFrame, waitSemaphores, waitStages);
+
+			submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+			submitInfo.pWaitSemaphores = waitSemaphores.data();
+			submitInfo.pWaitDstStageMask = waitStages.data();
 
 			submitInfo.commandBufferCount = 1;
-			submitInfo.pCommandBuffers = &vkCommandBuffers[imageIndex];
+			submitInfo.pCommandBuffers = &vkCommandBuffers[currentFrame];
 
 			VkSemaphore signalSemaphores[] = { vkRenderFinishedSemaphores[currentFrame] };
 			submitInfo.signalSemaphoreCount = 1;
@@ -943,30 +8924,51 @@ int main(int argc, char* args[])
 		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Exception Thrown", e.what(), nullptr);
 	}
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	//	Startup may have thrown before the device or the frame objects existed.
+	if (vkDevice != VK_NULL_HANDLE)
 	{
-		vkDestroySemaphore(vkDevice, vkRenderFinishedSemaphores[i], nullptr);
-		vkDestroySemaphore(vkDevice, vkImageAvailableSemaphores[i], nullptr);
-		vkDestroyFence(vkDevice, vkInFlightFences[i], nullptr);
-	}
+		vkDeviceWaitIdle(vkDevice);
 
-	vkDestroyCommandPool(vkDevice, vkCommandPool, nullptr);
+		StopShaderHotReload(shaderHotReloader, vkDevice);
 
-	for (auto framebuffer : vkChainFramebuffers)
-		vkDestroyFramebuffer(vkDevice, framebuffer, nullptr);
+		DestroyVulkanMesh(vkDevice, triangleMesh);
+		DestroyFrameRingBuffer(vkDevice, frameRing);
+		DestroyUploadEngine(vkDevice, uploadEngine);
+		DestroyAsyncComputeContext(vkDevice, asyncCompute);
 
-	vkDestroyPipeline(vkDevice, vkPipeline, nullptr);
-	vkDestroyPipelineLayout(vkDevice, vkPipelineLayout, nullptr);
-	vkDestroyRenderPass(vkDevice, vkRenderPass, nullptr);
+		for (size_t i = 0; i < vkInFlightFences.size(); i++)
+		{
+			vkDestroySemaphore(vkDevice, vkRenderFinishedSemaphores[i], nullptr);
+			vkDestroySemaphore(vkDevice, vkImageAvailableSemaphores[i], nullptr);
+			vkDestroyFence(vkDevice, vkInFlightFences[i], nullptr);
+		}
+
+		vkDestroyCommandPool(vkDevice, vkCommandPool, nullptr);
+
+		DestroyGraphicsPipelineCache(vkDevice, graphicsPipelineCache);
+		DestroyPipelineLayoutCache(vkDevice, pipelineLayoutCache);
+		DestroyFrameGraph(vkDevice, frameGraph);
+		DestroyGpuDrivenScene(vkDevice, gpuScene);
+		DestroyDescriptorSetCache(vkDevice, descriptorCache);
+		DestroyTextureStreamer(vkDevice, bindlessHeap, textureStreamer);
+		DestroyVirtualTexture(vkDevice, bindlessHeap, virtualTexture);
+		DestroyBindlessHeap(vkDevice, pipelineLayoutCache, bindlessHeap);
+		vkDestroyBuffer(vkDevice, materialBuffer, nullptr);
+		vkFreeMemory(vkDevice, materialMemory, nullptr);
 
-	for (auto imageView : vkChainImageViews)
-		vkDestroyImageView(vkDevice, imageView, nullptr);
+		for (auto imageView : vkChainImageViews)
+			vkDestroyImageView(vkDevice, imageView, nullptr);
 
-	vkDestroySwapchainKHR(vkDevice, vkSwapchain, nullptr);
-	vkDestroyDevice(vkDevice, nullptr);
-	vkDestroySurfaceKHR(vkInstance, surface, nullptr);
-	_vkDestroyDebugUtilsMessengerEXT(vkInstance, vkDebugMessenger, nullptr);
-	vkDestroyInstance(vkInstance, nullptr);
+		vkDestroySwapchainKHR(vkDevice, vkSwapchain, nullptr);
+		vkDestroyDevice(vkDevice, nullptr);
+	}
+
+	if (vkInstance != VK_NULL_HANDLE)
+	{
+		vkDestroySurfaceKHR(vkInstance, surface, nullptr);
+		_vkDestroyDebugUtilsMessengerEXT(vkInstance, vkDebugMessenger, nullptr);
+		vkDestroyInstance(vkInstance, nullptr);
+	}
 
 	return 0;
 }
\ No newline at end of file
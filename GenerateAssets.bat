@@ -1,3 +1,70 @@
-C:/GameDev/VulkanSDK/1.2.148.1/Bin/glslc.exe Shaders/GLSL/shader.vert -o Shaders/SPIR-V/vert.spv
-C:/GameDev/VulkanSDK/1.2.148.1/Bin/glslc.exe Shaders/GLSL/shader.frag -o Shaders/SPIR-V/frag.spv
-pause
\ No newline at end of file
+@echo off
+setlocal EnableDelayedExpansion
+
+rem Usage: GenerateAssets.bat [Debug^|Release]
+rem Shaders are compiled with glslc, optimized with spirv-opt and validated with spirv-val.
+rem Release additionally strips debug names and line info from the shipped SPIR-V.
+rem Textures in Textures/Source are baked to BC compressed KTX2 by the engine build of the same configuration,
+rem unchanged ones are skipped. Release bakes at high quality.
+
+if defined VULKAN_SDK (set VULKAN_BIN=%VULKAN_SDK%/Bin) else (set VULKAN_BIN=C:/GameDev/VulkanSDK/1.2.148.1/Bin)
+
+set CONFIG=%~1
+if "%CONFIG%"=="" set CONFIG=Debug
+
+set OPT_FLAGS=-O
+if /i "%CONFIG%"=="Release" set OPT_FLAGS=-O --strip-debug
+
+set TEXTURE_QUALITY=normal
+if /i "%CONFIG%"=="Release" set TEXTURE_QUALITY=high
+set TEXTURE_BAKER=Bin\x64\%CONFIG%\AVulkan.exe
+
+echo Building shaders (%CONFIG%)
+set FAILED=0
+if not exist Shaders\SPIR-V mkdir Shaders\SPIR-V
+
+rem Keep in sync with SHADER_ASSETS in AVulkan.cpp
+call :BuildShader Shaders/GLSL/shader.vert Shaders/SPIR-V/vert.spv
+call :BuildShader Shaders/GLSL/shader.frag Shaders/SPIR-V/frag.spv
+call :BuildShader Shaders/GLSL/depth.vert Shaders/SPIR-V/depth_vert.spv
+call :BuildShader Shaders/GLSL/cull.comp Shaders/SPIR-V/cull_comp.spv
+call :BuildShader Shaders/GLSL/cull.comp Shaders/SPIR-V/cull_early_comp.spv -DOCCLUSION_EARLY
+call :BuildShader Shaders/GLSL/cull.comp Shaders/SPIR-V/cull_late_comp.spv -DOCCLUSION_LATE
+call :BuildShader Shaders/GLSL/hiz.comp Shaders/SPIR-V/hiz_comp.spv
+call :BuildShader Shaders/GLSL/hiz.comp Shaders/SPIR-V/hiz_ms_comp.spv -DMULTISAMPLED
+call :BuildShader Shaders/GLSL/shader.frag Shaders/SPIR-V/frag_bindless.spv -DBINDLESS
+
+if %FAILED% neq 0 (echo Shader build failed.) else (echo Shader build succeeded.)
+
+echo Baking textures (%TEXTURE_QUALITY%)
+if exist "%TEXTURE_BAKER%" (
+	"%TEXTURE_BAKER%" --bake-textures Textures/Source Textures %TEXTURE_QUALITY% || set FAILED=1
+) else (
+	echo %TEXTURE_BAKER% not found, build the %CONFIG% configuration to bake textures.
+)
+pause
+exit /b %FAILED%
+
+:BuildShader
+set SOURCE=%~1
+set OUTPUT=%~2
+set DEFINES=%~3
+set UNOPTIMIZED=%OUTPUT%.unopt
+
+"%VULKAN_BIN%/glslc.exe" %DEFINES% "%SOURCE%" -o "%UNOPTIMIZED%" || (set FAILED=1& exit /b 1)
+"%VULKAN_BIN%/spirv-opt.exe" %OPT_FLAGS% "%UNOPTIMIZED%" -o "%OUTPUT%" || (set FAILED=1& exit /b 1)
+"%VULKAN_BIN%/spirv-val.exe" --target-env vulkan1.0 "%OUTPUT%" || (set FAILED=1& exit /b 1)
+
+call :MeasureShader "%UNOPTIMIZED%" BEFORE_SIZE BEFORE_COUNT
+call :MeasureShader "%OUTPUT%" AFTER_SIZE AFTER_COUNT
+set /a SIZE_DELTA=AFTER_SIZE-BEFORE_SIZE
+set /a COUNT_DELTA=AFTER_COUNT-BEFORE_COUNT
+echo %OUTPUT%: %BEFORE_SIZE% -^> %AFTER_SIZE% bytes (%SIZE_DELTA%), %BEFORE_COUNT% -^> %AFTER_COUNT% instructions (%COUNT_DELTA%)
+
+del "%UNOPTIMIZED%"
+exit /b 0
+
+:MeasureShader
+set %2=%~z1
+for /f %%C in ('call "%VULKAN_BIN%/spirv-dis.exe" --no-header "%~1" ^| find /c /v ""') do set %3=%%C
+exit /b 0
\ No newline at end of file
@@ -0,0 +1,13 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 inPosition;
+
+//  Must match shader.vert.
+layout(location = 4) in vec4 inInstance;
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = vec4(inPosition * inInstance.w + inInstance.xyz, 1.0);
+}
\ No newline at end of file
@@ -1,10 +1,105 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+layout(constant_id = 0) const uint SHADING_MODE = 0;
 
 layout(location = 0) in vec3 fragColor;
+#ifdef BINDLESS
+layout(location = 1) in vec2 fragVirtualUV;
+layout(location = 2) in vec2 fragTexCoord;
+
+//  Only fragments that pass the depth test may report virtual texture feedback.
+layout(early_fragment_tests) in;
+#endif
 
 layout(location = 0) out vec4 outColor;
 
+//  BINDLESS reads the material from the bindless heap. The set and binding must match BINDLESS_DESCRIPTOR_SET
+//  and BINDLESS_STORAGE_BUFFER in AVulkan.cpp.
+#ifdef BINDLESS
+//  Must match BindlessMaterial in AVulkan.cpp.
+struct Material {
+    vec4 baseColor;
+};
+
+//  Must match VirtualTextureInfo in AVulkan.cpp.
+struct VirtualTextureInfo {
+    uint pageTable;
+    uint cache;
+    uint sampler;
+    uint maxMip;
+    vec2 size;
+    vec2 cacheTexelSize;
+};
+
+//  Every binding of the heap holds one descriptor type, the declarations below alias it per resource.
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 0) uniform utexture2D pageTables[];
+layout(set = 1, binding = 1) uniform sampler samplers[];
+layout(set = 1, binding = 2) readonly buffer Materials { Material materials[]; } buffers[];
+layout(set = 1, binding = 2) readonly buffer VirtualTextures { VirtualTextureInfo info; } virtualTextures[];
+layout(set = 1, binding = 2) writeonly buffer Feedback { uint entries[]; } feedback[];
+
+//  Must match the VIRTUAL_TEXTURE_ constants in AVulkan.cpp.
+const float PAGE_PAYLOAD = 128.0;
+const float PAGE_BORDER = 4.0;
+const float PAGE_SIZE = 136.0;
+const uint FEEDBACK_SCALE = 8;
+const uint INVALID_HANDLE = 0xFFFFFFFF;
+
+//  Must match BindlessDrawConstants in AVulkan.cpp.
+layout(push_constant) uniform Constants {
+    uint materialBuffer;
+    uint material;
+    uint virtualTexture;
+    uint feedbackBuffer;
+    uint feedbackWidth;
+    uint feedbackJitter;
+    uint baseColorTexture;
+    uint baseColorSampler;
+} constants;
+
+//  Looks the page up in the page table, which points at the finest resident level covering it, and reports the
+//  page actually wanted on the pixels of the feedback grid picked by the jitter.
+vec3 SampleVirtualTexture(vec2 uv) {
+    VirtualTextureInfo info = virtualTextures[constants.virtualTexture].info;
+    uv = clamp(uv, vec2(0.0), vec2(1.0 - 1.0 / info.size));
+
+    vec2 texel = uv * info.size;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0));
+    uint mip = min(uint(lod), info.maxMip);
+
+    uvec2 page = uvec2(texel / (PAGE_PAYLOAD * float(1u << mip)));
+    uvec4 entry = texelFetch(usampler2D(pageTables[info.pageTable], samplers[info.sampler]), ivec2(page), int(mip));
+
+    vec2 pagePosition = texel / (PAGE_PAYLOAD * float(1u << entry.z));
+    vec2 cacheTexel = vec2(entry.xy) * PAGE_SIZE + PAGE_BORDER + fract(pagePosition) * PAGE_PAYLOAD;
+    vec3 color = textureLod(sampler2D(textures[info.cache], samplers[info.sampler]), cacheTexel * info.cacheTexelSize, 0.0).rgb;
+
+    uvec2 pixel = uvec2(gl_FragCoord.xy);
+    uvec2 jitter = uvec2(constants.feedbackJitter & 0xFFFF, constants.feedbackJitter >> 16);
+    if (pixel % FEEDBACK_SCALE == jitter) {
+        uvec2 square = pixel / FEEDBACK_SCALE;
+        feedback[constants.feedbackBuffer].entries[square.y * constants.feedbackWidth + square.x] = page.x | page.y << 12 | mip << 24;
+    }
+
+    return color;
+}
+#endif
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    vec3 color = SHADING_MODE == 1 ? vec3(1.0) : fragColor;
+#ifdef BINDLESS
+    color *= buffers[constants.materialBuffer].materials[constants.material].baseColor.rgb;
+    if (constants.baseColorTexture != INVALID_HANDLE)
+        color *= texture(sampler2D(textures[constants.baseColorTexture], samplers[constants.baseColorSampler]), fragTexCoord).rgb;
+    if (constants.virtualTexture != INVALID_HANDLE)
+        color *= SampleVirtualTexture(fragVirtualUV);
+#endif
+    outColor = vec4(color, 1.0);
 }
\ No newline at end of file
@@ -1,21 +1,27 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+
+//  Must match InstanceData in AVulkan.cpp, xyz is the position and w the uniform scale.
+layout(location = 4) in vec4 inInstance;
+
 layout(location = 0) out vec3 fragColor;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+//  The scene has no texture coordinates, the virtual texture is projected onto the xy plane like a terrain's.
+layout(location = 1) out vec2 fragVirtualUV;
+
+//  Streamed textures span one unit of the mesh's own xy plane, RequestStreamedTextureInstances in AVulkan.cpp
+//  sizes their requests from it.
+layout(location = 2) out vec2 fragTexCoord;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+//  Must match depth.vert bit for bit, the forward pass tests EQUAL against the prepass depth.
+invariant gl_Position;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    gl_Position = vec4(inPosition * inInstance.w + inInstance.xyz, 1.0);
+    fragColor = inColor;
+    fragVirtualUV = gl_Position.xy * 0.5 + 0.5;
+    fragTexCoord = inPosition.xy + 0.5;
 }
\ No newline at end of file